@@ -23,72 +23,55 @@
  */
 
 #include <stdio.h>
+#include <limits.h>
+#include <math.h>
 #include <signal.h>
 #include <getopt.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/common.h>
-#include <libavutil/imgutils.h>
 #include <libavutil/mathematics.h>
 #include <libavfilter/avfilter.h>
-#include <libswscale/swscale.h>
 #include <X11/Xlib.h>
 
 #include "anipaper.h"
+#include "queue.h"
 
 /* Queues size. */
 #define MAX_PACKET_QUEUE 128
 #define MAX_PICTURE_QUEUE 8
 
+/* Frames due in less than this (in seconds) are too late. */
+#define LATE_FRAME_SECS 0.010
+
+/* Packets whose decode cost is predicted ahead. */
+#define LOOKAHEAD_PKTS 32
+
+/* Smoothing factor of the decode time statistics (EMA). */
+#define QUEUE_ALPHA 0.05
+
+/* Cooperative mode: pictures that fit the ring. */
+#define COOP_PICS (QUEUE_DEPTH_MAX + 4)
+
+/*
+ * Stream index used to mark a 'flush' packet: signals to the
+ * decode thread that the decoder and the picture queue must
+ * be flushed, i.e: the enqueue thread has just seeked.
+ */
+#define FLUSH_PKT_IDX -1
+
 /*
  * Multiple decode parameters, used during the decoding
  * and playing process.
  */
 struct av_decode_params dp = {0};
 
-/* Termination flags. */
+/* Termination flag. */
 int should_quit = 0;
-int end_pkts = 0;
-int end_pics = 0;
-
-/*
- * Since AVPacketList is marked as 'deprecated', let's
- * use ours.
- */
-struct packet_list
-{
-	AVPacket pkt;
-	struct packet_list *next;
-};
-
-/* Packet queue definition. */
-struct packet_queue
-{
-	struct packet_list *first_packet;
-	struct packet_list *last_packet;
-	int npkts;
-	int size;
-	SDL_mutex *mutex;
-	SDL_cond *cond;
-} packet_queue;
-
-/* Picture list definition. */
-struct picture_list
-{
-	double pts;
-	SDL_Texture *picture;
-	struct picture_list *next;
-};
 
-/* Picture queue definition. */
-struct picture_queue
-{
-	struct picture_list *first_picture;
-	struct picture_list *last_picture;
-	int npics;
-	SDL_mutex *mutex;
-	SDL_cond *cond;
-} picture_queue;
+/* Packet and picture queues. */
+static struct packet_queue packet_queue;
+static struct picture_queue picture_queue;
 
 /* SDL global variables. */
 static Display *x11dip;
@@ -98,7 +81,20 @@ static SDL_mutex *screen_mutex;
 
 static SDL_Thread *enqueue_thread;
 static SDL_Thread *decode_thread;
-static SDL_Thread *pause_thread;
+static SDL_Thread *watchdog_thread;
+
+/* Decoder states, for diagnostic purposes. */
+#define DEC_STATE_IDLE       0
+#define DEC_STATE_WAIT_PKT   1
+#define DEC_STATE_DECODING   2
+#define DEC_STATE_UPLOADING  3
+#define DEC_STATE_WAIT_QUEUE 4
+#define DEC_STATE_FINISHED   5
+static const char *const dec_state_names[] = {
+	"idle", "waiting packet", "decoding", "uploading",
+	"waiting picture queue", "finished"
+};
+static int dec_state;
 
 /* SDL Events. */
 static int SDL_EVENT_REFRESH_SCREEN;
@@ -113,242 +109,288 @@ static int SDL_EVENT_REFRESH_SCREEN;
 #define CMD_HW_ACCEL         64
 #define CMD_BORDERLESS      128
 #define CMD_PAUSE_SIGNAL    256
+#define CMD_WATCHDOG        512
+#define CMD_STALL_RECOVER  1024
+#define CMD_BENCH          2048
+#define CMD_BENCH_PACED    4096
+#define CMD_PACING         8192
+#define CMD_CHECKSUM      16384
+#define CMD_CHECKSUM_PRESENT 32768
+#define CMD_EXPORT        65536
+#define CMD_POWER        131072
+#define CMD_PSI          262144
+#define CMD_BUDGET       524288
+#define CMD_DIRTY_RECTS 1048576
+#define CMD_MOTION      2097152
+#define CMD_LOOKAHEAD   4194304
+#define CMD_QUEUE_ADAPT 8388608
+#define CMD_RENDITIONS  16777216
+#define CMD_COOP        33554432
+#define CMD_POOL        67108864
+#define CMD_AUTOTUNE   134217728
 static int cmd_flags = CMD_BACKGROUND | CMD_LOOP | CMD_RESOLUTION_FIT;
 static char device_type[16];
+static int decode_threads = -1;
+static char bench_renderer[32] = "software";
+static char render_driver[32];
+static int stop_stage = STAGE_PRESENT;
 static int should_pause;
+static int should_dump_stats;
+static int watchdog_periods;
+static double pacing_secs;
+static double pacing_tolerance = 5.0;
+static const char *checksum_path;
+static int checksum_verify;
+static const char *export_dir;
+static int export_fmt = EXPORT_FMT_PPM;
+static unsigned long export_first;
+static unsigned long export_last = ULONG_MAX;
+static int export_threads;
+static int pool_threads;
+static int tune_retune;
+static int occlusion_threshold = SCREEN_AREA_THRESHOLD;
+static const char *ac_spec;
+static const char *battery_spec;
+static struct perf_profile ac_profile;
+static struct perf_profile battery_profile;
+static int on_battery;
+static int throttle_level;
+static int throttle_pause;
+static SDL_mutex *knobs_mutex;
+static int bg_sched = BG_SCHED_NONE;
+static double next_check;
+static const char *affinity_spec;
+static double cpu_budget;
+static struct perf_profile budget_profile;
+static int budget_pause;
+
+/* Occlusion scan in flight (task pool) and its last result. */
+static int occlusion_busy;
+static int occlusion_area;
 
-/**
- * @brief Initialize the packet queue.
- *
- * @param q Packet queue.
- *
- * @return Returns 0 if sucess, -1 otherwise.
+/*
+ * Picture queue depth: bounds, depth wanted by the decode time
+ * jitter (or the lower bound) and extra depth for the expensive
+ * packets ahead.
+ */
+static int queue_min = MAX_PICTURE_QUEUE;
+static int queue_limit = MAX_PICTURE_QUEUE;
+static int queue_base;
+static int queue_ahead;
+
+/* Decode time statistics and missed deadlines. */
+static double jitter_mean;
+static double jitter_var;
+static int jitter_penalty;
+static unsigned long jitter_misses;
+static double jitter_calm;
+
+/*
+ * Cooperative (single-threaded) mode: decoded pictures waiting
+ * to be presented (a ring, in place of the picture queue), next
+ * frame tick, end of the input and the usual cost (in seconds)
+ * of a decode step.
  */
-static int init_packet_queue(struct packet_queue *q)
+static struct coop_picture
 {
-	memset(q, 0, sizeof(*q));
-	q->mutex = SDL_CreateMutex();
-	q->cond  = SDL_CreateCond();
-	if (!q->mutex || !q->cond)
-		LOG_GOTO("Unable to create SDL mutexes/cond!\n", out);
-	return (0);
-out:
-	return (-1);
-}
+	SDL_Texture *picture;
+	double pts;
+} coop_pics[COOP_PICS];
+static int coop_head;
+static int coop_npics;
+static double coop_tick;
+static int coop_eof;
+static double coop_step_secs;
+static AVPacket *coop_packet;
+static AVFrame *coop_sw_frame;
+static AVFrame *coop_hw_frame;
+
+/*
+ * Throttle levels: FPS cap and quality floor, combined with the
+ * current profile (the lowest FPS cap and quality always win).
+ */
+static const struct perf_profile throttle_profiles[THROTTLE_NR] = {
+	/* fps, threads, quality, occlusion. */
+	{0,  -1, 0,           100}, /* THROTTLE_NONE.    */
+	{15, -1, 1,           100}, /* THROTTLE_REDUCED. */
+	{10, -1, 2,           100}, /* THROTTLE_MINIMAL. */
+	{10, -1, QUALITY_MAX, 100}  /* THROTTLE_PAUSED.  */
+};
 
 /**
- * @brief Releases all resources related to the packet
- * queue, including the elements itself.
+ * @brief Releases the texture @p picture, already presented
+ * or dropped: recycled if the dirty regions are tracked,
+ * destroyed otherwise.
  *
- * @param q Packet queue to be freed.
+ * @param picture Texture to be released.
  */
-static void finish_packet_queue(struct packet_queue *q)
+static void release_picture(SDL_Texture *picture)
 {
-	struct packet_list *pkl;
-	struct packet_list *pkl_next;
-
-	if (!q)
-		return;
-	if (!q->mutex)
-		SDL_DestroyMutex(q->mutex);
-	if (!q->cond)
-		SDL_DestroyCond(q->cond);
-
-	/* Go through the queue and clear everything. */
-	pkl = q->first_packet;
-	while (pkl)
-	{
-		pkl_next = pkl->next;
-			av_packet_unref(&pkl->pkt);
-			av_free(pkl);
-		pkl = pkl_next;
-	}
+	if (cmd_flags & CMD_DIRTY_RECTS)
+		dirty_release(picture);
+	else
+		SDL_DestroyTexture(picture);
 }
 
 /**
- * @brief Add a new packet @p src_pkt to the queue.
- *
- * It is important to note that this routine is blocking and if
- * there are no space left, the thread remains in blocking state
- * until there are room available.
+ * @brief Cooperative mode: adds the picture @p picture with
+ * pts @p pts to the ring.
  *
- * @param q Packet queue.
- * @param src_pkt Packet to be added.
+ * @param picture Texture.
+ * @param pts Picture pts (in seconds).
  *
- * @return Returns 1 if success, -1 otherwise.
+ * @return Returns 1 if success, -1 if the ring is full.
  */
-static int packet_queue_put(struct packet_queue *q, AVPacket *src_pkt)
+static int coop_put(SDL_Texture *picture, double pts)
 {
-	struct packet_list *pkl;
+	struct coop_picture *cp;
 
-	pkl = av_malloc(sizeof(*pkl));
-	if (!pkl)
+	if (coop_npics == COOP_PICS)
 		return (-1);
 
-	/* Fill our new node. */
-	pkl->pkt  = *src_pkt;
-	pkl->next = NULL;
-
-	/* Add to our list. */
-	SDL_LockMutex(q->mutex);
-		while (1)
-		{
-			if (should_quit)
-				break;
-
-			/* Sleep until a new space or if we should quit. */
-			if (q->npkts == MAX_PACKET_QUEUE)
-			{
-				SDL_CondWait(q->cond, q->mutex);
-				continue;
-			}
-
-			if (!q->last_packet)
-				q->first_packet = pkl;
-			else
-				q->last_packet->next = pkl;
-			q->last_packet = pkl;
-
-			q->npkts++;
-			q->size += src_pkt->size;
-			SDL_CondSignal(q->cond);
-			break;
-		}
-	SDL_UnlockMutex(q->mutex);
+	cp = &coop_pics[(coop_head + coop_npics) % COOP_PICS];
+	cp->picture = picture;
+	cp->pts = pts;
+	coop_npics++;
 	return (1);
 }
 
 /**
- * @brief Removes a packet from the queue and returns it
- * as @p pk.
- *
- * It is important to note that this routine is blocking and if
- * there are no new packets, the thread remains in blocking state
- * until there are new packets.
+ * @brief Cooperative mode: evicts the pictures at the head of
+ * the ring with pts between @p min_pts and @p max_pts, as in
+ * picture_queue_evict().
  *
- * @param q Packet queue.
- * @param pk Returned packet.
+ * @param min_pts Lowest pts evicted.
+ * @param max_pts Pts from which pictures are kept.
  *
- * @return Returns 1 if success, -1 otherwise.
+ * @return Returns the amount of pictures evicted.
  */
-static int packet_queue_get(struct packet_queue *q, AVPacket *pk)
+static int coop_evict(double min_pts, double max_pts)
 {
-	int ret;
-	struct packet_list *pkl;
-
-	ret = -1;
-
-	SDL_LockMutex(q->mutex);
-		while (1)
-		{
-			/* Should we abort? */
-			if (should_quit || (end_pkts && !q->npkts))
-				break;
-
-			pkl = q->first_packet;
-
-			/* If empty, lets wait for something. */
-			if (!pkl)
-			{
-				SDL_CondWait(q->cond, q->mutex);
-				continue;
-			}
-
-			/* If something, remove head node and return. */
-			q->first_packet = pkl->next;
-			if (!q->first_packet)
-				q->last_packet = NULL;
-
-			q->npkts--;
-			q->size -= pkl->pkt.size;
-			*pk = pkl->pkt;
+	struct coop_picture *cp;
+	int n;
 
-			/* Release our node. */
-			av_free(pkl);
-			ret = 1;
+	for (n = 0; coop_npics; n++)
+	{
+		cp = &coop_pics[coop_head];
+		if (cp->pts < min_pts || cp->pts >= max_pts)
 			break;
-		}
-		SDL_CondSignal(q->cond);
-	SDL_UnlockMutex(q->mutex);
 
-	return (ret);
+		release_picture(cp->picture);
+		coop_head = (coop_head + 1) % COOP_PICS;
+		coop_npics--;
+	}
+	return (n);
 }
 
 /**
- * @brief Initialize the picture queue.
+ * @brief Gets the next picture to be presented, from the
+ * picture queue (blocking) or, in cooperative mode, from
+ * the ring.
  *
- * @param q Picture queue.
+ * @param sdl_pic Returned picture.
+ * @param pts Returned picture pts.
  *
- * @return Returns 0 if sucess, -1 otherwise.
+ * @return Returns 1 if success, 0 if there is no picture
+ * decoded yet (cooperative mode only) and -1 if there are
+ * no more pictures.
  */
-static int init_picture_queue(struct picture_queue *q)
+static int get_picture(SDL_Texture **sdl_pic, double *pts)
 {
-	memset(q, 0, sizeof(*q));
-	q->mutex = SDL_CreateMutex();
-	q->cond  = SDL_CreateCond();
-	if (!q->mutex || !q->cond)
-		LOG_GOTO("Unable to create SDL mutexes/cond in picture_queue!\n",
-			out);
-	return (0);
-out:
-	return (-1);
+	if (!(cmd_flags & CMD_COOP))
+		return (picture_queue_get(&picture_queue, sdl_pic, pts));
+
+	if (!coop_npics)
+		return (coop_eof ? -1 : 0);
+
+	*sdl_pic = coop_pics[coop_head].picture;
+	*pts = coop_pics[coop_head].pts;
+	coop_head = (coop_head + 1) % COOP_PICS;
+	coop_npics--;
+	return (1);
 }
 
 /**
- * @brief Releases all resources related to the picture
- * queue, including the elements itself.
+ * @brief Checks if the presentation clock can be trusted by
+ * the producer: known, running and not about to be restarted
+ * (after a flush).
+ *
+ * @param dp av_decode_params structure.
  *
- * @param q Picture queue to be freed.
+ * @return Returns 1 if so, 0 otherwise.
  */
-static void finish_picture_queue(struct picture_queue *q)
+static int clock_known(struct av_decode_params *dp)
 {
-	struct picture_list *pl;
-	struct picture_list *pl_next;
-
-	if (!q)
-		return;
-	if (!q->mutex)
-		SDL_DestroyMutex(q->mutex);
-	if (!q->cond)
-		SDL_DestroyCond(q->cond);
-
-	/* Go through the queue and clear everything. */
-	pl = q->first_picture;
-	while (pl)
-	{
-		pl_next = pl->next;
-			SDL_DestroyTexture(pl->picture);
-			av_free(pl);
-		pl = pl_next;
-	}
+	return (dp->clock_base != 0 && !dp->paused && !dp->resync);
 }
 
 /**
- * @brief Add a complete frame @p src_frm to the queue.
- *
- * It is important to note that this routine is blocking and if
- * there are no space left, the thread remains in blocking state
- * until there are room available.
+ * @brief Uploads the frame @p src_frm into a new texture
+ * (or only its dirty regions, into a recycled one) and adds
+ * it to the picture queue.
  *
  * @param dp av_decode_params structure.
- * @param q Picture queue.
  * @param src_frm Frame to be added.
  *
  * @return Returns 1 if success, -1 otherwise.
  */
-static int picture_queue_put(struct av_decode_params *dp,
-	struct picture_queue *q, AVFrame *src_frm)
+static int upload_frame(struct av_decode_params *dp, AVFrame *src_frm)
 {
-	int ret;
-	struct picture_list *pl;
+	double pts;
+	double start;
+	double area;
+	double now;
 	SDL_Texture *picture;
 
-	ret = -1;
+	/*
+	 * Evict the queued frames that are already too late, and
+	 * do not even upload this one if it is too late as well:
+	 * the presentation would throw them away anyway.
+	 */
+	pts = (double)src_frm->best_effort_timestamp * dp->time_base;
+	if (clock_known(dp))
+	{
+		now = time_secs();
+		if (cmd_flags & CMD_COOP)
+		{
+			stats.frames_evicted += coop_evict(stats.last_pts,
+				now + LATE_FRAME_SECS - dp->clock_base);
+		}
+		else
+		{
+			SDL_LockMutex(screen_mutex);
+				stats.frames_evicted += picture_queue_evict(&picture_queue,
+					stats.last_pts, now + LATE_FRAME_SECS - dp->clock_base,
+					release_picture);
+			SDL_UnlockMutex(screen_mutex);
+		}
+
+		if (pts >= stats.last_pts &&
+			dp->clock_base + pts - now < LATE_FRAME_SECS)
+		{
+			stats.frames_evicted++;
+			av_frame_unref(src_frm);
+			return (1);
+		}
+	}
+
+	/* Only the regions that changed, into a recycled texture. */
+	if (cmd_flags & CMD_DIRTY_RECTS)
+	{
+		start = time_secs();
+		SDL_LockMutex(screen_mutex);
+			picture = dirty_upload(renderer, src_frm, &area);
+		SDL_UnlockMutex(screen_mutex);
+		stats.stage_secs[STAGE_UPLOAD] += time_secs() - start;
+		if (!picture)
+			return (-1);
 
-	/* Allocate a new node and put in the list. */
-	pl = av_malloc(sizeof(*pl));
-	if (!pl)
-		return (-1);
+		stats.dirty_frames++;
+		stats.dirty_area += area;
+		if (area < 100.0)
+			stats.dirty_partial++;
+		goto enqueue;
+	}
 
 	/*
 	 * Create a SDL_Texture.
@@ -358,6 +400,7 @@ static int picture_queue_put(struct av_decode_params *dp,
 	 *
 	 * TODO: Handle non-YUV frames.
 	 */
+	start = time_secs();
 	SDL_LockMutex(screen_mutex);
 		picture = SDL_CreateTexture(renderer,
 			SDL_PIXELFORMAT_YV12,
@@ -367,111 +410,39 @@ static int picture_queue_put(struct av_decode_params *dp,
 		if (!picture)
 		{
 			SDL_UnlockMutex(screen_mutex);
-			av_free(pl);
 			return (-1);
 		}
 
-		/* Fill our new node with a new SDL_Surface. */
+		/* Fill our new texture. */
 		SDL_UpdateYUVTexture(picture, NULL,
 			src_frm->data[0], src_frm->linesize[0],
 			src_frm->data[1], src_frm->linesize[1],
 			src_frm->data[2], src_frm->linesize[2]);
 	SDL_UnlockMutex(screen_mutex);
+	stats.stage_secs[STAGE_UPLOAD] += time_secs() - start;
 
-	pl->pts = (double)src_frm->best_effort_timestamp * dp->time_base;
-	pl->picture = picture;
-	pl->next = NULL;
-
+enqueue:
 	/* Free frame buffers. */
 	av_frame_unref(src_frm);
 
 	/* Add to our list. */
-	SDL_LockMutex(q->mutex);
-		while (1)
-		{
-			if (should_quit)
-			{
-				ret = -1;
-				break;
-			}
-
-			/* Sleep until a new space or if we should quit. */
-			if (q->npics == MAX_PICTURE_QUEUE)
-			{
-				SDL_CondWait(q->cond, q->mutex);
-				continue;
-			}
-
-			if (!q->last_picture)
-				q->first_picture = pl;
-			else
-				q->last_picture->next = pl;
-			q->last_picture = pl;
-
-			ret = 1;
-			q->npics++;
-			SDL_CondSignal(q->cond);
-			break;
-		}
-	SDL_UnlockMutex(q->mutex);
-	return (ret);
-}
-
-/**
- * @brief Removes a full frame from the queue and returns it
- * as @p sdl_pic and @p pts.
- *
- * It is important to note that this routine is blocking and if
- * there are no new frames, the thread remains in blocking until
- * there are new frames.
- *
- * @param q Picture queue.
- * @param sdl_pic Returned frame to be drawn.
- * @param pts Returned frame pts.
- *
- * @return Returns 1 if success, -1 otherwise.
- */
-static int picture_queue_get(struct picture_queue *q, SDL_Texture **sdl_pic,
-	double *pts)
-{
-	int ret;
-	struct picture_list *pl;
-
-	ret = -1;
-
-	SDL_LockMutex(q->mutex);
-		while (1)
+	dec_state = DEC_STATE_WAIT_QUEUE;
+	if (cmd_flags & CMD_COOP)
+	{
+		if (coop_put(picture, pts) < 0)
 		{
-			if (should_quit || (end_pics && !q->npics))
-				break;
-
-			pl = q->first_picture;
-
-			/* If empty, lets wait for something. */
-			if (!pl)
-			{
-				SDL_CondWait(q->cond, q->mutex);
-				continue;
-			}
-
-			/* If something, remove head node and return. */
-			q->first_picture = pl->next;
-			if (!q->first_picture)
-				q->last_picture = NULL;
-
-			q->npics--;
-			*sdl_pic = pl->picture;
-			*pts = pl->pts;
-
-			/* Release our node. */
-			av_free(pl);
-			ret = 1;
-			break;
+			release_picture(picture);
+			stats.frames_evicted++;
 		}
-		SDL_CondSignal(q->cond);
-	SDL_UnlockMutex(q->mutex);
-
-	return (ret);
+	}
+	else if (picture_queue_put(&picture_queue, picture, pts) < 0)
+	{
+		SDL_LockMutex(screen_mutex);
+			release_picture(picture);
+		SDL_UnlockMutex(screen_mutex);
+		return (-1);
+	}
+	return (1);
 }
 
 /**
@@ -500,7 +471,11 @@ static Uint32 refresh_screen_callback(Uint32 interval, void *data)
  */
 static void schedule_refresh(struct av_decode_params *dp, int delay)
 {
-	SDL_AddTimer(delay, refresh_screen_callback, dp);
+	/* Cooperative mode: the main loop keeps track of it. */
+	if (cmd_flags & CMD_COOP)
+		coop_tick = time_secs() + delay / 1000.0;
+	else
+		SDL_AddTimer(delay, refresh_screen_callback, dp);
 }
 
 /**
@@ -508,13 +483,15 @@ static void schedule_refresh(struct av_decode_params *dp, int delay)
  * command line parameters into account.
  *
  * @param texture_frame Frame to be drawn.
+ * @param pts Frame pts (in seconds).
  * @param dp av_decode_params structure.
  */
-static void draw_frame(SDL_Texture *texture_frame,
+static void draw_frame(SDL_Texture *texture_frame, double pts,
 	struct av_decode_params *dp)
 {
 	SDL_Rect dst = {0};
 	SDL_Rect *dst_ptr;
+	double start;
 	double w_ratio;
 	double h_ratio;
 	double b_ratio;
@@ -570,11 +547,16 @@ static void draw_frame(SDL_Texture *texture_frame,
 		}
 	}
 
+	start = time_secs();
 	SDL_LockMutex(screen_mutex);
 		SDL_RenderClear(renderer);
 		SDL_RenderCopy(renderer, texture_frame, NULL, dst_ptr);
+		if (cmd_flags & CMD_CHECKSUM_PRESENT)
+			checksum_surface(renderer, llrint(pts / dp->time_base));
 		SDL_RenderPresent(renderer);
 	SDL_UnlockMutex(screen_mutex);
+	stats.stage_secs[STAGE_PRESENT] += time_secs() - start;
+	stats.frames_presented++;
 }
 
 /**
@@ -619,6 +601,7 @@ static double adjust_timers(double pts, struct av_decode_params *dp)
 	 * If we are too late, we ignore the frame.
 	 */
 	dp->frame_timer += delay;
+	dp->clock_base = dp->frame_timer - pts;
 	true_delay = dp->frame_timer - time_secs();
 	return (true_delay);
 }
@@ -632,122 +615,326 @@ static double adjust_timers(double pts, struct av_decode_params *dp)
  */
 static void change_execution(struct av_decode_params *dp, int should_pause)
 {
-	SDL_LockMutex(dp->pause_mutex);
-		if (should_pause)
-		{
-			if (!dp->paused)
-				dp->time_before_pause = time_secs();
-			else
-				goto out;
-		}
-
-		/* Resume. */
+	if (should_pause)
+	{
+		if (!dp->paused)
+			dp->time_before_pause = time_secs();
 		else
+			return;
+	}
+
+	/* Resume. */
+	else
+	{
+		if (dp->paused)
 		{
-			if (dp->paused)
-				dp->frame_timer += (time_secs() - dp->time_before_pause);
-			else
-				goto out;
+			dp->frame_timer += (time_secs() - dp->time_before_pause);
+			dp->clock_base = dp->frame_timer - dp->frame_last_pts;
 		}
+		else
+			return;
+	}
 
-		dp->paused = !dp->paused;
-		SDL_CondSignal(dp->pause_cond);
-out:
-	SDL_UnlockMutex(dp->pause_mutex);
+	if (cmd_flags & CMD_PACING)
+		pacing_pause_event(!dp->paused, time_secs());
+
+	dp->paused = !dp->paused;
 }
 
 /**
- * @brief Checks at fixed interval if the total area
- * of the non-minimized windows is greater than
- * some threshold, if so, pause the Anipaper execution,
- * otherwise, resume.
+ * @brief Restricts the FPS cap and quality level of @p dp
+ * to the limits @p t: the lowest FPS cap and quality win.
  *
- * This executes in another thread.
+ * @param dp av_decode_params structure.
+ * @param t Limits.
+ */
+static void limit_knobs(struct av_decode_params *dp,
+	const struct perf_profile *t)
+{
+	if (t->fps_cap > 0 && (dp->fps_cap <= 0 || t->fps_cap < dp->fps_cap))
+		dp->fps_cap = t->fps_cap;
+	dp->quality = FFMAX(dp->quality, t->quality);
+}
+
+/**
+ * @brief Combines the current power profile with the current
+ * throttle level and CPU budget limits, and updates the decoder
+ * knobs, FPS cap and occlusion threshold. The decoder knobs are
+ * applied by the decode thread itself, before the next packet.
+ *
+ * @param dp av_decode_params structure.
+ */
+static void update_knobs(struct av_decode_params *dp)
+{
+	const struct perf_profile *p;
+
+	SDL_LockMutex(knobs_mutex);
+		p = on_battery ? &battery_profile : &ac_profile;
+
+		dp->fps_cap = p->fps_cap;
+		dp->quality = p->quality;
+		dp->threads = p->threads;
+		occlusion_threshold = p->occlusion;
+
+		limit_knobs(dp, &throttle_profiles[throttle_level]);
+		if (cmd_flags & CMD_BUDGET)
+			limit_knobs(dp, &budget_profile);
+
+		throttle_pause = (throttle_level == THROTTLE_PAUSED) ||
+			budget_pause;
+	SDL_UnlockMutex(knobs_mutex);
+}
+
+/**
+ * @brief Occlusion scan task: the X server round trips happen
+ * in the task pool, out of the presentation thread.
  *
  * @param arg av_decode_params structure.
+ * @param job Unused.
+ */
+static void scan_occlusion(void *arg, int job)
+{
+	struct av_decode_params *dp;
+
+	((void)job);
+	dp = (struct av_decode_params *)arg;
+
+	occlusion_area = screen_area_used(x11dip, dp->screen_width,
+		dp->screen_height);
+	occlusion_busy = 0;
+}
+
+/**
+ * @brief Checks if the total area of the non-minimized windows
+ * is greater than some threshold (or if paused by signal,
+ * throttling or CPU budget), if so, pause the Anipaper
+ * execution, otherwise, resume.
  *
- * @return Always returns 0.
+ * @param dp av_decode_params structure.
  */
-static int pause_execution_thread(void *data)
+static void check_pause(struct av_decode_params *dp)
 {
 	int sp;
+	int idx;
 	int s_area;
-	struct av_decode_params *dp;
-
-	dp = (struct av_decode_params *)data;
 
-	while (1)
+	sp = should_pause;
+	if (!sp && (cmd_flags & CMD_PACING))
+		sp = pacing_should_pause();
+	if ((cmd_flags & CMD_BUDGET) && budget_update(&budget_profile,
+		&budget_pause))
 	{
-		if (should_quit)
-			break;
-
-		sp = should_pause;
-		if (!sp && (cmd_flags & CMD_BACKGROUND))
+		update_knobs(dp);
+	}
+	/* The dirty regions pool is sized for a single resolution. */
+	if ((cmd_flags & (CMD_RENDITIONS|CMD_DIRTY_RECTS)) == CMD_RENDITIONS)
+	{
+		idx = rendition_update(dp->quality);
+		if (idx >= 0)
+			dp->next_idx = idx;
+	}
+	if (!sp && throttle_pause)
+		sp = 1;
+	if (!sp && (cmd_flags & CMD_BACKGROUND))
+	{
+		/* Task pool: the last scan is used, the next one queued. */
+		if (pool_size())
+		{
+			if (!occlusion_busy)
+			{
+				occlusion_busy = 1;
+				pool_submit(scan_occlusion, dp, POOL_PRIO_BACKGROUND);
+			}
+			s_area = occlusion_area;
+		}
+		else
 		{
 			s_area = screen_area_used(x11dip, dp->screen_width,
 				dp->screen_height);
-
-			if (s_area > SCREEN_AREA_THRESHOLD)
-				sp = 1;
 		}
 
-		/* Changes or keeps execution mode. */
-		change_execution(dp, sp);
+		if (s_area > occlusion_threshold)
+			sp = 1;
+	}
+
+	/* Changes or keeps execution mode. */
+	change_execution(dp, sp);
+}
+
+/**
+ * @brief Runs the periodic work (pause checks) that is due,
+ * or that would be due within @p slack seconds.
+ *
+ * This is called by the main thread at each frame tick, so,
+ * while playing, the periodic work never needs a wakeup of
+ * its own: it runs right after a frame is presented and the
+ * next tick is scheduled, within the time left until then.
+ *
+ * @param dp av_decode_params structure.
+ * @param slack How early (in seconds) the work may run.
+ *
+ * @return Returns the time until the next periodic work
+ * (in ms).
+ */
+static int periodic_work(struct av_decode_params *dp, double slack)
+{
+	double now;
 
+	now = time_secs();
+	if (now + slack >= next_check)
+	{
 		/* Check again in CHECK_PAUSE_MS (100ms, by default). */
-		SDL_Delay(CHECK_PAUSE_MS);
+		next_check = now + CHECK_PAUSE_MS / 1000.0;
+		if (cmd_flags & (CMD_BACKGROUND|CMD_PAUSE_SIGNAL))
+			check_pause(dp);
 	}
+	return (FFMAX((int)((next_check - now) * 1000.0 + 0.5), 1));
+}
 
-	return (0);
+/**
+ * @brief Dumps the state of the whole pipeline: queues,
+ * termination flags, threads activity and decoder state.
+ *
+ * @param dp av_decode_params structure.
+ *
+ * @note The queues are read without its locks on purpose:
+ * a stalled thread may be holding them.
+ */
+static void dump_pipeline_state(struct av_decode_params *dp)
+{
+	LOG("  packet queue:  %d pkts (%d bytes), end: %d, wakeups: %lu\n",
+		packet_queue.npkts, packet_queue.size, packet_queue.end,
+		packet_queue.wakeups);
+	LOG("  picture queue: %d/%d pics, end: %d, wakeups: %lu\n",
+		picture_queue.npics, picture_queue.max, picture_queue.end,
+		picture_queue.wakeups);
+	LOG("  decoder: %s, frames decoded: %lu, threads: %d\n",
+		dec_state_names[dec_state], stats.frames_decoded,
+		dp->codec_context->thread_count);
+	stats_dump(stderr);
 }
 
 /**
- * @brief Updates the screen periodically, until
- * there is no more data to be processed.
+ * @brief Checks at fixed interval if a frame was presented
+ * within the last watchdog_periods frame periods. If not
+ * (and not paused), reports the stall and optionally asks
+ * the enqueue thread to recover.
+ *
+ * This executes in another thread.
  *
  * @param data av_decode_params structure.
+ *
+ * @return Always returns 0.
  */
-static void refresh_screen(void *data)
+static int watchdog_execution_thread(void *data)
 {
-	int ret;
-	SDL_Event event;
 	struct av_decode_params *dp;
-	SDL_Texture *texture_frame;
-
-	double true_delay;
-	double pts;
+	double last_alive;
+	double limit;
+	double now;
+	int stalled;
 
 	dp = (struct av_decode_params *)data;
-	texture_frame = NULL;
-again:
+	last_alive = time_secs();
+	stalled = 0;
 
-	if (!(cmd_flags & (CMD_PAUSE_SIGNAL|CMD_BACKGROUND)))
-		goto not_pause;
+	sched_timer_slack(BG_TIMER_SLACK_NS);
 
-	SDL_LockMutex(dp->pause_mutex);
-	check_pause:
-		if (dp->paused && !should_quit)
-		{
-			/*
-			 * Wait up to 40ms, as we need to check if there is a
-			 * possible SDL_QUIT event to be handled, otherwise,
-			 * the program would not be terminated until restarted
-			 * from pause.
-			 */
-			SDL_CondWaitTimeout(dp->pause_cond, dp->pause_mutex, 40);
-
-			/* Check if there is a SDL_QUIT event. */
-			SDL_PumpEvents();
-			ret = SDL_PeepEvents(&event, 1, SDL_PEEKEVENT, SDL_QUIT,
-				SDL_QUIT);
-			if (!ret)
-				goto check_pause;
-			else
-				return;
+	while (!should_quit)
+	{
+		/*
+		 * Sleep until the earliest time a stall could be
+		 * reported, instead of polling.
+		 */
+		if (stats.last_present > last_alive)
+			last_alive = stats.last_present;
+		limit = watchdog_periods * dp->frame_last_delay;
+		SDL_Delay(FFMAX((int)((last_alive + limit - time_secs()) * 1000.0),
+			WATCHDOG_CHECK_MS));
+
+		stats.wakeups++;
+		now = time_secs();
+
+		/* Paused time do not count. */
+		if (dp->paused)
+		{
+			last_alive = now;
+			continue;
+		}
+
+		if (stats.last_present > last_alive)
+			last_alive = stats.last_present;
+
+		if (now - last_alive < limit)
+		{
+			stalled = 0;
+			continue;
+		}
+
+		/* Report only once per stall. */
+		if (stalled)
+			continue;
+
+		stalled = 1;
+		stats.stalls++;
+
+		LOG("watchdog: no frame presented for %.3fs (%d periods)!\n",
+			now - last_alive, watchdog_periods);
+		dump_pipeline_state(dp);
+
+		if (cmd_flags & CMD_STALL_RECOVER)
+		{
+			LOG("watchdog: trying to recover, seeking to %.3f...\n",
+				stats.last_pts);
+			/*
+			 * Abort first: the enqueue thread may be waiting for
+			 * room (or parked at the end of the file), and the
+			 * recovery flush is what clears the abort.
+			 */
+			packet_queue_abort(&packet_queue);
+			dp->stall_recover = 1;
+		}
+	}
+
+	return (0);
+}
+
+/**
+ * @brief Updates the screen periodically, until
+ * there is no more data to be processed.
+ *
+ * @param data av_decode_params structure.
+ */
+static void refresh_screen(void *data)
+{
+	SDL_Event event;
+	struct av_decode_params *dp;
+	SDL_Texture *texture_frame;
+
+	double true_delay;
+	double pts;
+	int next_ms;
+	int ret;
+
+	dp = (struct av_decode_params *)data;
+	texture_frame = NULL;
+	stats.wakeups++;
+
+	/*
+	 * Paused: nothing to show, just sleep until the next
+	 * check (SDL_QUIT events are handled meanwhile).
+	 */
+	if (dp->paused)
+	{
+		next_ms = periodic_work(dp, dp->frame_last_delay / 2);
+		if (dp->paused)
+		{
+			schedule_refresh(dp, next_ms);
+			return;
 		}
-	SDL_UnlockMutex(dp->pause_mutex);
+	}
 
-not_pause:
+again:
 	/*
 	 * If error, do nothing.
 	 *
@@ -760,7 +947,8 @@ not_pause:
 	 * every time, wasting resources. The timer should
 	 * always be adjusted anyway.
 	 */
-	if (picture_queue_get(&picture_queue, &texture_frame, &pts) < 0)
+	ret = get_picture(&texture_frame, &pts);
+	if (ret < 0)
 	{
 		/*
 		 * If everything is over, send an event to myself signaling
@@ -771,21 +959,48 @@ not_pause:
 		return;
 	}
 
+	/* Cooperative mode, nothing decoded: right after the decoding. */
+	else if (!ret)
+	{
+		schedule_refresh(dp, 0);
+		return;
+	}
+	stats.queue_depth_sum += (cmd_flags & CMD_COOP) ? coop_npics :
+		picture_queue.npics;
+	stats.queue_depth_samples++;
+
+	/*
+	 * If the pipeline was just flushed (due to a stall recovery),
+	 * restart our timers from the current time, otherwise all the
+	 * frames would be considered late.
+	 */
+	if (dp->resync)
+	{
+		dp->resync = 0;
+		dp->frame_timer = time_secs();
+		dp->frame_last_pts = pts;
+	}
+
 	/* === Adjust timers === */
 	true_delay = adjust_timers(pts, dp);
 
 	/* If less than 10ms, skip the frame and read the next. */
-	if (true_delay < 0.010)
+	if (true_delay < LATE_FRAME_SECS)
 	{
-		SDL_DestroyTexture(texture_frame);
+		release_picture(texture_frame);
+		stats.frames_dropped++;
 		goto again;
 	}
 
 	/* Update screen. */
-	draw_frame(texture_frame, dp);
+	draw_frame(texture_frame, pts, dp);
+	stats.last_present = time_secs();
+	stats.last_pts = pts;
+	if (cmd_flags & CMD_PACING)
+		pacing_record(pts, stats.last_present);
 
 	/* Release resources. */
-	SDL_DestroyTexture(texture_frame);
+	release_picture(texture_frame);
 
 	/*
 	 * Set our new timer, with the adjusted delay.
@@ -794,6 +1009,99 @@ not_pause:
 	 * need to convert first and round the result.
 	 */
 	schedule_refresh(dp, (int)((true_delay * 1000) + 0.5));
+
+	/*
+	 * Periodic work, coalesced with this frame tick: after the
+	 * present, so its latency (e.g: X round trips) falls in the
+	 * slack until the next one.
+	 */
+	periodic_work(dp, true_delay);
+}
+
+/**
+ * @brief Checks if the frame with pts @p pts should be skipped
+ * in order to respect the frame rate @p fps, given the next pts
+ * allowed @p next_pts (updated if the frame is kept).
+ *
+ * @param pts Frame pts (in seconds).
+ * @param fps Frame rate.
+ * @param next_pts Next pts allowed.
+ *
+ * @return Returns 1 if the frame should be skipped, 0
+ * otherwise.
+ */
+static int rate_skip(double pts, double fps, double *next_pts)
+{
+	double period;
+
+	period = 1.0 / fps;
+
+	/*
+	 * Too early, skip. Half a frame of tolerance avoids
+	 * skipping frames due to rounding errors in the pts.
+	 */
+	if (pts < *next_pts - period / 2 &&
+		pts > *next_pts - 2 * period)
+	{
+		return (1);
+	}
+
+	/*
+	 * Keep frame: if too far (seek or loop), restart the
+	 * schedule from the current pts.
+	 */
+	*next_pts += period;
+	if (fabs(pts - *next_pts) > 2 * period)
+		*next_pts = pts + period;
+	return (0);
+}
+
+/**
+ * @brief Checks if the frame @p frm should be skipped in
+ * order to respect the FPS cap (if any).
+ *
+ * Skipping here (right after decoding), avoids the cost of
+ * converting and uploading a frame that would never be shown.
+ *
+ * @param dp av_decode_params structure.
+ * @param frm Decoded frame.
+ *
+ * @return Returns 1 if the frame should be skipped, 0
+ * otherwise.
+ */
+static int fps_cap_skip(struct av_decode_params *dp, AVFrame *frm)
+{
+	if (dp->fps_cap <= 0)
+		return (0);
+
+	return (rate_skip((double)frm->best_effort_timestamp * dp->time_base,
+		dp->fps_cap, &dp->cap_next_pts));
+}
+
+/**
+ * @brief Checks if the frame @p frm should be skipped because
+ * the scene barely moves: the motion-adaptive rate is lowered
+ * during low-motion segments.
+ *
+ * @param dp av_decode_params structure.
+ * @param frm Decoded frame, in system memory.
+ *
+ * @return Returns 1 if the frame should be skipped, 0
+ * otherwise.
+ */
+static int motion_skip(struct av_decode_params *dp, AVFrame *frm)
+{
+	double pts;
+	double start;
+	double fps;
+
+	pts = (double)frm->best_effort_timestamp * dp->time_base;
+
+	start = time_secs();
+	fps = motion_fps(frm, pts);
+	stats.motion_secs += time_secs() - start;
+
+	return (rate_skip(pts, fps, &dp->motion_next_pts));
 }
 
 /**
@@ -801,28 +1109,45 @@ not_pause:
  * @p dp decode context, decode the packet and saves
  * the resulting frame in the picture queue.
  *
- * @param packet Packet to be decoded.
+ * @param packet Packet to be decoded, NULL to drain the
+ * decoder (i.e: get the frames it still holds).
  * @param frame Destination frame.
  * @param dp av_decode_params structure.
+ * @param decode_secs Time spent in the decoder alone.
  *
  * @return Returns 0 if success, -1 otherwise.
  */
 static int decode_packet(AVPacket *packet,
 	AVFrame *src_frame, AVFrame *dst_frame,
-	struct av_decode_params *dp)
+	struct av_decode_params *dp, double *decode_secs)
 {
 	int ret;
+	double start;
 	AVFrame *frame;
 
+	/* Deadline of the decoder jobs on the task pool. */
+	if (packet)
+	{
+		dp->decode_pts = (double)(packet->pts != AV_NOPTS_VALUE ?
+			packet->pts : packet->dts) * dp->time_base;
+	}
+
 	/* Send packet data as input to a decoder. */
+	start = time_secs();
 	ret = avcodec_send_packet(dp->codec_context, packet);
+	*decode_secs = time_secs() - start;
+	stats.stage_secs[STAGE_DECODE] += *decode_secs;
 	if (ret < 0)
 		LOG_GOTO("Error while sending packet data to a decoder!\n", out);
 
 	while (ret >= 0)
 	{
 		/* Get decoded output (i.e: frame) from the decoder. */
+		start = time_secs();
 		ret = avcodec_receive_frame(dp->codec_context, src_frame);
+		stats.last_decode = time_secs();
+		*decode_secs += stats.last_decode - start;
+		stats.stage_secs[STAGE_DECODE] += stats.last_decode - start;
 
 		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
 			break;
@@ -830,13 +1155,35 @@ static int decode_packet(AVPacket *packet,
 		else if (ret < 0)
 			LOG_GOTO("Error while getting a frame from the decoder!\n", out);
 
+		stats.frames_decoded++;
+
+		/* Dirty regions, relative to the previous decoded frame. */
+		if (cmd_flags & CMD_DIRTY_RECTS)
+			dirty_frame(src_frame);
+
+		if (fps_cap_skip(dp, src_frame))
+		{
+			stats.frames_skipped++;
+			av_frame_unref(src_frame);
+			continue;
+		}
+
+		/* Benchmark: stop right after decoding. */
+		if (stop_stage == STAGE_DECODE)
+		{
+			av_frame_unref(src_frame);
+			continue;
+		}
+
 		/* Check if our frame is CPU or GPU. */
 		if ((cmd_flags & CMD_HW_ACCEL) &&
 			src_frame->format == dp->hw_pix_fmt)
 		{
 			/* GPU, receive data from GPU to CPU and convert. */
 			dst_frame->format = AV_PIX_FMT_YUV420P;
+			start = time_secs();
 			ret = av_hwframe_transfer_data(dst_frame, src_frame, 0);
+			stats.stage_secs[STAGE_CONVERT] += time_secs() - start;
 
 			if (ret < 0)
 			{
@@ -862,22 +1209,539 @@ static int decode_packet(AVPacket *packet,
 		else
 			frame = src_frame;
 
-#ifndef DECODE_TO_FILE
+		/* Low motion, skip before any further work. */
+		if ((cmd_flags & CMD_MOTION) && motion_skip(dp, frame))
+		{
+			stats.frames_still++;
+			av_frame_unref(frame);
+			continue;
+		}
+
+		/* Golden-frame checksum of what goes to the texture. */
+		if ((cmd_flags & (CMD_CHECKSUM|CMD_CHECKSUM_PRESENT)) == CMD_CHECKSUM)
+			checksum_frame(frame);
+
+		/*
+		 * Export (in background), stop everything as soon as the
+		 * frame range is over.
+		 */
+		if (cmd_flags & CMD_EXPORT)
+		{
+			ret = export_frame(frame);
+			if (ret != 0)
+			{
+				av_frame_unref(frame);
+				if (ret > 0)
+				{
+					should_quit = 1;
+					packet_queue_flush(&packet_queue);
+				}
+				ret = -1;
+				goto out;
+			}
+		}
+
+		/* Benchmark: stop right after converting. */
+		if (stop_stage == STAGE_CONVERT)
+		{
+			av_frame_unref(frame);
+			continue;
+		}
+
 		/* We have the complete frame, enqueue it */
-		if (picture_queue_put(dp, &picture_queue, frame) < 0)
+		dec_state = DEC_STATE_UPLOADING;
+		if (upload_frame(dp, frame) < 0)
 		{
 			ret = -1;
 			goto out;
 		}
-#else
-		save_frame_ppm(frame, dp);
-#endif
+		dec_state = DEC_STATE_DECODING;
 	}
 	ret = 0;
 out:
 	return (ret);
 }
 
+/**
+ * @brief Callback that negotiates the codec format to the
+ * HW pixel format.
+ *
+ * @param ctx Codec Context.
+ * @param pix_fmts Pixel formats list.
+ *
+ * @return Returns the HW format (if supported), or
+ * AV_PIX_FMT_NONE if not supported.
+ */
+static enum AVPixelFormat get_hw_pixel_format(AVCodecContext *ctx,
+	const enum AVPixelFormat *pix_fmts)
+{
+	((void)ctx);
+	const enum AVPixelFormat *p;
+
+	for (p = pix_fmts; *p != -1; p++)
+		if (*p == dp.hw_pix_fmt)
+			return (*p);
+
+	return (AV_PIX_FMT_NONE);
+}
+
+/**
+ * @brief Sets the decoder skip options of the quality
+ * ladder level @p quality.
+ *
+ * @param dp av_decode_params structure.
+ * @param quality Quality ladder level.
+ */
+static void set_quality(struct av_decode_params *dp, int quality)
+{
+	AVCodecContext *ctx = dp->codec_context;
+
+	ctx->skip_loop_filter = AVDISCARD_DEFAULT;
+	ctx->skip_frame = AVDISCARD_DEFAULT;
+
+	if (quality == 1)
+		ctx->skip_loop_filter = AVDISCARD_NONREF;
+	else if (quality >= 2)
+		ctx->skip_loop_filter = AVDISCARD_ALL;
+	if (quality >= 3)
+		ctx->skip_frame = AVDISCARD_NONREF;
+
+	dp->cur_quality = quality;
+}
+
+/* Decoder jobs (execute()/execute2()), run on the task pool. */
+struct pool_exec
+{
+	AVCodecContext *ctx;
+	int (*func)(AVCodecContext *ctx, void *arg);
+	int (*func2)(AVCodecContext *ctx, void *arg, int job, int thread);
+	char *arg;
+	int *ret;
+	int size;
+	int count;
+	int nbands;
+};
+
+/**
+ * @brief Runs the decoder jobs of the band @p band: one out of
+ * every nbands, starting at @p band.
+ *
+ * @param arg pool_exec structure.
+ * @param band Band index, also the 'thread' of execute2().
+ */
+static void exec_band(void *arg, int band)
+{
+	struct pool_exec *e;
+	int ret;
+	int i;
+
+	e = (struct pool_exec *)arg;
+	for (i = band; i < e->count; i += e->nbands)
+	{
+		if (e->func)
+			ret = e->func(e->ctx, e->arg + (ptrdiff_t)i * e->size);
+		else
+			ret = e->func2(e->ctx, e->arg, i, band);
+		if (e->ret)
+			e->ret[i] = ret;
+	}
+}
+
+/**
+ * @brief libavcodec execute() callback: runs the @p count jobs
+ * (one argument each) on the task pool, up to the decoding
+ * threads knob at once, with the packet pts as deadline.
+ *
+ * @param ctx Codec context.
+ * @param func Job routine.
+ * @param arg Job arguments, @p size bytes each.
+ * @param ret Output, job return values (may be NULL).
+ * @param count Amount of jobs.
+ * @param size Size of each job argument.
+ *
+ * @return Always returns 0.
+ */
+static int pool_execute(AVCodecContext *ctx,
+	int (*func)(AVCodecContext *ctx, void *arg), void *arg, int *ret,
+	int count, int size)
+{
+	struct av_decode_params *dp;
+	struct pool_exec e = {0};
+
+	dp = (struct av_decode_params *)ctx->opaque;
+	e.ctx    = ctx;
+	e.func   = func;
+	e.arg    = (char *)arg;
+	e.ret    = ret;
+	e.size   = size;
+	e.count  = count;
+	e.nbands = FFMIN(pool_size() + 1, count);
+	if (dp->cur_threads > 0)
+		e.nbands = FFMIN(e.nbands, dp->cur_threads);
+
+	if (e.nbands > 0)
+		pool_run(exec_band, &e, e.nbands, dp->decode_pts);
+	return (0);
+}
+
+/**
+ * @brief libavcodec execute2() callback: runs the @p count jobs
+ * on the task pool, with the packet pts as deadline.
+ *
+ * The codec keeps per-thread state for thread_count threads
+ * only, so the jobs are spread over that many bands at most.
+ *
+ * @param ctx Codec context.
+ * @param func Job routine.
+ * @param arg Argument of every job.
+ * @param ret Output, job return values (may be NULL).
+ * @param count Amount of jobs.
+ *
+ * @return Always returns 0.
+ */
+static int pool_execute2(AVCodecContext *ctx,
+	int (*func)(AVCodecContext *ctx, void *arg, int job, int thread),
+	void *arg, int *ret, int count)
+{
+	struct av_decode_params *dp;
+	struct pool_exec e = {0};
+
+	dp = (struct av_decode_params *)ctx->opaque;
+	e.ctx    = ctx;
+	e.func2  = func;
+	e.arg    = (char *)arg;
+	e.ret    = ret;
+	e.count  = count;
+	e.nbands = FFMIN(FFMAX(ctx->thread_count, 1), count);
+
+	if (e.nbands > 0)
+		pool_run(exec_band, &e, e.nbands, dp->decode_pts);
+	return (0);
+}
+
+/**
+ * @brief Sets up the decoding threads of the codec context
+ * @p ctx: @p threads threads of its own (-1 for the default)
+ * or, with the task pool, none at all: the codec jobs run on
+ * the pool instead.
+ *
+ * @param dp av_decode_params structure.
+ * @param ctx Codec context, not opened yet.
+ * @param threads Decoding threads.
+ */
+static void setup_threads(struct av_decode_params *dp, AVCodecContext *ctx,
+	int threads)
+{
+	if (cmd_flags & CMD_POOL)
+	{
+		ctx->opaque       = dp;
+		ctx->thread_type  = FF_THREAD_SLICE;
+		ctx->thread_count = 1;
+		ctx->execute      = pool_execute;
+		ctx->execute2     = pool_execute2;
+		return;
+	}
+
+	if (threads >= 0)
+		ctx->thread_count = threads;
+}
+
+/**
+ * @brief Reopens the decoder with @p dp->cur_threads decoding
+ * threads: the thread count cannot be changed in an opened
+ * codec context.
+ *
+ * The new decoder has no reference frames, so everything
+ * until the next keyframe must be discarded.
+ *
+ * @param dp av_decode_params structure.
+ *
+ * @return Returns 0 if success, -1 otherwise (keeping the
+ * current decoder).
+ */
+static int reopen_decoder(struct av_decode_params *dp)
+{
+	AVStream *video;
+	const AVCodec *codec;
+	AVCodecContext *ctx;
+
+	codec = dp->codec_context->codec;
+	video = dp->format_context->streams[dp->video_idx];
+
+	ctx = avcodec_alloc_context3(codec);
+	if (!ctx)
+		LOG_GOTO("Unable to create a codec context!\n", out0);
+
+	if (avcodec_parameters_to_context(ctx, video->codecpar) < 0)
+	{
+		LOG_GOTO("Unable to fill codec context with the codec "
+			"parameters!\n", out1);
+	}
+
+	if (cmd_flags & CMD_HW_ACCEL)
+	{
+		ctx->get_format = get_hw_pixel_format;
+		ctx->hw_device_ctx = av_buffer_ref(dp->hw_device_ctx);
+	}
+
+	setup_threads(dp, ctx, dp->cur_threads);
+	if (cmd_flags & CMD_DIRTY_RECTS)
+		ctx->flags2 |= AV_CODEC_FLAG2_EXPORT_MVS;
+
+	if (avcodec_open2(ctx, codec, NULL) < 0)
+		LOG_GOTO("Unable to reopen the decoder!\n", out1);
+
+	/* Frames already decoded keep their own references. */
+	avcodec_free_context(&dp->codec_context);
+	dp->codec_context = ctx;
+	dp->cur_quality = -1;
+	dp->wait_keyframe = 1;
+	return (0);
+out1:
+	avcodec_free_context(&ctx);
+out0:
+	return (-1);
+}
+
+/**
+ * @brief Switches to the rendition @p dp->next_idx: the decoder
+ * is reopened with the new stream parameters, right at one of
+ * its keyframes.
+ *
+ * @param dp av_decode_params structure.
+ *
+ * @return Returns 0 if success, -1 otherwise (keeping the
+ * current rendition).
+ */
+static int switch_rendition(struct av_decode_params *dp)
+{
+	AVStream *video;
+	int prev;
+
+	prev = dp->video_idx;
+	dp->video_idx = dp->next_idx;
+
+	if (reopen_decoder(dp) < 0)
+	{
+		dp->video_idx = dp->next_idx = prev;
+		rendition_failed(prev);
+		return (-1);
+	}
+
+	video = dp->format_context->streams[dp->video_idx];
+	dp->time_base = av_q2d(video->time_base);
+	dp->wait_keyframe = 0;
+	stats.queue_frame_bytes = (double)dp->codec_context->width *
+		dp->codec_context->height * 3 / 2;
+	stats.rendition_switches++;
+	return (0);
+}
+
+/**
+ * @brief Applies the picture queue depth: the depth wanted by
+ * the jitter plus the one for the packets ahead, within the
+ * configured bounds.
+ */
+static void set_queue_depth(void)
+{
+	int depth;
+
+	depth = FFMIN(FFMAX(queue_base + queue_ahead, queue_min), queue_limit);
+	if (depth != stats.queue_max)
+	{
+		/* Cooperative mode: the main loop checks the depth itself. */
+		if (!(cmd_flags & CMD_COOP))
+			picture_queue_set_max(&picture_queue, depth);
+		stats.queue_max = depth;
+	}
+}
+
+/**
+ * @brief Sizes the picture queue from the decode time of the
+ * packets seen so far: a frame must be ready when due, so the
+ * queue holds as many frames as a slow decode (mean plus
+ * QUEUE_JITTER_K standard deviations) takes frame periods,
+ * plus the one on the screen.
+ *
+ * Each missed deadline (dropped or evicted frames) also adds a
+ * frame, and each QUEUE_CALM_MS without misses removes one.
+ *
+ * @param dp av_decode_params structure.
+ * @param secs Decode time of the last packet (in seconds).
+ */
+static void jitter_depth(struct av_decode_params *dp, double secs)
+{
+	unsigned long misses;
+	double period;
+	double dev;
+	double now;
+
+	period = dp->frame_last_delay;
+	if (period <= 0)
+		return;
+
+	dev = secs - jitter_mean;
+	jitter_mean += QUEUE_ALPHA * dev;
+	jitter_var = (1.0 - QUEUE_ALPHA) * (jitter_var + QUEUE_ALPHA * dev * dev);
+
+	now = time_secs();
+	misses = stats.frames_dropped + stats.frames_evicted;
+	if (misses != jitter_misses)
+	{
+		jitter_misses = misses;
+		jitter_penalty = FFMIN(jitter_penalty + 1, queue_limit);
+		jitter_calm = now;
+	}
+	else if (jitter_penalty && (now - jitter_calm) * 1000.0 >= QUEUE_CALM_MS)
+	{
+		jitter_penalty--;
+		jitter_calm = now;
+	}
+
+	queue_base = 1 + jitter_penalty + (int)ceil((jitter_mean +
+		QUEUE_JITTER_K * sqrt(jitter_var)) / period);
+	set_queue_depth();
+}
+
+/**
+ * @brief Sizes the picture queue for the packets ahead: the
+ * decode thread falls behind on every packet predicted to take
+ * longer than a frame period (and catches up on the cheaper
+ * ones), so the queue must hold, in advance, as many frames as
+ * the largest delay accumulated. Otherwise, it stays shallow.
+ *
+ * @param dp av_decode_params structure.
+ */
+static void lookahead_depth(struct av_decode_params *dp)
+{
+	struct packet_info info[LOOKAHEAD_PKTS];
+	double period;
+	double debt;
+	double need;
+	int n;
+	int i;
+
+	period = dp->frame_last_delay;
+	if (period <= 0)
+		return;
+
+	n = packet_queue_peek(&packet_queue, info, LOOKAHEAD_PKTS);
+	for (i = 0, debt = 0.0, need = 0.0; i < n; i++)
+	{
+		debt = FFMAX(debt + cost_predict(info[i].size, info[i].key) -
+			period, 0.0);
+		need = FFMAX(need, debt);
+	}
+
+	queue_ahead = (int)ceil(need / period);
+	set_queue_depth();
+}
+
+/**
+ * @brief Decodes the video packet @p packet (taking ownership
+ * of it): switches renditions, applies the decoder knobs and
+ * sizes the picture queue as needed, before and after.
+ *
+ * @param dp av_decode_params structure.
+ * @param packet Packet to be decoded.
+ * @param sw_frame SW frame.
+ * @param hw_frame HW frame (if HW decoding).
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int process_packet(struct av_decode_params *dp, AVPacket *packet,
+	AVFrame *sw_frame, AVFrame *hw_frame)
+{
+	double decode_secs;
+	int threads;
+	int quality;
+
+	/*
+	 * Another rendition: switch at its first keyframe, and
+	 * drop everything else that is not the current one.
+	 */
+	if (packet->stream_index != dp->video_idx)
+	{
+		if (packet->stream_index != dp->next_idx ||
+			!(packet->flags & AV_PKT_FLAG_KEY) ||
+			switch_rendition(dp) < 0)
+		{
+			av_packet_unref(packet);
+			return (0);
+		}
+	}
+
+	/* Decoder knobs wanted, written by other threads. */
+	if (knobs_mutex)
+		SDL_LockMutex(knobs_mutex);
+	threads = dp->threads;
+	quality = dp->quality;
+	if (knobs_mutex)
+		SDL_UnlockMutex(knobs_mutex);
+
+	/*
+	 * Decoder knobs changed (by a profile), apply them: on the
+	 * task pool, the threads only limit the jobs in flight.
+	 * Otherwise, a new decoder is needed: only at a keyframe,
+	 * so nothing is discarded, and once the current one gave
+	 * the frames it still holds. Whatever happens, do not try
+	 * again.
+	 */
+	if (threads != dp->cur_threads && (cmd_flags & CMD_POOL))
+		dp->cur_threads = threads;
+	else if (threads != dp->cur_threads &&
+		(packet->flags & AV_PKT_FLAG_KEY))
+	{
+		if (decode_packet(NULL, sw_frame, hw_frame, dp, &decode_secs) < 0)
+		{
+			av_packet_unref(packet);
+			return (-1);
+		}
+		avcodec_flush_buffers(dp->codec_context);
+
+		dp->cur_threads = threads;
+		reopen_decoder(dp);
+	}
+	if (quality != dp->cur_quality)
+		set_quality(dp, quality);
+
+	/* Reopened decoder: nothing to refer to until a keyframe. */
+	if (dp->wait_keyframe)
+	{
+		if (!(packet->flags & AV_PKT_FLAG_KEY))
+		{
+			av_packet_unref(packet);
+			return (0);
+		}
+		dp->wait_keyframe = 0;
+	}
+
+	/* Make room for the expensive packets ahead, if any. */
+	if (cmd_flags & CMD_LOOKAHEAD)
+		lookahead_depth(dp);
+
+	/*
+	 * Decode time only: not the time waiting for room, nor
+	 * the motion analysis and conversions done per frame.
+	 */
+	if (decode_packet(packet, sw_frame, hw_frame, dp, &decode_secs) < 0)
+	{
+		av_packet_unref(packet);
+		return (-1);
+	}
+
+	if (cmd_flags & CMD_LOOKAHEAD)
+	{
+		cost_learn(packet->size, packet->flags & AV_PKT_FLAG_KEY,
+			decode_secs);
+	}
+	if (cmd_flags & CMD_QUEUE_ADAPT)
+		jitter_depth(dp, decode_secs);
+
+	av_packet_unref(packet);
+	return (0);
+}
+
 /**
  * @brief Read each packet from the packet queue,
  * decode them, and save the resulting frame
@@ -898,6 +1762,14 @@ static int decode_packets_thread(void *arg)
 
 	dp = (struct av_decode_params *)arg;
 
+	/*
+	 * Background class: the libavcodec workers inherit it
+	 * from the thread that opens the decoder, so reopen it
+	 * from here.
+	 */
+	if (bg_sched != BG_SCHED_NONE && !sched_background(bg_sched))
+		reopen_decoder(dp);
+
 	sw_frame = av_frame_alloc();
 	if (!sw_frame)
 		LOG_GOTO("Unable to allocate a SW AVFrame!\n", out0);
@@ -913,21 +1785,41 @@ static int decode_packets_thread(void *arg)
 
 	while (1)
 	{
+		dec_state = DEC_STATE_WAIT_PKT;
+
 		/* Should quit?. */
 		if (packet_queue_get(&packet_queue, &packet) < 0)
-		{
-			/* Signal the end of pictures and wake up threads. */
-			end_pics = 1;
-			SDL_CondSignal(picture_queue.cond);
 			break;
+
+		/*
+		 * Flush packet: the enqueue thread has seeked, so we need
+		 * to discard everything buffered until now.
+		 */
+		if (packet.stream_index == FLUSH_PKT_IDX)
+		{
+			avcodec_flush_buffers(dp->codec_context);
+			SDL_LockMutex(screen_mutex);
+				picture_queue_flush(&picture_queue);
+				if (cmd_flags & CMD_DIRTY_RECTS)
+					dirty_reset();
+			SDL_UnlockMutex(screen_mutex);
+			dp->resync = 1;
+			continue;
 		}
 
-		if (decode_packet(&packet, sw_frame, hw_frame, dp) < 0)
+		dec_state = DEC_STATE_DECODING;
+		if (process_packet(dp, &packet, sw_frame, hw_frame) < 0)
 			break;
-
-		av_packet_unref(&packet);
 	}
 
+	/*
+	 * Signal the end of pictures and wake up threads, even
+	 * if leaving due to an error: otherwise, the main thread
+	 * would wait forever for a new picture.
+	 */
+	picture_queue_end(&picture_queue);
+
+	dec_state = DEC_STATE_FINISHED;
 	av_frame_free(&hw_frame);
 out1:
 	av_frame_free(&sw_frame);
@@ -935,67 +1827,279 @@ out0:
 	return (0);
 }
 
+/**
+ * @brief Recovers the pipeline from a stall: discards all
+ * the pending packets (restarting the queue), seeks to the
+ * last presented frame and asks the decode thread to flush
+ * everything.
+ *
+ * @param dp av_decode_params structure.
+ */
+static void recover_stall(struct av_decode_params *dp)
+{
+	AVPacket flush_pkt = {0};
+	int64_t ts;
+
+	packet_queue_flush(&packet_queue);
+
+	ts = (int64_t)(stats.last_pts / dp->time_base);
+	if (av_seek_frame(dp->format_context, dp->video_idx, ts,
+		AVSEEK_FLAG_BACKWARD) < 0)
+	{
+		av_seek_frame(dp->format_context, dp->video_idx, 0,
+			AVSEEK_FLAG_BACKWARD);
+	}
+
+	flush_pkt.stream_index = FLUSH_PKT_IDX;
+	packet_queue_put(&packet_queue, &flush_pkt);
+
+	stats.recoveries++;
+	dp->stall_recover = 0;
+}
+
 /**
  * @brief Read each video packet from the video and
  * enqueue them for later processing.
  *
  * This executes in another thread.
  *
- * @param arg av_decode_params structure.
+ * @param arg av_decode_params structure.
+ *
+ * @return Always returns 0.
+ */
+static int enqueue_packets_thread(void *arg)
+{
+	double start;
+	AVFrame *frame;
+	AVPacket *packet;
+	struct av_decode_params *dp;
+
+	dp = (struct av_decode_params *)arg;
+
+	/* Demuxing is not urgent. */
+	sched_background(bg_sched);
+
+	/* Allocate memory for AVFrame and AVPacket. */
+	frame = av_frame_alloc();
+	if (!frame)
+		LOG_GOTO("Unable to allocate an AVFrame!\n", out2);
+	packet = av_packet_alloc();
+	if (!packet)
+		LOG_GOTO("Unable to allocate an AVPacket!\n", out3);
+
+start:
+	while (1)
+	{
+		if (should_quit)
+			goto out2;
+
+		/* Watchdog asked us to recover. */
+		if (dp->stall_recover)
+			recover_stall(dp);
+
+		/* Error/EOF. */
+		start = time_secs();
+		if (av_read_frame(dp->format_context, packet) < 0)
+		{
+			/*
+			 * Signal the end of packets and wake up threads, unless
+			 * looping: otherwise, the decode thread would quit as
+			 * soon as the queue gets empty at the loop seam.
+			 */
+			if (!(cmd_flags & CMD_LOOP))
+				packet_queue_end(&packet_queue);
+			break;
+		}
+
+		stats.last_demux = time_secs();
+		stats.stage_secs[STAGE_DEMUX] += stats.last_demux - start;
+
+		/*
+		 * Check packet type and enqueue it: while switching
+		 * renditions, both streams are needed.
+		 */
+		if (packet->stream_index == dp->video_idx ||
+			packet->stream_index == dp->next_idx)
+		{
+			stats.pkts_read++;
+
+			/* Benchmark: stop right after demuxing. */
+			if (stop_stage == STAGE_DEMUX)
+				av_packet_unref(packet);
+			else
+				packet_queue_put(&packet_queue, packet);
+		}
+		else
+			av_packet_unref(packet);
+	}
+
+	/* Loop again. */
+	if (cmd_flags & CMD_LOOP)
+	{
+		av_seek_frame(dp->format_context, dp->video_idx, 0,
+			AVSEEK_FLAG_BACKWARD);
+		goto start;
+	}
+
+	/* Playing once: stay around, the watchdog may ask to recover. */
+	if ((cmd_flags & CMD_STALL_RECOVER) &&
+		packet_queue_wait_abort(&packet_queue))
+	{
+		goto start;
+	}
+
+out2:
+	av_packet_free(&packet);
+out3:
+	av_frame_free(&frame);
+	return (0);
+}
+
+/**
+ * @brief Cooperative mode: allocates what the enqueue and
+ * decode threads would.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int coop_init(void)
+{
+	coop_packet = av_packet_alloc();
+	coop_sw_frame = av_frame_alloc();
+	if (cmd_flags & CMD_HW_ACCEL)
+		coop_hw_frame = av_frame_alloc();
+
+	if (!coop_packet || !coop_sw_frame ||
+		((cmd_flags & CMD_HW_ACCEL) && !coop_hw_frame))
+	{
+		LOG("Unable to allocate the cooperative mode frames!\n");
+		return (-1);
+	}
+	return (0);
+}
+
+/**
+ * @brief Cooperative mode: releases the pictures not presented
+ * and what coop_init() allocated.
+ */
+static void coop_finish(void)
+{
+	for (; coop_npics; coop_npics--)
+	{
+		release_picture(coop_pics[coop_head].picture);
+		coop_head = (coop_head + 1) % COOP_PICS;
+	}
+
+	av_packet_free(&coop_packet);
+	av_frame_free(&coop_sw_frame);
+	av_frame_free(&coop_hw_frame);
+}
+
+/**
+ * @brief Cooperative mode: runs a decode step, i.e: reads the
+ * next packet and, if a video one, decodes it (the resulting
+ * frames go to the ring), as the enqueue and decode threads
+ * would.
+ *
+ * @param dp av_decode_params structure.
+ *
+ * @return Returns 1 if there may be more steps, 0 otherwise
+ * (end of the input or error).
+ */
+static int coop_step(struct av_decode_params *dp)
+{
+	double start;
+
+	start = time_secs();
+	if (av_read_frame(dp->format_context, coop_packet) < 0)
+	{
+		if (!(cmd_flags & CMD_LOOP))
+		{
+			coop_eof = 1;
+			return (0);
+		}
+		av_seek_frame(dp->format_context, dp->video_idx, 0,
+			AVSEEK_FLAG_BACKWARD);
+		return (1);
+	}
+
+	stats.last_demux = time_secs();
+	stats.stage_secs[STAGE_DEMUX] += stats.last_demux - start;
+
+	if ((coop_packet->stream_index != dp->video_idx &&
+		coop_packet->stream_index != dp->next_idx) ||
+		stop_stage == STAGE_DEMUX)
+	{
+		if (coop_packet->stream_index == dp->video_idx)
+			stats.pkts_read++;
+		av_packet_unref(coop_packet);
+		return (1);
+	}
+	stats.pkts_read++;
+
+	if (process_packet(dp, coop_packet, coop_sw_frame, coop_hw_frame) < 0)
+	{
+		coop_eof = 1;
+		return (0);
+	}
+
+	coop_step_secs += QUEUE_ALPHA * (time_secs() - start - coop_step_secs);
+	return (1);
+}
+
+/**
+ * @brief Cooperative mode main loop: demuxing, decoding, pause
+ * checks (occlusion) and presentation all run here, as steps
+ * scheduled by the next frame deadline, without any other
+ * thread, mutex or condition variable involved.
+ *
+ * At each frame tick, the next picture is presented (as in the
+ * threaded mode); meanwhile, packets are decoded ahead while
+ * the ring has room and the usual decode step fits before the
+ * tick. Otherwise, the loop sleeps until the tick (or an event).
  *
- * @return Always returns 0.
+ * @param dp av_decode_params structure.
  */
-static int enqueue_packets_thread(void *arg)
+static void coop_loop(struct av_decode_params *dp)
 {
-	AVFrame *frame;
-	AVPacket *packet;
-	struct av_decode_params *dp;
-
-	dp = (struct av_decode_params *)arg;
-
-	/* Allocate memory for AVFrame and AVPacket. */
-	frame = av_frame_alloc();
-	if (!frame)
-		LOG_GOTO("Unable to allocate an AVFrame!\n", out2);
-	packet = av_packet_alloc();
-	if (!packet)
-		LOG_GOTO("Unable to allocate an AVPacket!\n", out3);
+	SDL_Event event;
+	double wait;
 
-start:
 	while (1)
 	{
-		if (should_quit)
-			goto out2;
+		while (SDL_PollEvent(&event))
+			if (event.type == SDL_QUIT)
+				return;
 
-		/* Error/EOF. */
-		if (av_read_frame(dp->format_context, packet) < 0)
+		if (should_dump_stats)
 		{
-			/* Signal the end of packets and wake up threads. */
-			end_pkts = 1;
-			SDL_CondSignal(packet_queue.cond);
-			break;
+			should_dump_stats = 0;
+			stats_dump(stderr);
 		}
 
-		/* Check packet type and enqueue it. */
-		if (packet->stream_index == dp->video_idx)
-			packet_queue_put(&packet_queue, packet);
-		else
-			av_packet_unref(packet);
-	}
+		wait = coop_tick - time_secs();
 
-	/* Loop again. */
-	if (cmd_flags & CMD_LOOP)
-	{
-		av_seek_frame(dp->format_context, dp->video_idx, 0,
-			AVSEEK_FLAG_BACKWARD);
-		goto start;
-	}
+		/* Frame tick: present, unless there is nothing yet. */
+		if (wait <= 0 && (coop_npics || coop_eof || dp->paused))
+		{
+			refresh_screen(dp);
 
-out2:
-	av_packet_free(&packet);
-out3:
-	av_frame_free(&frame);
-	return (0);
+			/* Pacing test is over. */
+			if ((cmd_flags & CMD_PACING) && pacing_done())
+				return;
+			continue;
+		}
+
+		/* Room and time for a decode step before the tick. */
+		if (!dp->paused && !coop_eof && (!coop_npics ||
+			(coop_npics < stats.queue_max && coop_step_secs < wait)))
+		{
+			coop_step(dp);
+			continue;
+		}
+
+		/* Nothing to do until the tick (or an event). */
+		SDL_WaitEventTimeout(NULL, FFMAX((int)(wait * 1000.0), 1));
+	}
 }
 
 /**
@@ -1042,6 +2146,7 @@ static const AVCodec *open_file_and_find_codec(struct av_decode_params *dp,
 
 	video = dp->format_context->streams[dp->video_idx];
 	dp->time_base = av_q2d(video->time_base);
+	dp->next_idx = dp->video_idx;
 	return (codec);
 
 out1:
@@ -1050,70 +2155,6 @@ out0:
 	return (codec);
 }
 
-/**
- * @brief Setup the scale context if the file dump
- * is enabled.
- *
- * @param dp av_decode_params structure.
- *
- * @return Returns 0 if success, -1 otherwise.
- */
-#ifdef DECODE_TO_FILE
-static int sws_setup(struct av_decode_params *dp)
-{
-	/* Prepare our scale context and temporary buffer. */
-	dp->sws_ctx = sws_getContext(dp->codec_context->width,
-		dp->codec_context->height,
-		dp->codec_context->pix_fmt,
-		dp->codec_context->width,
-		dp->codec_context->height,
-		AV_PIX_FMT_RGB24,
-		SWS_BILINEAR,
-		NULL,
-		NULL,
-		NULL
-	);
-	if (!dp->sws_ctx)
-		LOG_GOTO("Unable to create a scale context!\n", out0);
-
-	if (av_image_alloc(dp->dst_img, dp->dst_linesize,
-		dp->codec_context->width, dp->codec_context->height,
-		AV_PIX_FMT_RGB24, 16) < 0)
-	{
-		LOG_GOTO("Unable to allocate destination image!\n", out1);
-	}
-
-	return (0);
-out1:
-	sws_freeContext(dp->sws_ctx);
-out0:
-	return (-1);
-}
-#endif
-
-/**
- * @brief Callback that negotiates the codec format to the
- * HW pixel format.
- *
- * @param ctx Codec Context.
- * @param pix_fmts Pixel formats list.
- *
- * @return Returns the HW format (if supported), or
- * AV_PIX_FMT_NONE if not supported.
- */
-static enum AVPixelFormat get_hw_pixel_format(AVCodecContext *ctx,
-	const enum AVPixelFormat *pix_fmts)
-{
-	((void)ctx);
-	const enum AVPixelFormat *p;
-
-	for (p = pix_fmts; *p != -1; p++)
-		if (*p == dp.hw_pix_fmt)
-			return (*p);
-
-	return (AV_PIX_FMT_NONE);
-}
-
 /**
  * @brief Setup the HW acceleration (if enabled) for a given
  * @p codec.
@@ -1228,6 +2269,60 @@ out0:
 	return (-1);
 }
 
+/**
+ * @brief Starts with the rendition that best fits the screen
+ * (if the file has more than one), so the decoder does not
+ * decode more pixels than the ones shown.
+ *
+ * @param dp av_decode_params structure.
+ */
+static void select_rendition(struct av_decode_params *dp)
+{
+	XWindowAttributes attr;
+	AVStream *video;
+	int width;
+	int height;
+	int prev;
+	int idx;
+
+	width = dp->screen_width;
+	height = dp->screen_height;
+
+	/* SDL is not up yet, ask X11 (the display is kept for later). */
+	if ((!width || !height) && !(cmd_flags & CMD_WINDOWED))
+	{
+		if (!x11dip)
+			x11dip = XOpenDisplay(NULL);
+		if (x11dip && XGetWindowAttributes(x11dip,
+			DefaultRootWindow(x11dip), &attr))
+		{
+			width = attr.width;
+			height = attr.height;
+		}
+	}
+
+	/* Not scaled at all, any rendition is as good. */
+	if (!(cmd_flags & (CMD_RESOLUTION_SCALE|CMD_RESOLUTION_FIT)))
+		width = height = 0;
+
+	idx = rendition_init(dp->format_context, dp->video_idx, width, height,
+		cmd_flags & CMD_RESOLUTION_SCALE);
+	if (idx == dp->video_idx)
+		return;
+
+	prev = dp->video_idx;
+	dp->video_idx = dp->next_idx = idx;
+	video = dp->format_context->streams[idx];
+	if (reopen_decoder(dp) < 0)
+	{
+		LOG("rendition: unable to open stream #%d!\n", idx);
+		dp->video_idx = dp->next_idx = prev;
+		rendition_failed(prev);
+		return;
+	}
+	dp->time_base = av_q2d(video->time_base);
+}
+
 /**
  * @brief Initializes all resources related to video decoding,
  * most of them related to libavcodec. Leaves the program in a
@@ -1271,16 +2366,19 @@ static int init_av(struct av_decode_params *dp, const char *file)
 			goto out2;
 	}
 
+	/* Decoding threads (0 means auto), or the task pool. */
+	setup_threads(dp, dp->codec_context, decode_threads);
+	dp->threads = dp->cur_threads = decode_threads;
+	dp->quality = dp->cur_quality = 0;
+
+	/* Motion vectors, for the dirty regions. */
+	if (cmd_flags & CMD_DIRTY_RECTS)
+		dp->codec_context->flags2 |= AV_CODEC_FLAG2_EXPORT_MVS;
+
 	/* Open codec. */
 	if (avcodec_open2(dp->codec_context, codec, NULL) < 0)
 		LOG_GOTO("Unable to initialize a codec context!\n", out3);
 
-#ifdef DECODE_TO_FILE
-	/* Prepare our scale context and temporary buffer. */
-	if (sws_setup(dp) < 0)
-		goto out3;
-#endif
-
 	/* Initial time (in seconds). */
 	dp->frame_timer = time_secs();
 
@@ -1315,11 +2413,6 @@ static void finish_av(struct av_decode_params *dp)
 
 	if (cmd_flags & CMD_HW_ACCEL)
 		av_buffer_unref(&dp->hw_device_ctx);
-
-	sws_freeContext(dp->sws_ctx);
-#if DECODE_TO_FILE
-	av_freep(&dp->dst_img[0]);
-#endif
 }
 
 /**
@@ -1400,16 +2493,37 @@ static int get_screen_resolution(int *w, int *h)
  */
 static int init_sdl(struct av_decode_params *dp)
 {
+	char driver[32];
 	Window x11w;
 	int width;
 	int height;
+	Uint32 renderer_flags;
+
+	/*
+	 * Benchmark mode should run everywhere, even without a display,
+	 * so use the dummy video driver (unless the user says otherwise)
+	 * and the requested render driver (software by default). Since
+	 * there is no event loop, leave SIGINT to its default action.
+	 */
+	if (cmd_flags & CMD_BENCH)
+	{
+		SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+		SDL_SetHint(SDL_HINT_RENDER_DRIVER, bench_renderer);
+		SDL_SetHint(SDL_HINT_NO_SIGNAL_HANDLERS, "1");
+	}
 
-	/* Initialize. */
-	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0)
+	/*
+	 * Initialize: the cooperative mode does not use timers, and
+	 * the timer subsystem would start a thread of its own.
+	 */
+	if (SDL_Init(SDL_INIT_VIDEO |
+		((cmd_flags & CMD_COOP) ? 0 : SDL_INIT_TIMER)) < 0)
+	{
 		LOG_GOTO("Unable to initialize SDL!\n", out0);
+	}
 
 	/* Get screen dimensions. */
-	if (!dp->screen_width || !dp->screen_height)
+	if (!(cmd_flags & CMD_BENCH) && (!dp->screen_width || !dp->screen_height))
 	{
 		if (get_screen_resolution(&dp->screen_width,
 			&dp->screen_height) < 0)
@@ -1422,8 +2536,14 @@ static int init_sdl(struct av_decode_params *dp)
 	/*
 	 * Create Window through X11's RootWindow or a new SDL
 	 * window.
+	 *
+	 * If benchmarking and the frames will not be uploaded,
+	 * there is no need for a window and renderer at all.
 	 */
-	if (cmd_flags & CMD_WINDOWED)
+	if ((cmd_flags & CMD_BENCH) && stop_stage < STAGE_UPLOAD)
+		goto threads;
+
+	else if (cmd_flags & CMD_WINDOWED)
 	{
 		if (cmd_flags & (CMD_RESOLUTION_SCALE|CMD_RESOLUTION_FIT))
 		{
@@ -1455,6 +2575,8 @@ static int init_sdl(struct av_decode_params *dp)
 		int flags = SDL_WINDOW_SHOWN;
 		if (cmd_flags & CMD_BORDERLESS)
 			flags |= SDL_WINDOW_BORDERLESS;
+		if (cmd_flags & CMD_BENCH)
+			flags = SDL_WINDOW_HIDDEN;
 		window = SDL_CreateWindow("video",
 			SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
 			width, height, flags);
@@ -1478,12 +2600,46 @@ static int init_sdl(struct av_decode_params *dp)
 			LOG_GOTO("Unable to create a new SDL Window through X11!\n", out2);
 	}
 
-	/* Create renderer. */
-	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED |
-		SDL_RENDERER_PRESENTVSYNC);
+	/*
+	 * Render driver: the one asked for, the fastest one (calibrated
+	 * on the stream and screen resolutions) or SDL's choice.
+	 */
+	if (!(cmd_flags & CMD_BENCH) && (!strcmp(render_driver, "auto") ||
+		!strcmp(render_driver, "calibrate")))
+	{
+		SDL_GetWindowSize(window, &width, &height);
+
+		if (!render_select(dp->codec_context->width,
+			dp->codec_context->height, width, height,
+			render_driver[0] == 'c', driver, sizeof(driver)))
+		{
+			SDL_SetHint(SDL_HINT_RENDER_DRIVER, driver);
+		}
+	}
+	else if (!(cmd_flags & CMD_BENCH) && render_driver[0])
+		SDL_SetHint(SDL_HINT_RENDER_DRIVER, render_driver);
+
+	/* Create renderer: no vsync if benchmarking. */
+	renderer_flags = SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC;
+	if (cmd_flags & CMD_BENCH)
+		renderer_flags = 0;
+
+	renderer = SDL_CreateRenderer(window, -1, renderer_flags);
 	if (!renderer)
 		LOG_GOTO("Unable to create an SDL Renderer!\n", out2);
 
+threads:
+	/*
+	 * Cooperative mode: no threads and no screen mutex (locking
+	 * a NULL mutex is a no-op in SDL).
+	 */
+	if (cmd_flags & CMD_COOP)
+	{
+		if (coop_init() < 0)
+			goto out3;
+		return (0);
+	}
+
 	/* Create threads. */
 	enqueue_thread = SDL_CreateThread(enqueue_packets_thread,
 		"enqueue_pkts", dp);
@@ -1495,13 +2651,13 @@ static int init_sdl(struct av_decode_params *dp)
 	if (!decode_thread)
 		LOG_GOTO("Unable to create the decode_packets thread!\n", out3);
 
-	/* Pause thread only in X11 mode or if explicitly enabled. */
-	if ((cmd_flags & (CMD_BACKGROUND|CMD_PAUSE_SIGNAL)))
+	/* Stall watchdog. */
+	if (cmd_flags & CMD_WATCHDOG)
 	{
-		pause_thread = SDL_CreateThread(pause_execution_thread,
-			"pause_thread", dp);
-		if (!pause_thread)
-			LOG_GOTO("Unable to create pause thread!\n", out3);
+		watchdog_thread = SDL_CreateThread(watchdog_execution_thread,
+			"watchdog", dp);
+		if (!watchdog_thread)
+			LOG_GOTO("Unable to create watchdog thread!\n", out3);
 	}
 
 	/* Allocate SDL Events. */
@@ -1514,18 +2670,7 @@ static int init_sdl(struct av_decode_params *dp)
 	if (!screen_mutex)
 		LOG_GOTO("Unable to create screen mutex!\n", out3);
 
-	/* Pause mutex & cond. */
-	if ((cmd_flags & (CMD_BACKGROUND|CMD_PAUSE_SIGNAL)))
-	{
-		dp->pause_mutex = SDL_CreateMutex();
-		dp->pause_cond  = SDL_CreateCond();
-		if (!dp->pause_mutex || !dp->pause_cond)
-			LOG_GOTO("Unable to create pause mutex!\n", out4);
-	}
-
 	return (0);
-out4:
-	SDL_DestroyMutex(screen_mutex);
 out3:
 	SDL_DestroyRenderer(renderer);
 out2:
@@ -1552,10 +2697,6 @@ static void finish_sdl(void)
 	 */
 
 	/* Release resources. */
-	if (dp.pause_cond)
-		SDL_DestroyCond(dp.pause_cond);
-	if (dp.pause_mutex)
-		SDL_DestroyMutex(dp.pause_mutex);
 	if (screen_mutex)
 		SDL_DestroyMutex(screen_mutex);
 	if (renderer)
@@ -1567,6 +2708,65 @@ static void finish_sdl(void)
 		XCloseDisplay(x11dip);
 }
 
+/**
+ * @brief Reports the benchmark results as JSON in the
+ * stdout.
+ *
+ * @param dp av_decode_params structure.
+ * @param file Input file.
+ */
+static void bench_report(struct av_decode_params *dp, const char *file)
+{
+	SDL_RendererInfo info = {0};
+	if (renderer)
+		SDL_GetRendererInfo(renderer, &info);
+	stats_dump_json(stdout, dp, file, stop_stage, info.name);
+}
+
+/**
+ * @brief Runs the pipeline as fast as possible, without
+ * any pacing, and reports the results as JSON in the
+ * stdout.
+ *
+ * @param dp av_decode_params structure.
+ * @param file Input file.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int bench_loop(struct av_decode_params *dp, const char *file)
+{
+	int ret;
+	double pts;
+	SDL_Texture *texture_frame;
+
+	while (1)
+	{
+		/* Cooperative mode: decode until there is a picture. */
+		if ((cmd_flags & CMD_COOP) && !coop_npics && coop_step(dp))
+			continue;
+		if (get_picture(&texture_frame, &pts) <= 0)
+			break;
+		if (stop_stage == STAGE_PRESENT)
+			draw_frame(texture_frame, pts, dp);
+		release_picture(texture_frame);
+
+		stats.last_pts = pts;
+		if (should_dump_stats)
+		{
+			should_dump_stats = 0;
+			stats_dump(stderr);
+		}
+	}
+
+	should_quit = 1;
+	SDL_CondBroadcast(packet_queue.cond);
+
+	/* Wait for the pending exports, so they are accounted for. */
+	ret = export_finish();
+	bench_report(dp, file);
+	return (ret);
+}
+
 /**
  * @brief Show program usage.
  * @param prgname Program name.
@@ -1587,6 +2787,104 @@ static void usage(const char *prgname)
 		"  -r Set screen resolution, in format: WIDTHxHEIGHT\n\n"
 		"  -d <dev> Enable HW accel for a given device (like vaapi or vdpau)\n\n"
 		"  -p Enable pause/resume commands via SIGUSR1\n\n"
+		"  -t <N> Enable stall watchdog: report if no frame is presented\n"
+		"     for N frame periods (while not paused)\n\n"
+		"  -R Try to recover from stalls (flush and seek), requires -t\n\n"
+		"  --threads <N> Number of decoding threads (0 for auto)\n\n"
+		"  --fps-cap <fps> Show at most <fps> frames per second, the\n"
+		"     remaining frames are skipped right after decoding\n\n"
+		"Benchmark options:\n"
+		"  --bench Decode (and upload/present) the whole input file as\n"
+		"     fast as possible, without a display, and report the results\n"
+		"     as JSON\n\n"
+		"  --bench-stop <stage> Last pipeline stage to run, one of: demux,\n"
+		"     decode, convert, upload, present (default)\n\n"
+		"  --bench-renderer <name> SDL render driver used to upload/present\n"
+		"     frames (default: software)\n\n"
+		"  --bench-paced Like --bench, but keeps the real-time playback\n"
+		"     pacing, useful to measure the CPU usage while playing\n\n"
+		"  --bench-pacing <secs> Play (in loop) for <secs> seconds, pausing\n"
+		"     once in the middle, and report the frame pacing accuracy\n"
+		"     against the ideal schedule as JSON\n\n"
+		"  --pacing-tolerance <ms> Max p99 pacing error allowed before\n"
+		"     --bench-pacing fails (default: 5)\n\n"
+		"  --checksum <file> Write a per-frame checksum (Adler-32) of the\n"
+		"     exact bytes uploaded to the texture into <file>\n\n"
+		"  --checksum-verify <file> Compare each frame against the checksums\n"
+		"     in <file>, fails on any mismatch\n\n"
+		"  --checksum-present Checksum the rendered surface instead (only\n"
+		"     bit-exact with the software renderer)\n\n"
+		"Export options:\n"
+		"  --export <dir> Decode the input file as fast as possible and\n"
+		"     export each frame into <dir>\n\n"
+		"  --export-format <fmt> One of: ppm (default), pam or yuv (raw,\n"
+		"     decoder pixel format)\n\n"
+		"  --export-range <first>[:<last>] Export only these frames\n\n"
+		"  --export-threads <N> Number of export threads (default: number\n"
+		"     of CPUs)\n\n");
+	fprintf(stderr,
+		"Power options:\n"
+		"  --power-profiles Follow the power source: switch to a low-power\n"
+		"     profile while on battery, and back while on AC\n\n"
+		"  --profile-ac <spec> AC profile (implies --power-profiles),\n"
+		"     default: the command line settings\n\n"
+		"  --profile-battery <spec> Battery profile (implies\n"
+		"     --power-profiles), default: fps=24,threads=1,quality=2,\n"
+		"     occlusion=50\n\n"
+		"     <spec> is a list of key=value, separated by commas:\n"
+		"     fps (FPS cap, 0 for none), threads (decoding threads, 0 for\n"
+		"     auto), quality (0 to 3, 0 is the full quality) and occlusion\n"
+		"     (screen area, in %%, that pauses the playback)\n\n"
+		"  --psi Back off under CPU/IO pressure (PSI): lower the FPS cap\n"
+		"     and the decoding quality, or even pause, recovering slowly\n"
+		"     once the pressure is gone\n\n"
+		"  --bg-sched <class> Run the demux and decode threads (and the\n"
+		"     decoder workers) in a background class, one of: idle\n"
+		"     (SCHED_IDLE), nice (nice 19) or none (default), both with\n"
+		"     idle I/O priority. The presentation keeps its priority\n\n"
+		"  --affinity <cpus> Pin all threads to <cpus>: a CPU list (e.g:\n"
+		"     0-3,8), efficiency or performance (core types of hybrid\n"
+		"     CPUs), llc (CPUs sharing the last L3 cache) or auto\n"
+		"     (efficiency cores, or else the last L3). Unless --threads is\n"
+		"     set, decodes with one thread per CPU selected\n\n"
+		"  --cpu-budget <percent> Keep the CPU usage (in %% of one CPU)\n"
+		"     under <percent>, lowering the FPS cap and the decoding\n"
+		"     quality (or, as a last resort, pausing) as needed\n\n"
+		"  --dirty-rects Upload only the regions that changed, as told\n"
+		"     by the decoder motion vectors (software decoding only)\n\n"
+		"  --motion-adaptive Lower the frame rate (down to a quarter)\n"
+		"     while the scene barely moves, back to full rate as soon\n"
+		"     as it moves again\n\n"
+		"  --lookahead Predict the decode cost of the packets ahead\n"
+		"     (learned per file) and decode early only before the\n"
+		"     expensive ones, keeping the picture queue shallow\n\n"
+		"  --queue-depth <min>:<max> Size the picture queue (default: 8\n"
+		"     frames) from the decode time jitter and the missed\n"
+		"     deadlines, between <min> and <max> frames\n\n"
+		"  --renderer <name> SDL render driver (e.g: opengl, opengles2,\n"
+		"     software), 'auto' to use the fastest one for the stream\n"
+		"     and screen (timed once, then cached) or 'calibrate' to\n"
+		"     time them again\n\n"
+		"  --single-thread Run demuxing, decoding, pause checks and\n"
+		"     presentation as cooperative steps of a single thread (and\n"
+		"     a single decoding thread, unless set with --threads), for\n"
+		"     single-core machines (no watchdog or lookahead)\n\n"
+		"  --renditions If the file has the video at several resolutions,\n"
+		"     play the one that best fits the screen, switching to a\n"
+		"     lower one under load (and back up when it is gone)\n\n"
+		"  --auto-tune Trial candidate configurations (decoding threads,\n"
+		"     single-threaded mode, dirty regions, adaptive queue and\n"
+		"     renditions) on the input file with the headless pacing test,\n"
+		"     and play with the cheapest one that meets the pacing target.\n"
+		"     The result is cached per machine, file and options, and the\n"
+		"     render driver is calibrated (see --renderer auto). Options\n"
+		"     set by the user are not tuned\n\n"
+		"  --retune Same as --auto-tune, but ignores the cached result\n\n"
+		"  --task-pool <N> Run the decoder jobs, the export, the motion\n"
+		"     analysis and the occlusion scans on a shared work-stealing\n"
+		"     pool of <N> threads (0: sized, along with the decode thread,\n"
+		"     to the CPU budget or to the CPUs). --threads then limits the\n"
+		"     decoder jobs in flight\n\n"
 		"  -h This help\n\n"
 		"Note:\n"
 		"  Please note that some options depends on the screen resolution.\n"
@@ -1599,54 +2897,257 @@ static void usage(const char *prgname)
 }
 
 /**
- * @brief For a given string WIDTHxHEIGHT, parses it
- * and returns the width and height.
+ * @brief For a given string WIDTHxHEIGHT, parses it
+ * and returns the width and height.
+ *
+ * @param res Resolution string.
+ * @param w Returned width pointer.
+ * @param h Returned height pointer.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int get_resolution(const char *res, int *w, int *h)
+{
+	const char *p = res;
+
+	/* Read width. */
+	*w = 0;
+	while (*p && isdigit(*p))
+	{
+		*w *= 10;
+		*w += *p - '0';
+		p++;
+	}
+
+	/* Skip delimiter, single char. */
+	p++;
+	if (!*p)
+		return (-1);
+
+	/* Read height. */
+	*h = 0;
+	while (*p && isdigit(*p))
+	{
+		*h *= 10;
+		*h += *p - '0';
+		p++;
+	}
+
+	/* Validate remaining. */
+	while (*p)
+	{
+		if (!isspace(*p))
+			return (-1);
+		p++;
+	}
+
+	if (!*w || !*h)
+		return (-1);
+
+	return (0);
+}
+
+/* Long options. */
+#define OPT_BENCH          256
+#define OPT_BENCH_STOP     257
+#define OPT_BENCH_RENDERER 258
+#define OPT_BENCH_PACED    259
+#define OPT_THREADS        260
+#define OPT_FPS_CAP        261
+#define OPT_BENCH_PACING   262
+#define OPT_PACING_TOL     263
+#define OPT_CHECKSUM       264
+#define OPT_CHECKSUM_VERIFY  265
+#define OPT_CHECKSUM_PRESENT 266
+#define OPT_EXPORT         267
+#define OPT_EXPORT_FORMAT  268
+#define OPT_EXPORT_RANGE   269
+#define OPT_EXPORT_THREADS 270
+#define OPT_POWER_PROFILES 271
+#define OPT_PROFILE_AC     272
+#define OPT_PROFILE_BATTERY 273
+#define OPT_PSI            274
+#define OPT_BG_SCHED       275
+#define OPT_AFFINITY       276
+#define OPT_CPU_BUDGET     277
+#define OPT_DIRTY_RECTS    278
+#define OPT_MOTION         279
+#define OPT_LOOKAHEAD      280
+#define OPT_QUEUE_DEPTH    281
+#define OPT_RENDERER       282
+#define OPT_RENDITIONS     283
+#define OPT_SINGLE_THREAD  284
+#define OPT_TASK_POOL      285
+#define OPT_AUTO_TUNE      286
+#define OPT_RETUNE         287
+static const struct option long_options[] = {
+	{"bench",          no_argument,       NULL, OPT_BENCH},
+	{"bench-stop",     required_argument, NULL, OPT_BENCH_STOP},
+	{"bench-renderer", required_argument, NULL, OPT_BENCH_RENDERER},
+	{"bench-paced",    no_argument,       NULL, OPT_BENCH_PACED},
+	{"threads",        required_argument, NULL, OPT_THREADS},
+	{"fps-cap",        required_argument, NULL, OPT_FPS_CAP},
+	{"bench-pacing",   required_argument, NULL, OPT_BENCH_PACING},
+	{"pacing-tolerance", required_argument, NULL, OPT_PACING_TOL},
+	{"checksum",         required_argument, NULL, OPT_CHECKSUM},
+	{"checksum-verify",  required_argument, NULL, OPT_CHECKSUM_VERIFY},
+	{"checksum-present", no_argument,       NULL, OPT_CHECKSUM_PRESENT},
+	{"export",           required_argument, NULL, OPT_EXPORT},
+	{"export-format",    required_argument, NULL, OPT_EXPORT_FORMAT},
+	{"export-range",     required_argument, NULL, OPT_EXPORT_RANGE},
+	{"export-threads",   required_argument, NULL, OPT_EXPORT_THREADS},
+	{"power-profiles",   no_argument,       NULL, OPT_POWER_PROFILES},
+	{"profile-ac",       required_argument, NULL, OPT_PROFILE_AC},
+	{"profile-battery",  required_argument, NULL, OPT_PROFILE_BATTERY},
+	{"psi",              no_argument,       NULL, OPT_PSI},
+	{"bg-sched",         required_argument, NULL, OPT_BG_SCHED},
+	{"affinity",         required_argument, NULL, OPT_AFFINITY},
+	{"cpu-budget",       required_argument, NULL, OPT_CPU_BUDGET},
+	{"dirty-rects",      no_argument,       NULL, OPT_DIRTY_RECTS},
+	{"motion-adaptive",  no_argument,       NULL, OPT_MOTION},
+	{"lookahead",        no_argument,       NULL, OPT_LOOKAHEAD},
+	{"queue-depth",      required_argument, NULL, OPT_QUEUE_DEPTH},
+	{"renderer",         required_argument, NULL, OPT_RENDERER},
+	{"renditions",       no_argument,       NULL, OPT_RENDITIONS},
+	{"single-thread",    no_argument,       NULL, OPT_SINGLE_THREAD},
+	{"task-pool",        required_argument, NULL, OPT_TASK_POOL},
+	{"auto-tune",        no_argument,       NULL, OPT_AUTO_TUNE},
+	{"retune",           no_argument,       NULL, OPT_RETUNE},
+	{NULL, 0, NULL, 0}
+};
+
+/**
+ * @brief Given a stage name @p name, returns its number.
+ *
+ * @param name Stage name.
+ *
+ * @return Returns the stage number, or -1 if not found.
+ */
+static int get_stage(const char *name)
+{
+	int i;
+	for (i = 0; i < STAGE_NR; i++)
+		if (!strcmp(stage_names[i], name))
+			return (i);
+	return (-1);
+}
+
+/**
+ * @brief Given a background class name @p name, returns its
+ * number.
+ *
+ * @param name Class name.
+ *
+ * @return Returns the class number, or -1 if not found.
+ */
+static int get_bg_sched(const char *name)
+{
+	int i;
+	for (i = 0; i < BG_SCHED_NR; i++)
+		if (!strcmp(bg_sched_names[i], name))
+			return (i);
+	return (-1);
+}
+
+/**
+ * @brief Given an export format name @p name, returns its
+ * number.
+ *
+ * @param name Format name.
+ *
+ * @return Returns the format number, or -1 if not found.
+ */
+static int get_export_format(const char *name)
+{
+	int i;
+	for (i = 0; i < EXPORT_FMT_NR; i++)
+		if (!strcmp(export_format_names[i], name))
+			return (i);
+	return (-1);
+}
+
+/**
+ * @brief Parses a frame range in the format: first[:last].
  *
- * @param res Resolution string.
- * @param w Returned width pointer.
- * @param h Returned height pointer.
+ * @param range Range string.
+ * @param first Returned first frame.
+ * @param last Returned last frame (ULONG_MAX if absent).
  *
  * @return Returns 0 if success, -1 otherwise.
  */
-static int get_resolution(const char *res, int *w, int *h)
+static int get_frame_range(const char *range, unsigned long *first,
+	unsigned long *last)
 {
-	const char *p = res;
+	char *end;
 
-	/* Read width. */
-	*w = 0;
-	while (*p && isdigit(*p))
+	if (!isdigit(*range))
+		return (-1);
+
+	*first = strtoul(range, &end, 10);
+	*last  = ULONG_MAX;
+
+	if (*end == ':')
 	{
-		*w *= 10;
-		*w += *p - '0';
-		p++;
+		if (!isdigit(end[1]))
+			return (-1);
+		*last = strtoul(end + 1, &end, 10);
 	}
 
-	/* Skip delimiter, single char. */
-	p++;
-	if (!*p)
+	if (*end || *last < *first)
 		return (-1);
 
-	/* Read height. */
-	*h = 0;
-	while (*p && isdigit(*p))
+	return (0);
+}
+
+/**
+ * @brief Applies the auto-tuned configuration (cached, or
+ * trialed right now) to the knobs not set by the user.
+ *
+ * @param argv Argument list, options first (as left by
+ * getopt), then the input file.
+ */
+static void auto_tune(char **argv)
+{
+	struct tune_config cfg;
+	int fixed;
+
+	fixed = 0;
+	if (decode_threads >= 0 || (cmd_flags & CMD_POOL))
+		fixed |= TUNE_THREADS;
+	if (cmd_flags & CMD_COOP)
+		fixed |= TUNE_COOP;
+	if (cmd_flags & (CMD_DIRTY_RECTS|CMD_HW_ACCEL))
+		fixed |= TUNE_DIRTY_RECTS;
+	if (cmd_flags & (CMD_QUEUE_ADAPT|CMD_LOOKAHEAD))
+		fixed |= TUNE_QUEUE;
+	if (cmd_flags & CMD_RENDITIONS)
+		fixed |= TUNE_RENDITIONS;
+
+	if (tune_config(argv, optind, argv[optind], fixed, tune_retune,
+		&cfg) < 0)
 	{
-		*h *= 10;
-		*h += *p - '0';
-		p++;
+		LOG("tune: keeping the default configuration\n");
+		return;
 	}
 
-	/* Validate remaining. */
-	while (*p)
+	if (cfg.threads >= 0)
+		decode_threads = cfg.threads;
+	if (cfg.coop)
+		cmd_flags |= CMD_COOP;
+	if (cfg.dirty_rects)
+		cmd_flags |= CMD_DIRTY_RECTS;
+	if (cfg.queue_min)
 	{
-		if (!isspace(*p))
-			return (-1);
-		p++;
+		queue_min   = cfg.queue_min;
+		queue_limit = cfg.queue_max;
+		cmd_flags  |= CMD_QUEUE_ADAPT;
 	}
+	if (cfg.renditions)
+		cmd_flags |= CMD_RENDITIONS;
 
-	if (!*w || !*h)
-		return (-1);
-
-	return (0);
+	/* The render driver has a calibration (and cache) of its own. */
+	if (!render_driver[0])
+		strcpy(render_driver, "auto");
 }
 
 /**
@@ -1660,7 +3161,9 @@ static int get_resolution(const char *res, int *w, int *h)
 static char* parse_args(int argc, char **argv)
 {
 	int c; /* Current arg. */
-	while ((c = getopt(argc, argv, "howbksfr:d:p")) != -1)
+	int ncpus = 0;
+	while ((c = getopt_long(argc, argv, "howbksfr:d:pt:R", long_options,
+		NULL)) != -1)
 	{
 		switch (c)
 		{
@@ -1705,12 +3208,330 @@ static char* parse_args(int argc, char **argv)
 			case 'p':
 				cmd_flags |= CMD_PAUSE_SIGNAL;
 				break;
+			case 't':
+				watchdog_periods = atoi(optarg);
+				if (watchdog_periods <= 0)
+				{
+					fprintf(stderr, "Invalid watchdog periods (%s)\n", optarg);
+					usage(argv[0]);
+				}
+				cmd_flags |= CMD_WATCHDOG;
+				break;
+			case 'R':
+				cmd_flags |= CMD_STALL_RECOVER;
+				break;
+			case OPT_BENCH:
+				cmd_flags |= CMD_BENCH;
+				break;
+			case OPT_BENCH_STOP:
+				stop_stage = get_stage(optarg);
+				if (stop_stage < 0)
+				{
+					fprintf(stderr, "Invalid stage (%s)\n", optarg);
+					usage(argv[0]);
+				}
+				break;
+			case OPT_BENCH_RENDERER:
+				strncpy(bench_renderer, optarg, sizeof(bench_renderer) - 1);
+				break;
+			case OPT_BENCH_PACED:
+				cmd_flags |= CMD_BENCH | CMD_BENCH_PACED;
+				break;
+			case OPT_THREADS:
+				decode_threads = atoi(optarg);
+				if (decode_threads < 0)
+				{
+					fprintf(stderr, "Invalid number of threads (%s)\n", optarg);
+					usage(argv[0]);
+				}
+				break;
+			case OPT_FPS_CAP:
+				dp.fps_cap = atof(optarg);
+				if (dp.fps_cap <= 0)
+				{
+					fprintf(stderr, "Invalid FPS cap (%s)\n", optarg);
+					usage(argv[0]);
+				}
+				break;
+			case OPT_BENCH_PACING:
+				pacing_secs = atof(optarg);
+				if (pacing_secs <= 0)
+				{
+					fprintf(stderr, "Invalid pacing duration (%s)\n", optarg);
+					usage(argv[0]);
+				}
+				cmd_flags |= CMD_BENCH | CMD_BENCH_PACED | CMD_PACING;
+				break;
+			case OPT_PACING_TOL:
+				pacing_tolerance = atof(optarg);
+				if (pacing_tolerance <= 0)
+				{
+					fprintf(stderr, "Invalid pacing tolerance (%s)\n", optarg);
+					usage(argv[0]);
+				}
+				break;
+			case OPT_CHECKSUM:
+			case OPT_CHECKSUM_VERIFY:
+				checksum_path = optarg;
+				checksum_verify = (c == OPT_CHECKSUM_VERIFY);
+				cmd_flags |= CMD_CHECKSUM;
+				break;
+			case OPT_CHECKSUM_PRESENT:
+				cmd_flags |= CMD_CHECKSUM_PRESENT;
+				break;
+			case OPT_EXPORT:
+				export_dir = optarg;
+				cmd_flags |= CMD_BENCH | CMD_EXPORT;
+				break;
+			case OPT_EXPORT_FORMAT:
+				export_fmt = get_export_format(optarg);
+				if (export_fmt < 0)
+				{
+					fprintf(stderr, "Invalid export format (%s)\n", optarg);
+					usage(argv[0]);
+				}
+				break;
+			case OPT_EXPORT_RANGE:
+				if (get_frame_range(optarg, &export_first, &export_last) < 0)
+				{
+					fprintf(stderr, "Invalid frame range (%s)\n", optarg);
+					usage(argv[0]);
+				}
+				break;
+			case OPT_EXPORT_THREADS:
+				export_threads = atoi(optarg);
+				if (export_threads <= 0)
+				{
+					fprintf(stderr, "Invalid number of export threads (%s)\n",
+						optarg);
+					usage(argv[0]);
+				}
+				break;
+			case OPT_POWER_PROFILES:
+				cmd_flags |= CMD_POWER;
+				break;
+			case OPT_PROFILE_AC:
+				ac_spec = optarg;
+				cmd_flags |= CMD_POWER;
+				break;
+			case OPT_PROFILE_BATTERY:
+				battery_spec = optarg;
+				cmd_flags |= CMD_POWER;
+				break;
+			case OPT_PSI:
+				cmd_flags |= CMD_PSI;
+				break;
+			case OPT_BG_SCHED:
+				bg_sched = get_bg_sched(optarg);
+				if (bg_sched < 0)
+				{
+					fprintf(stderr, "Invalid scheduling class (%s)\n", optarg);
+					usage(argv[0]);
+				}
+				break;
+			case OPT_AFFINITY:
+				affinity_spec = optarg;
+				break;
+			case OPT_CPU_BUDGET:
+				cpu_budget = atof(optarg);
+				if (cpu_budget <= 0)
+				{
+					fprintf(stderr, "Invalid CPU budget (%s)\n", optarg);
+					usage(argv[0]);
+				}
+				cmd_flags |= CMD_BUDGET;
+				break;
+			case OPT_DIRTY_RECTS:
+				cmd_flags |= CMD_DIRTY_RECTS;
+				break;
+			case OPT_MOTION:
+				cmd_flags |= CMD_MOTION;
+				break;
+			case OPT_LOOKAHEAD:
+				cmd_flags |= CMD_LOOKAHEAD;
+				break;
+			case OPT_QUEUE_DEPTH:
+				if (sscanf(optarg, "%d:%d", &queue_min, &queue_limit) != 2 ||
+					queue_min < 1 || queue_min > queue_limit ||
+					queue_limit > QUEUE_DEPTH_MAX)
+				{
+					fprintf(stderr, "Invalid queue depth (%s)\n", optarg);
+					usage(argv[0]);
+				}
+				cmd_flags |= CMD_QUEUE_ADAPT;
+				break;
+			case OPT_RENDERER:
+				strncpy(render_driver, optarg, sizeof(render_driver) - 1);
+				break;
+			case OPT_RENDITIONS:
+				cmd_flags |= CMD_RENDITIONS;
+				break;
+			case OPT_SINGLE_THREAD:
+				cmd_flags |= CMD_COOP;
+				break;
+			case OPT_TASK_POOL:
+				pool_threads = atoi(optarg);
+				if (pool_threads < 0)
+				{
+					fprintf(stderr, "Invalid pool size (%s)\n", optarg);
+					usage(argv[0]);
+				}
+				cmd_flags |= CMD_POOL;
+				break;
+			case OPT_RETUNE:
+				tune_retune = 1;
+				/* Fall through. */
+			case OPT_AUTO_TUNE:
+				cmd_flags |= CMD_AUTOTUNE;
+				break;
 			default:
 				usage(argv[0]);
 				break;
 		}
 	}
 
+	/*
+	 * Auto-tuning, before anything is derived from the knobs.
+	 * The trials are benchmarks themselves: never tuned.
+	 */
+	if ((cmd_flags & (CMD_AUTOTUNE|CMD_BENCH)) == CMD_AUTOTUNE &&
+		optind < argc)
+	{
+		auto_tune(argv);
+	}
+
+	if ((cmd_flags & CMD_STALL_RECOVER) && !(cmd_flags & CMD_WATCHDOG))
+	{
+		fprintf(stderr, "Option -R requires -t!\n");
+		usage(argv[0]);
+	}
+
+	if ((cmd_flags & CMD_CHECKSUM_PRESENT) && !(cmd_flags & CMD_CHECKSUM))
+	{
+		fprintf(stderr, "Option --checksum-present requires --checksum "
+			"or --checksum-verify!\n");
+		usage(argv[0]);
+	}
+
+	/*
+	 * CPU affinity: unless told otherwise, use as many decoding
+	 * (and export) threads as CPUs available.
+	 */
+	if (affinity_spec)
+	{
+		ncpus = affinity_init(affinity_spec);
+		if (ncpus < 0)
+		{
+			fprintf(stderr, "Invalid affinity (%s)\n", affinity_spec);
+			usage(argv[0]);
+		}
+		if (ncpus > 0 && decode_threads < 0)
+			decode_threads = ncpus;
+		if (ncpus > 0 && !export_threads)
+			export_threads = ncpus;
+	}
+
+	/*
+	 * Task pool: the decoder runs its jobs on it (with no
+	 * threads of its own), and the decode thread helps, so the
+	 * pool plus the decode thread are sized to the CPU budget
+	 * (rounded up to whole CPUs), or else to the CPUs available.
+	 * A single thread has no use for it.
+	 */
+	if (cmd_flags & CMD_COOP)
+		cmd_flags &= ~CMD_POOL;
+	if ((cmd_flags & CMD_POOL) && !pool_threads)
+	{
+		if (cmd_flags & CMD_BUDGET)
+			pool_threads = (int)ceil(cpu_budget / 100.0) - 1;
+		else
+			pool_threads = (ncpus > 0 ? ncpus : SDL_GetCPUCount()) - 1;
+		if (pool_threads <= 0)
+			cmd_flags &= ~CMD_POOL;
+	}
+
+	/*
+	 * Cooperative mode: a single thread, so no watchdog, no peeking
+	 * into a packet queue (lookahead) and a single decoding thread,
+	 * unless told otherwise (before the AC profile takes it).
+	 */
+	if (cmd_flags & CMD_COOP)
+	{
+		cmd_flags &= ~(CMD_WATCHDOG|CMD_LOOKAHEAD);
+		if (decode_threads < 0)
+			decode_threads = 1;
+	}
+
+	/*
+	 * Power profiles: AC defaults to the command line
+	 * settings, battery to a low-power profile.
+	 */
+	ac_profile.fps_cap   = dp.fps_cap;
+	ac_profile.threads   = decode_threads;
+	ac_profile.quality   = 0;
+	ac_profile.occlusion = SCREEN_AREA_THRESHOLD;
+
+	battery_profile.fps_cap = BATTERY_FPS_CAP;
+	if (dp.fps_cap > 0 && dp.fps_cap < BATTERY_FPS_CAP)
+		battery_profile.fps_cap = dp.fps_cap;
+	battery_profile.threads   = BATTERY_THREADS;
+	battery_profile.quality   = BATTERY_QUALITY;
+	battery_profile.occlusion = BATTERY_AREA_THRESHOLD;
+
+	if (ac_spec && profile_parse(ac_spec, &ac_profile) < 0)
+	{
+		fprintf(stderr, "Invalid AC profile (%s)\n", ac_spec);
+		usage(argv[0]);
+	}
+	if (battery_spec && profile_parse(battery_spec, &battery_profile) < 0)
+	{
+		fprintf(stderr, "Invalid battery profile (%s)\n", battery_spec);
+		usage(argv[0]);
+	}
+
+	/* Lookahead alone: shallow, unless there is a spike ahead. */
+	if ((cmd_flags & (CMD_LOOKAHEAD|CMD_QUEUE_ADAPT)) == CMD_LOOKAHEAD)
+		queue_min = LOOKAHEAD_MIN_DEPTH;
+
+	/* Benchmarks must be reproducible. */
+	if (cmd_flags & CMD_BENCH)
+		cmd_flags &= ~(CMD_POWER|CMD_PSI);
+
+	/*
+	 * Throttling may pause the playback, and the budget is
+	 * checked along with the pause checks.
+	 */
+	if (cmd_flags & (CMD_PSI|CMD_BUDGET))
+		cmd_flags |= CMD_PAUSE_SIGNAL;
+
+	/*
+	 * Export runs the pipeline up to the conversion, as fast
+	 * as possible: no window or renderer is needed.
+	 */
+	if (cmd_flags & CMD_EXPORT)
+	{
+		cmd_flags &= ~(CMD_BENCH_PACED|CMD_PACING);
+		stop_stage = STAGE_CONVERT;
+	}
+
+	/*
+	 * Benchmark runs the input only once, in a (hidden) window,
+	 * without any pause.
+	 *
+	 * The pacing test is the exception: loop seams and
+	 * pause/resume are part of what is measured.
+	 */
+	if (cmd_flags & CMD_BENCH)
+	{
+		if (cmd_flags & CMD_PACING)
+			cmd_flags |= CMD_PAUSE_SIGNAL;
+		else
+			cmd_flags &= ~(CMD_LOOP|CMD_PAUSE_SIGNAL);
+
+		cmd_flags &= ~CMD_BACKGROUND;
+		cmd_flags |= CMD_WINDOWED;
+	}
+
 	/* If not input file available. */
 	if (optind >= argc)
 	{
@@ -1733,9 +3554,62 @@ void sig_pause(int sig)
 	signal(SIGUSR1, sig_pause);
 }
 
+/**
+ * @Brief Signal handler for stats dump commands.
+ *
+ * @param sig Signal number, ignored.
+ */
+void sig_stats(int sig)
+{
+	((void)sig);
+	should_dump_stats = 1;
+	signal(SIGUSR2, sig_stats);
+}
+
+/**
+ * @brief Power source callback: switches to the profile of
+ * the current power source.
+ *
+ * @param battery 1 if on battery, 0 if on AC.
+ * @param data av_decode_params structure.
+ */
+static void apply_profile(int battery, void *data)
+{
+	struct perf_profile *p;
+
+	p = battery ? &battery_profile : &ac_profile;
+	LOG("power: on %s, fps cap: %g, threads: %d, quality: %d, "
+		"occlusion: %d%%\n", battery ? "battery" : "AC", p->fps_cap,
+		p->threads, p->quality, p->occlusion);
+
+	on_battery = battery;
+	update_knobs((struct av_decode_params *)data);
+}
+
+/**
+ * @brief Pressure callback: switches to the throttle level
+ * @p level.
+ *
+ * @param level New throttle level (THROTTLE_*).
+ * @param data av_decode_params structure.
+ */
+static void apply_throttle(int level, void *data)
+{
+	static const char *const names[THROTTLE_NR] = {
+		"none", "reduced", "minimal", "paused"
+	};
+
+	LOG("psi: throttle level: %d (%s)\n", level, names[level]);
+
+	throttle_level = level;
+	stats.throttle_level = level;
+	update_knobs((struct av_decode_params *)data);
+}
+
 /* Main =). */
 int main(int argc, char **argv)
 {
+	double fps;
 	int ret;
 	SDL_Event event;
 	char *input_file;
@@ -1745,26 +3619,135 @@ int main(int argc, char **argv)
 	/* Parse arguments. */
 	input_file = parse_args(argc, argv);
 
-	/* Register pause signal. */
+	/* Pin before creating any thread, so all of them inherit it. */
+	if (affinity_apply() < 0)
+		goto out0;
+
+	/* Register pause and stats signals. */
 	signal(SIGUSR1, sig_pause);
+	signal(SIGUSR2, sig_stats);
 
 	/* Initialize AV stuff. */
 	if (init_av(&dp, input_file) < 0)
 		LOG_GOTO("Unable to process input file, aborting!\n", out0);
 
+	/* Rendition that best fits the screen. */
+	if (cmd_flags & CMD_RENDITIONS)
+		select_rendition(&dp);
+
 	/* Initialize queues. */
-	if (init_packet_queue(&packet_queue) < 0)
+	if (init_packet_queue(&packet_queue, MAX_PACKET_QUEUE) < 0)
 		LOG_GOTO("Unable to initialize packet queue!\n", out1);
-	if (init_picture_queue(&picture_queue) < 0)
+	if (init_picture_queue(&picture_queue, MAX_PICTURE_QUEUE) < 0)
 		LOG_GOTO("Unable to initialize picture queue!\n", out2);
+	stats.queue_max = MAX_PICTURE_QUEUE;
+	stats.queue_frame_bytes = (double)dp.codec_context->width *
+		dp.codec_context->height * 3 / 2;
+
+	/* Decode cost models. */
+	if (cmd_flags & CMD_LOOKAHEAD)
+		cost_init(input_file);
+
+	/* Shallowest queue, until something is learned or measured. */
+	queue_base = queue_min;
+	set_queue_depth();
+
+	/* Golden-frame checksums. */
+	if (cmd_flags & CMD_CHECKSUM)
+	{
+		if (checksum_open(checksum_path, checksum_verify,
+			(cmd_flags & CMD_CHECKSUM_PRESENT) ? "present" : "texture") < 0)
+		{
+			goto out3;
+		}
+	}
+
+	/* Shared task pool, before anything that submits tasks. */
+	if (cmd_flags & CMD_POOL)
+	{
+		if (pool_init(pool_threads) < 0)
+			goto out3;
+	}
+
+	/* Frame export (on the task pool). */
+	if (cmd_flags & CMD_EXPORT)
+	{
+		if (export_init(export_dir, export_fmt, export_first, export_last,
+			export_threads) < 0)
+		{
+			goto out3;
+		}
+	}
+
+	/* Dirty regions tracking. */
+	if (cmd_flags & CMD_DIRTY_RECTS)
+	{
+		if (dirty_init(dp.codec_context->width,
+			dp.codec_context->height) < 0)
+		{
+			goto out3;
+		}
+	}
+
+	/* Profiles and throttling. */
+	if (cmd_flags & (CMD_POWER|CMD_PSI|CMD_BUDGET))
+	{
+		knobs_mutex = SDL_CreateMutex();
+		if (!knobs_mutex)
+			LOG_GOTO("Unable to create the knobs mutex!\n", out3);
+	}
+
+	/* Follow the power source. */
+	if (cmd_flags & CMD_POWER)
+	{
+		if (power_start(apply_profile, &dp) < 0)
+			goto out3;
+	}
+
+	/* Back off under CPU/IO pressure, not a big deal if unavailable. */
+	if (cmd_flags & CMD_PSI)
+		psi_start(apply_throttle, &dp);
+
+	/* Stream frame rate. */
+	fps = av_q2d(dp.format_context->streams[dp.video_idx]->avg_frame_rate);
+	if (fps <= 0)
+		fps = 60.0;
+
+	/* CPU budget, full effort means the stream frame rate. */
+	if (cmd_flags & CMD_BUDGET)
+		budget_init(cpu_budget, fps);
+
+	/* Motion-adaptive frame rate, full rate is the stream one. */
+	if (cmd_flags & CMD_MOTION)
+	{
+		if (motion_init(fps) < 0)
+			goto out3;
+	}
 
 	/* Initialize SDL and start enqueue & decode packet threads. */
+	stats_begin();
 	if (init_sdl(&dp) < 0)
 		LOG_GOTO("Unable to initialize SDL, aborting!\n", out3);
 
+	if ((cmd_flags & (CMD_BENCH|CMD_BENCH_PACED)) == CMD_BENCH)
+	{
+		ret = bench_loop(&dp, input_file) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+		goto join;
+	}
+
 	/* Start our refresh timer. */
+	if (cmd_flags & CMD_PACING)
+		pacing_begin(pacing_secs);
 	schedule_refresh(&dp, 40);
 
+	/* Cooperative mode: everything runs in its own loop. */
+	if (cmd_flags & CMD_COOP)
+	{
+		coop_loop(&dp);
+		should_quit = 1;
+		goto done;
+	}
+
 	/* SDL/Event loop. */
 	while (1)
 	{
@@ -1774,24 +3757,63 @@ int main(int argc, char **argv)
 		{
 			should_quit = 1;
 			SDL_CondSignal(picture_queue.cond);
-			SDL_CondSignal(packet_queue.cond);
-			SDL_CondSignal(dp.pause_cond);
+			SDL_CondBroadcast(packet_queue.cond);
 			break;
 		}
 
 		else if (event.type == (Uint32)SDL_EVENT_REFRESH_SCREEN)
+		{
 			refresh_screen(event.user.data1);
+
+			/* Pacing test is over. */
+			if ((cmd_flags & CMD_PACING) && pacing_done())
+			{
+				event.type = SDL_QUIT;
+				SDL_PushEvent(&event);
+			}
+		}
+
+		if (should_dump_stats)
+		{
+			should_dump_stats = 0;
+			stats_dump(stderr);
+		}
+	}
+
+done:
+	ret = EXIT_SUCCESS;
+	if (cmd_flags & CMD_PACING)
+	{
+		if (pacing_report(stdout, input_file, pacing_tolerance) < 0)
+			ret = EXIT_FAILURE;
 	}
+	else if (cmd_flags & CMD_BENCH_PACED)
+		bench_report(&dp, input_file);
 
+join:
 	SDL_WaitThread(enqueue_thread, NULL);
 	SDL_WaitThread(decode_thread, NULL);
 
-	if (cmd_flags & (CMD_BACKGROUND|CMD_PAUSE_SIGNAL))
-		SDL_WaitThread(pause_thread, NULL);
+	if (cmd_flags & CMD_WATCHDOG)
+		SDL_WaitThread(watchdog_thread, NULL);
 
-	ret = EXIT_SUCCESS;
 out3:
+	psi_stop();
+	power_stop();
+	if (knobs_mutex)
+		SDL_DestroyMutex(knobs_mutex);
+	if (checksum_close() < 0)
+		ret = EXIT_FAILURE;
+	if (export_finish() < 0)
+		ret = EXIT_FAILURE;
+	pool_finish();
+	if (cmd_flags & CMD_COOP)
+		coop_finish();
 	finish_picture_queue(&picture_queue);
+	dirty_finish();
+	motion_finish();
+	if (cmd_flags & CMD_LOOKAHEAD)
+		cost_save();
 	finish_sdl();
 out2:
 	finish_packet_queue(&packet_queue);
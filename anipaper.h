@@ -25,6 +25,7 @@
 #ifndef ANIPAPER_H
 #define ANIPAPER_H
 
+	#include <stdint.h>
 	#include <SDL.h>
 
 	/*
@@ -40,6 +41,74 @@
 	#define CHECK_PAUSE_MS 100
 #endif
 
+	/* Watchdog minimum check interval. */
+#ifndef WATCHDOG_CHECK_MS
+	#define WATCHDOG_CHECK_MS 100
+#endif
+
+	/* Timer slack of the background threads (in ns). */
+#ifndef BG_TIMER_SLACK_NS
+	#define BG_TIMER_SLACK_NS 50000000
+#endif
+
+	/* Battery (low-power) profile defaults. */
+#ifndef BATTERY_FPS_CAP
+	#define BATTERY_FPS_CAP 24
+#endif
+#ifndef BATTERY_THREADS
+	#define BATTERY_THREADS 1
+#endif
+#ifndef BATTERY_QUALITY
+	#define BATTERY_QUALITY 2
+#endif
+#ifndef BATTERY_AREA_THRESHOLD
+	#define BATTERY_AREA_THRESHOLD 50
+#endif
+
+	/*
+	 * Motion-adaptive frame rate: activity (mean absolute
+	 * luma difference) below which the rate is a quarter and
+	 * a half of the stream rate, time it must stay low, and
+	 * lowest rate.
+	 */
+#ifndef MOTION_LOW_ACTIVITY
+	#define MOTION_LOW_ACTIVITY 1.0
+#endif
+#ifndef MOTION_MID_ACTIVITY
+	#define MOTION_MID_ACTIVITY 3.0
+#endif
+#ifndef MOTION_HOLD_MS
+	#define MOTION_HOLD_MS 1000
+#endif
+#ifndef MOTION_MIN_FPS
+	#define MOTION_MIN_FPS 10.0
+#endif
+
+	/* Picture queue depth with lookahead, without expensive frames. */
+#ifndef LOOKAHEAD_MIN_DEPTH
+	#define LOOKAHEAD_MIN_DEPTH 2
+#endif
+
+	/*
+	 * Adaptive picture queue: standard deviations of the decode
+	 * time covered, time without missed deadlines to remove a
+	 * frame, and largest depth allowed.
+	 */
+#ifndef QUEUE_JITTER_K
+	#define QUEUE_JITTER_K 3.0
+#endif
+#ifndef QUEUE_CALM_MS
+	#define QUEUE_CALM_MS 5000
+#endif
+#ifndef QUEUE_DEPTH_MAX
+	#define QUEUE_DEPTH_MAX 64
+#endif
+
+	/* Auto-tuning: duration of each trial (in seconds). */
+#ifndef AUTOTUNE_TRIAL_SECS
+	#define AUTOTUNE_TRIAL_SECS 4
+#endif
+
 	/* Logs. */
 	#define LOG_GOTO(log,lbl) \
 		do { \
@@ -58,13 +127,11 @@
 	{
 		/* Video decode stuff. */
 		int video_idx;
+		int next_idx; /* Rendition wanted, from its next keyframe. */
 		AVCodecContext *codec_context;
 		AVFormatContext *format_context;
 
-		/* Scale stuff. */
-		struct SwsContext *sws_ctx;
-		uint8_t *dst_img[4];
-		int dst_linesize[4];
+		/* Screen stuff. */
 		int screen_width;
 		int screen_height;
 
@@ -74,21 +141,280 @@
 		double frame_last_pts;
 		double frame_timer;
 
+		/* FPS cap (0 if none) and next pts allowed by it. */
+		double fps_cap;
+		double cap_next_pts;
+
+		/* Next pts allowed by the motion-adaptive rate. */
+		double motion_next_pts;
+
+		/*
+		 * Presentation clock: a frame with pts P is due at
+		 * clock_base + P (0 if not known yet).
+		 */
+		double clock_base;
+
 		/* Pause stuff. */
 		int paused;
 		double time_before_pause;
-		SDL_mutex *pause_mutex;
-		SDL_cond *pause_cond;
 
 		/* HW decoding. */
 		AVBufferRef *hw_device_ctx;
 		enum AVPixelFormat hw_pix_fmt;
+
+		/* Stall recovery. */
+		volatile int stall_recover;
+		int resync;
+
+		/* Task pool: pts (in seconds) of the packet being decoded. */
+		double decode_pts;
+
+		/*
+		 * Decoder knobs: requested by any thread, applied by
+		 * the decode thread between packets.
+		 */
+		int quality;       /* Quality ladder level wanted.       */
+		int cur_quality;   /* Quality ladder level in use.       */
+		int threads;       /* Decoding threads wanted (-1: default). */
+		int cur_threads;   /* Decoding threads in use.           */
+		int wait_keyframe; /* Decoder reopened, wait a keyframe. */
+	};
+
+	/*
+	 * Quality ladder: 0 is the full quality, each level skips
+	 * more decoding work (loop filter, then non-ref frames).
+	 */
+	#define QUALITY_MAX 3
+
+	/* Performance profile. */
+	struct perf_profile
+	{
+		double fps_cap; /* FPS cap, 0 if none.               */
+		int threads;    /* Decoding threads, -1 for default. */
+		int quality;    /* Quality ladder floor.             */
+		int occlusion;  /* Occlusion threshold (in %).       */
+	};
+
+	/* Throttle levels, under CPU/IO pressure. */
+	#define THROTTLE_NONE    0
+	#define THROTTLE_REDUCED 1 /* Lower FPS cap and quality. */
+	#define THROTTLE_MINIMAL 2 /* Even lower.                */
+	#define THROTTLE_PAUSED  3 /* Playback paused.           */
+	#define THROTTLE_NR      4
+
+	/* Pipeline stages. */
+	#define STAGE_DEMUX   0
+	#define STAGE_DECODE  1
+	#define STAGE_CONVERT 2
+	#define STAGE_UPLOAD  3
+	#define STAGE_PRESENT 4
+	#define STAGE_NR      5
+
+	/*
+	 * Pipeline metrics, updated by each thread without locks:
+	 * values are only meant to be read for diagnostic purposes.
+	 */
+	struct pipeline_stats
+	{
+		/* Counters. */
+		unsigned long pkts_read;
+		unsigned long frames_decoded;
+		unsigned long frames_presented;
+		unsigned long frames_dropped;
+		unsigned long frames_skipped;
+		unsigned long frames_evicted;
+		unsigned long stalls;
+		unsigned long recoveries;
+		unsigned long rendition_switches;
+
+		/*
+		 * Dirty region uploads: frames uploaded, partially
+		 * uploaded and area uploaded (sum, in %).
+		 */
+		unsigned long dirty_frames;
+		unsigned long dirty_partial;
+		double dirty_area;
+
+		/*
+		 * Motion-adaptive rate: frames skipped, current rate
+		 * and time spent measuring the motion.
+		 */
+		unsigned long frames_still;
+		double motion_fps;
+		double motion_secs;
+
+		/*
+		 * Picture queue: current maximum depth, size of each
+		 * frame (in bytes) and depth seen by each presentation
+		 * (sum and samples).
+		 */
+		int queue_max;
+		double queue_frame_bytes;
+		double queue_depth_sum;
+		unsigned long queue_depth_samples;
+
+		/* Task pool: workers, tasks run and tasks stolen. */
+		int pool_threads;
+		unsigned long pool_tasks;
+		unsigned long pool_steals;
+
+		/* Timer/poll wakeups of all threads. */
+		unsigned long wakeups;
+
+		/* Current throttle level (THROTTLE_*). */
+		int throttle_level;
+
+		/* CPU usage (in % of one CPU) and budget, if any. */
+		double cpu_usage;
+		double cpu_budget;
+
+		/* Last activity of each thread (in seconds). */
+		double last_demux;
+		double last_decode;
+		double last_present;
+
+		/* Last presented pts (in seconds). */
+		double last_pts;
+
+		/* Time spent on each stage (in seconds). */
+		double stage_secs[STAGE_NR];
+	};
+
+	extern struct pipeline_stats stats;
+	extern const char *const stage_names[STAGE_NR];
+
+	/* Window rectangle. */
+	struct rect
+	{
+		int x1; /* Top left corner X.     */
+		int y1; /* Top left corner Y.     */
+		int x2; /* Bottom right corner X. */
+		int y2; /* Bottom right corner Y. */
 	};
 
-	extern void save_frame_ppm(AVFrame *frame,
-		struct av_decode_params *dp);
 	extern double time_secs(void);
+	extern int cache_path(char *buf, size_t size, const char *name,
+		const char *key);
+	extern void cache_mkdir(const char *path);
+	extern void machine_id(char *buf, size_t size);
+	extern int64_t calculate_area(struct rect *rects, int nrects);
+	extern int is_visible(XWindowAttributes *attr, int screen_width,
+		int screen_height);
 	extern int screen_area_used(Display *disp, int screen_width,
 		int screen_height);
+	extern void stats_dump(FILE *f);
+	extern void stats_begin(void);
+	extern void stats_dump_json(FILE *f, struct av_decode_params *dp,
+		const char *file, int stop, const char *renderer);
+	extern void json_str(FILE *f, const char *str);
+	extern void pacing_begin(double duration);
+	extern int pacing_done(void);
+	extern int pacing_should_pause(void);
+	extern void pacing_record(double pts, double present);
+	extern void pacing_pause_event(int paused, double t);
+	extern int pacing_report(FILE *f, const char *file, double tolerance_ms);
+	extern int checksum_open(const char *file, int verify,
+		const char *source);
+	extern void checksum_frame(AVFrame *frm);
+	extern void checksum_surface(SDL_Renderer *renderer, int64_t ts);
+	extern int checksum_close(void);
+
+	extern int power_on_battery(void);
+	extern int power_start(void (*changed)(int battery, void *data),
+		void *data);
+	extern void power_stop(void);
+	extern int profile_parse(const char *spec, struct perf_profile *p);
+	extern int psi_start(void (*changed)(int level, void *data), void *data);
+	extern void psi_stop(void);
+
+	/* Background scheduling classes. */
+	#define BG_SCHED_NONE 0
+	#define BG_SCHED_IDLE 1 /* SCHED_IDLE, idle I/O.      */
+	#define BG_SCHED_NICE 2 /* Highest nice, idle I/O.    */
+	#define BG_SCHED_NR   3
+
+	extern const char *const bg_sched_names[BG_SCHED_NR];
+	extern int sched_background(int mode);
+	extern int affinity_init(const char *spec);
+	extern int affinity_apply(void);
+	extern void sched_timer_slack(unsigned long ns);
+	extern void budget_init(double percent, double fps);
+	extern int budget_update(struct perf_profile *p, int *pause);
+
+	extern int dirty_init(int width, int height);
+	extern void dirty_finish(void);
+	extern int dirty_frame(AVFrame *frm);
+	extern const uint8_t *dirty_tiles(int *w, int *h);
+	extern void dirty_reset(void);
+	extern SDL_Texture *dirty_upload(SDL_Renderer *renderer, AVFrame *frm,
+		double *area);
+	extern void dirty_release(SDL_Texture *tex);
+
+	/* Task pool priorities, highest first. */
+	#define POOL_PRIO_FRAME      0 /* By frame deadline (pts).     */
+	#define POOL_PRIO_BACKGROUND 1 /* No deadline.                 */
+	#define POOL_PRIO_NR         2
+
+	extern int pool_init(int threads);
+	extern void pool_finish(void);
+	extern int pool_size(void);
+	extern int pool_worker(void);
+	extern void pool_submit(void (*fn)(void *arg, int job), void *arg,
+		int prio);
+	extern void pool_run(void (*fn)(void *arg, int job), void *arg,
+		int njobs, double deadline);
+
+	extern int motion_init(double fps);
+	extern void motion_finish(void);
+	extern double motion_fps(AVFrame *frm, double pts);
+
+	extern int render_select(int width, int height, int win_w, int win_h,
+		int force, char *name, size_t size);
+
+	extern int rendition_init(AVFormatContext *fmt, int best, int dst_w,
+		int dst_h, int stretch);
+	extern int rendition_update(int quality);
+	extern void rendition_failed(int idx);
+
+	/*
+	 * Auto-tuned configuration, unset knobs are -1 (threads)
+	 * or 0 (the others).
+	 */
+	struct tune_config
+	{
+		int threads;     /* Decoding threads, 0 for auto.   */
+		int coop;        /* Single-threaded mode.           */
+		int dirty_rects; /* Dirty region uploads.           */
+		int queue_min;   /* Adaptive picture queue bounds.  */
+		int queue_max;
+		int renditions;  /* Rendition selection.            */
+	};
+
+	/* Knobs set by the user, not tuned. */
+	#define TUNE_THREADS      1
+	#define TUNE_COOP         2
+	#define TUNE_DIRTY_RECTS  4
+	#define TUNE_QUEUE        8
+	#define TUNE_RENDITIONS  16
+
+	extern int tune_config(char **args, int nargs, const char *file,
+		int fixed, int retune, struct tune_config *cfg);
+
+	extern void cost_init(const char *file);
+	extern void cost_save(void);
+	extern void cost_learn(int size, int key, double secs);
+	extern double cost_predict(int size, int key);
+
+	/* Export formats. */
+	#define EXPORT_FMT_PPM 0
+	#define EXPORT_FMT_PAM 1
+	#define EXPORT_FMT_YUV 2
+	#define EXPORT_FMT_NR  3
+
+	extern const char *const export_format_names[EXPORT_FMT_NR];
+	extern int export_init(const char *dir, int fmt, unsigned long first,
+		unsigned long last, int threads);
+	extern int export_frame(AVFrame *frm);
+	extern int export_finish(void);
 
 #endif /* ANIPAPER_H */
@@ -22,6 +22,26 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 
+
+#
+# Benchmark matrix runner.
+#
+# Sweeps a matrix of resolution, fps, codec, decoding threads, fit
+# mode and fps cap over synthetic clips (generated by bench/synth),
+# running Anipaper in headless (--bench) or paced (--bench-paced)
+# mode. CPU times come from Anipaper itself (getrusage), so no GPU,
+# root or external tools are required.
+#
+# Each configuration is run RUNS times and the averaged results are
+# written, one JSON object per line, into OUTPUT. If BASELINE is set,
+# the results are compared against it and any regression greater
+# than TOLERANCE (in %) makes the script exit with a non-zero code.
+#
+# All the parameters below can be overridden via environment, e.g:
+#   $ RESOLUTIONS="1920x1080" THREADS="1 4" ./bench.sh
+#   $ BASELINE=baseline.jsonl TOLERANCE=5 ./bench.sh
+#
+
 # Paths
 CURDIR="$( cd -- "$(dirname "$0")" >/dev/null 2>&1 ; pwd -P )"
 cd "${CURDIR}/"
@@ -29,89 +49,188 @@ cd "${CURDIR}/"
 # Colors
 GREEN="\033[1;32m"
 YELLOW="\033[1;33m"
+RED="\033[1;31m"
 NC="\033[0m"
 
-function check_and_convert()
+# Matrix
+RESOLUTIONS=${RESOLUTIONS:-"1280x720 1920x1080"}
+FPS=${FPS:-"30 60"}
+CODECS=${CODECS:-"mpeg4"}
+THREADS=${THREADS:-"1 0"}
+FITS=${FITS:-"fit"}
+FPS_CAPS=${FPS_CAPS:-"0"}
+PATTERN=${PATTERN:-"shapes"}
+SECONDS_CLIP=${SECONDS_CLIP:-10}
+
+# Run parameters
+MODE=${MODE:-"headless"}       # headless or paced
+STOP=${STOP:-"present"}        # headless only
+SCREEN=${SCREEN:-"1920x1080"}  # screen resolution used by fit modes
+RUNS=${RUNS:-3}
+OUTPUT=${OUTPUT:-"results.jsonl"}
+BASELINE=${BASELINE:-""}
+TOLERANCE=${TOLERANCE:-10}
+
+# Binaries
+ANIPAPER=${ANIPAPER:-"$(command -v anipaper || echo ../anipaper)"}
+SYNTH=${SYNTH:-"./synth"}
+CLIPS="clips"
+
+# Extracts a numeric value from a JSON line: json_get <key> <line>
+function json_get()
 {
-	file="$1"
-	width="$2"
-	height="$3"
-	fps="$4"
-	step="$5"
-
-	if [ -f "lake${height}p_${fps}.mp4" ]; then
-		printf "Skipping lake${height}p_${fps}.mp4\n"
-	else
-		printf "${GREEN}(${step}/5) Converting to ${height}p, ${fps} fps...${NC} "
-		ffmpeg -i "${file}" -r ${fps} -vf scale=$width:$height \
-			"lake${height}p_${fps}.mp4" &> /dev/null
-		printf "done\n"
-	fi	
+	printf "%s\n" "$2" | sed -n "s/.*\"$1\": *\([-0-9.eE+]*\).*/\1/p"
 }
 
-function run()
+# Generates (if not already) the clip: gen_clip <res> <fps> <codec>
+function gen_clip()
 {
-	input_file="lake${1}p_${2}.mp4"
-	text_file="lake${1}p_${2}.txt"
-	step="${3}"
-	
-	printf "${YELLOW}Input file: ${input_file} (${step}/6)\n"
-	printf "NO HW ACCEL:\n" > "${text_file}"
-	printf "  ${GREEN}Run #1/6 hw accel: no${NC}\n"
-	sudo intel_gpu_time anipaper "${input_file}" -o >> "${text_file}"
-	printf "  ${GREEN}Run #2/6 hw accel: no${NC}\n"
-	sudo intel_gpu_time anipaper "${input_file}" -o >> "${text_file}"
-	printf "  ${GREEN}Run #3/6 hw accel: no${NC}\n"
-	sudo intel_gpu_time anipaper "${input_file}" -o >> "${text_file}"
-
-	printf "HW ACCEL:\n" >> "${text_file}"
-	printf "  ${GREEN}Run #4/6 hw accel: yes${NC}\n"
-	sudo intel_gpu_time anipaper "${input_file}" -o -d vaapi >> "${text_file}"
-	printf "  ${GREEN}Run #5/6 hw accel: yes${NC}\n"
-	sudo intel_gpu_time anipaper "${input_file}" -o -d vaapi >> "${text_file}"
-	printf "  ${GREEN}Run #6/6 hw accel: yes${NC}\n"
-	sudo intel_gpu_time anipaper "${input_file}" -o -d vaapi >> "${text_file}"
+	clip="${CLIPS}/${PATTERN}_${1}_${2}_${3}.mkv"
+	if [ ! -f "${clip}" ]; then
+		printf "${GREEN}Generating ${clip}...${NC}\n" >&2
+		"${SYNTH}" -p "${PATTERN}" -r "$1" -f "$2" -c "$3" \
+			-n $(($2 * SECONDS_CLIP)) -g $(($2 * 2)) "${clip}" >&2 || return 1
+	fi
+	printf "%s" "${clip}"
 }
 
-if [ ! -x "$(command -v ffmpeg)" ]; then
-	printf "FFmpeg not found in PATH!!\n"
-	exit 1
-fi
+# Runs a single configuration RUNS times and prints the averaged
+# result as a JSON line: run_config <name> <clip> <anipaper args...>
+function run_config()
+{
+	name="$1"
+	clip="$2"
+	shift 2
+
+	fps_sum=0; cpu_sum=0; drop_sum=0; rss_max=0
+
+	for run in $(seq 1 "${RUNS}"); do
+		printf "  ${GREEN}${name}: run #${run}/${RUNS}${NC}\n" >&2
+		if [ "${MODE}" = "paced" ]; then
+			out=$("${ANIPAPER}" --bench-paced "$@" "${clip}" 2>/dev/null)
+		else
+			out=$("${ANIPAPER}" --bench --bench-stop "${STOP}" "$@" "${clip}" \
+				2>/dev/null)
+		fi
+		out=$(printf "%s" "${out}" | tr -d '\n')
+		if [ -z "${out}" ]; then
+			printf "  ${RED}${name}: run failed!${NC}\n" >&2
+			return 1
+		fi
 
-if [ ! -x "$(command -v anipaper)" ]; then
-	printf "Anipaper not found in PATH!!\n"
+		fps_sum=$(awk -v a="${fps_sum}" -v b="$(json_get fps "${out}")" \
+			'BEGIN {print a + b}')
+		cpu_sum=$(awk -v a="${cpu_sum}" \
+			-v b="$(json_get cpu_ms_per_frame "${out}")" 'BEGIN {print a + b}')
+		drop_sum=$(awk -v a="${drop_sum}" \
+			-v b="$(json_get frames_dropped "${out}")" 'BEGIN {print a + b}')
+		rss=$(json_get peak_rss_kb "${out}")
+		[ "${rss}" -gt "${rss_max}" ] && rss_max="${rss}"
+	done
+
+	awk -v name="${name}" -v mode="${MODE}" -v runs="${RUNS}" \
+		-v fps="${fps_sum}" -v cpu="${cpu_sum}" -v drop="${drop_sum}" \
+		-v rss="${rss_max}" 'BEGIN {
+		printf "{\"name\": \"%s\", \"mode\": \"%s\", \"runs\": %d, ",
+			name, mode, runs
+		printf "\"fps\": %.3f, \"cpu_ms_per_frame\": %.6f, ",
+			fps / runs, cpu / runs
+		printf "\"frames_dropped\": %.1f, \"peak_rss_kb\": %d}\n",
+			drop / runs, rss
+	}'
+}
+
+# Compares OUTPUT against BASELINE, returns 1 if any regression.
+function compare_baseline()
+{
+	awk -v tol="${TOLERANCE}" -v mode="${MODE}" '
+	function get(line, key,    re) {
+		re = "\"" key "\": *[-0-9.eE+]+"
+		if (!match(line, re))
+			return ""
+		line = substr(line, RSTART, RLENGTH)
+		sub(/.*: */, "", line)
+		return line + 0
+	}
+	function name(line) {
+		match(line, /"name": *"[^"]*"/)
+		line = substr(line, RSTART, RLENGTH)
+		sub(/"name": *"/, "", line); sub(/"$/, "", line)
+		return line
+	}
+	NR == FNR { base[name($0)] = $0; next }
+	{
+		n = name($0)
+		if (!(n in base)) {
+			printf "  %-40s no baseline\n", n
+			next
+		}
+		cpu  = get($0, "cpu_ms_per_frame")
+		bcpu = get(base[n], "cpu_ms_per_frame")
+		fps  = get($0, "fps")
+		bfps = get(base[n], "fps")
+
+		dcpu = bcpu > 0 ? (cpu - bcpu) * 100 / bcpu : 0
+		dfps = bfps > 0 ? (bfps - fps) * 100 / bfps : 0
+
+		status = "ok"
+		if (dcpu > tol || (mode == "headless" && dfps > tol)) {
+			status = "REGRESSION"
+			fail = 1
+		}
+		printf "  %-40s cpu/frame %+7.2f%%, fps %+7.2f%%: %s\n",
+			n, dcpu, -dfps, status
+	}
+	END { exit fail }' "${BASELINE}" "${OUTPUT}"
+}
+
+if [ ! -x "${ANIPAPER}" ]; then
+	printf "Anipaper not found (set ANIPAPER or add it to PATH)!!\n"
 	exit 1
 fi
 
-if [ ! -x "$(command -v intel_gpu_time)" ]; then
-	printf "intel_gpu_time not found!!\n"
+if [ ! -x "${SYNTH}" ]; then
+	printf "synth not found, please build it first with: make bench\n"
 	exit 1
 fi
 
-printf "${YELLOW}[+] Checking if intel_gpu_time works...${NC} "
-sudo intel_gpu_time ls &> /dev/null
-if [ $? -eq 1 ]; then
-	printf "no\n"
-	printf "  > Please check if you have a proper Intel graphics card up and\n"
-	printf "  > running. Aborting\n"
-	exit 1
-else
-	printf "yes\n"
+mkdir -p "${CLIPS}"
+: > "${OUTPUT}"
+
+printf "${YELLOW}[+] Running matrix (${MODE})...${NC}\n"
+for res in ${RESOLUTIONS}; do
+for fps in ${FPS}; do
+for codec in ${CODECS}; do
+	clip=$(gen_clip "${res}" "${fps}" "${codec}") || exit 1
+
+	for threads in ${THREADS}; do
+	for fit in ${FITS}; do
+	for cap in ${FPS_CAPS}; do
+		args="--threads ${threads} -r ${SCREEN}"
+		case "${fit}" in
+			fit)   args="${args} -f" ;;
+			scale) args="${args} -s" ;;
+			keep)  args="${args} -k" ;;
+		esac
+		[ "${cap}" != "0" ] && args="${args} --fps-cap ${cap}"
+
+		name="${res}_${fps}_${codec}_t${threads}_${fit}_cap${cap}"
+		run_config "${name}" "${clip}" ${args} >> "${OUTPUT}" || exit 1
+	done
+	done
+	done
+done
+done
+done
+
+printf "${YELLOW}[+] Results written to ${OUTPUT}${NC}\n"
+
+if [ -n "${BASELINE}" ]; then
+	printf "${YELLOW}[+] Comparing against ${BASELINE} (tolerance: "
+	printf "${TOLERANCE}%%)...${NC}\n"
+	if ! compare_baseline; then
+		printf "${RED}[!] Performance regression detected!${NC}\n"
+		exit 1
+	fi
+	printf "${GREEN}[+] No regressions${NC}\n"
 fi
-	
-
-printf "${YELLOW}[+] Converting videos (this may take a while)...${NC}\n"
-
-check_and_convert "lake1440p_60.mp4" 2560 1440 30 1 # 1440p 30 fps
-check_and_convert "lake1440p_60.mp4" 1920 1080 60 2 # 1080p 60 fps
-check_and_convert "lake1080p_60.mp4" 1920 1080 30 3 # 1080p 30 fps
-check_and_convert "lake1080p_60.mp4" 1280  720 60 4 #  720p 60 fps
-check_and_convert "lake720p_60.mp4"  1280  720 30 5 #  720p 30 fps
-
-printf "${YELLOW}[+] Running Anipaper${NC}\n"
-run 1440 60 1
-run 1440 30 2
-run 1080 60 3
-run 1080 30 4
-run  720 60 5
-run  720 30 6
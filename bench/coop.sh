@@ -0,0 +1,117 @@
+#!/usr/bin/env bash
+
+# MIT License
+#
+# Copyright (c) 2021 Davidson Francis <davidsondfgl@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+#
+# Cooperative mode benchmark.
+#
+# Plays a synthetic clip in real time (--bench-paced), pinned to
+# a single CPU (as a single-core thin client would), with the
+# threaded pipeline and then with the cooperative one
+# (--single-thread), RUNS times each, and prints the averages of
+# the CPU time per frame, dropped frames, wakeups and context
+# switches of each.
+#
+# All the parameters below can be overridden via environment, e.g:
+#   $ RES=2560x1440 FPS=60 CPU=2 ./coop.sh
+#
+
+# Paths
+CURDIR="$( cd -- "$(dirname "$0")" >/dev/null 2>&1 ; pwd -P )"
+cd "${CURDIR}/"
+
+# Colors
+GREEN="\033[1;32m"
+YELLOW="\033[1;33m"
+NC="\033[0m"
+
+# Parameters
+RES=${RES:-"1920x1080"}
+FPS=${FPS:-"30"}
+CODEC=${CODEC:-"mpeg4"}
+PATTERN=${PATTERN:-"shapes"}
+SECONDS_CLIP=${SECONDS_CLIP:-10}
+CPU=${CPU:-"0"}
+RUNS=${RUNS:-3}
+
+# Binaries
+ANIPAPER=${ANIPAPER:-"$(command -v anipaper || echo ../anipaper)"}
+SYNTH=${SYNTH:-"./synth"}
+CLIPS="clips"
+
+# Extracts a numeric value from a JSON line: json_get <key> <line>
+function json_get()
+{
+	printf "%s\n" "$2" | sed -n "s/.*\"$1\": *\([-0-9.eE+]*\).*/\1/p"
+}
+
+if [ ! -x "${ANIPAPER}" ]; then
+	printf "Anipaper not found (set ANIPAPER or add it to PATH)!!\n"
+	exit 1
+fi
+
+if [ ! -x "${SYNTH}" ]; then
+	printf "synth not found, please build it first with: make bench\n"
+	exit 1
+fi
+
+if ! command -v taskset >/dev/null; then
+	printf "taskset not found (util-linux)!!\n"
+	exit 1
+fi
+
+mkdir -p "${CLIPS}"
+clip="${CLIPS}/${PATTERN}_${RES}_${FPS}_${CODEC}.mkv"
+if [ ! -f "${clip}" ]; then
+	printf "${GREEN}Generating ${clip}...${NC}\n"
+	"${SYNTH}" -p "${PATTERN}" -r "${RES}" -f "${FPS}" -c "${CODEC}" \
+		-n $((FPS * SECONDS_CLIP)) -g $((FPS * 2)) "${clip}" || exit 1
+fi
+
+printf "${YELLOW}[+] ${clip}, pinned to CPU ${CPU}, ${RUNS} runs...${NC}\n"
+for mode in threaded single-thread; do
+	args="--threads 1"
+	if [ "${mode}" = "single-thread" ]; then
+		args="${args} --single-thread"
+	fi
+
+	cpu=0; dropped=0; wakeups=0; switches=0
+	for ((run = 0; run < RUNS; run++)); do
+		res=$(taskset -c "${CPU}" "${ANIPAPER}" --bench-paced ${args} \
+			"${clip}" 2>/dev/null | tr -d '\n')
+
+		cpu=$(awk -v a="${cpu}" -v b="$(json_get cpu_ms_per_frame "${res}")" \
+			'BEGIN {print a + b}')
+		dropped=$((dropped + $(json_get frames_dropped "${res}")))
+		wakeups=$(awk -v a="${wakeups}" -v b="$(json_get wakeups_per_s "${res}")" \
+			'BEGIN {print a + b}')
+		switches=$((switches + $(json_get ctx_switches "${res}")))
+	done
+
+	awk -v m="${mode}" -v r="${RUNS}" -v c="${cpu}" -v d="${dropped}" \
+		-v w="${wakeups}" -v s="${switches}" 'BEGIN {
+		printf "  %-13s %8.3f cpu ms/frame, %6.1f dropped, %8.1f wakeups/s, " \
+			"%8.0f ctx switches\n", m, c / r, d / r, w / r, s / r
+	}'
+done
@@ -0,0 +1,333 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Dirty regions benchmark: decodes a clip and, for every frame,
+ * compares the dirty tiles derived from the motion vectors
+ * (dirty.c) against an exact pixel-diff with the past reference,
+ * reporting the cost of each approach and how accurate the
+ * motion vectors are:
+ *
+ * - missed: tiles that changed but were considered clean, i.e:
+ *   stale pixels on the screen, until the next full upload;
+ * - overshoot: tiles considered dirty that did not change,
+ *   i.e: wasted uploads.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "../anipaper.h"
+
+/* Tile size, same as dirty.c. */
+#define TILE 16
+
+/* Results. */
+static unsigned long frames;
+static unsigned long mv_frames;
+static unsigned long miss_frames;
+static unsigned long tiles_total;
+static unsigned long tiles_mv;
+static unsigned long tiles_diff;
+static unsigned long tiles_missed;
+static unsigned long tiles_over;
+static int max_missed_error;
+static double mv_secs;
+static double diff_secs;
+
+/**
+ * @brief Current monotonic time, in seconds.
+ */
+static double now_secs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+/**
+ * @brief Compares the tile (@p tx, @p ty) of the plane @p p
+ * of two frames.
+ *
+ * @param a First frame.
+ * @param b Second frame.
+ * @param p Plane.
+ * @param tx Tile column.
+ * @param ty Tile row.
+ * @param err Output, if not NULL: largest absolute difference.
+ *
+ * @return Returns 1 if different, 0 otherwise.
+ */
+static int tile_differs(AVFrame *a, AVFrame *b, int p, int tx, int ty,
+	int *err)
+{
+	int x1, y1, x2, y2;
+	int x, y;
+	int sub;
+	int diff;
+	const uint8_t *ra;
+	const uint8_t *rb;
+
+	sub = p ? 1 : 0;
+	x1 = (tx * TILE) >> sub;
+	y1 = (ty * TILE) >> sub;
+	x2 = FFMIN((tx + 1) * TILE, a->width) >> sub;
+	y2 = FFMIN((ty + 1) * TILE, a->height) >> sub;
+	diff = 0;
+
+	for (y = y1; y < y2; y++)
+	{
+		ra = a->data[p] + (ptrdiff_t)y * a->linesize[p];
+		rb = b->data[p] + (ptrdiff_t)y * b->linesize[p];
+		if (!err)
+		{
+			if (memcmp(ra + x1, rb + x1, x2 - x1))
+				return (1);
+			continue;
+		}
+		for (x = x1; x < x2; x++)
+			diff = FFMAX(diff, abs(ra[x] - rb[x]));
+	}
+
+	if (err)
+		*err = FFMAX(*err, diff);
+	return (diff > 0);
+}
+
+/**
+ * @brief Pixel-diff: dirty tiles of @p cur relative to
+ * @p ref.
+ *
+ * @param cur Current frame.
+ * @param ref Reference frame.
+ * @param tiles Output, 1 if dirty, 0 if clean.
+ * @param tw Tiles per row.
+ * @param th Tiles per column.
+ */
+static void pixel_diff(AVFrame *cur, AVFrame *ref, uint8_t *tiles,
+	int tw, int th)
+{
+	int tx, ty;
+
+	for (ty = 0; ty < th; ty++)
+	{
+		for (tx = 0; tx < tw; tx++)
+		{
+			tiles[ty * tw + tx] =
+				tile_differs(cur, ref, 0, tx, ty, NULL) ||
+				tile_differs(cur, ref, 1, tx, ty, NULL) ||
+				tile_differs(cur, ref, 2, tx, ty, NULL);
+		}
+	}
+}
+
+/**
+ * @brief Compares both approaches for the frame @p cur.
+ *
+ * @param cur Current frame.
+ * @param ref Past reference (empty if none).
+ * @param diff Pixel-diff tiles buffer.
+ */
+static void process_frame(AVFrame *cur, AVFrame *ref, uint8_t *diff)
+{
+	const uint8_t *mv;
+	double start;
+	int missed;
+	int tw, th;
+	int i;
+
+	frames++;
+
+	start = now_secs();
+	dirty_frame(cur);
+	mv = dirty_tiles(&tw, &th);
+	mv_secs += now_secs() - start;
+
+	if (!ref->data[0])
+		return;
+
+	start = now_secs();
+	pixel_diff(cur, ref, diff, tw, th);
+	diff_secs += now_secs() - start;
+
+	/* Entirely dirty frame: nothing to compare. */
+	if (!mv)
+		return;
+
+	mv_frames++;
+	missed = 0;
+	for (i = 0; i < tw * th; i++)
+	{
+		tiles_total++;
+		tiles_mv   += mv[i];
+		tiles_diff += diff[i];
+
+		if (diff[i] && !mv[i])
+		{
+			tiles_missed++;
+			missed = 1;
+			tile_differs(cur, ref, 0, i % tw, i / tw, &max_missed_error);
+		}
+		else if (mv[i] && !diff[i])
+			tiles_over++;
+	}
+	miss_frames += missed;
+}
+
+/* Main =). */
+int main(int argc, char **argv)
+{
+	AVFormatContext *fmt_ctx;
+	AVCodecContext *ctx;
+	const AVCodec *codec;
+	AVPacket *pkt;
+	AVFrame *cur;
+	AVFrame *ref;
+	uint8_t *diff;
+	int idx;
+	int ret;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "Usage: %s <video-file>\n", argv[0]);
+		return (EXIT_FAILURE);
+	}
+
+	fmt_ctx = NULL;
+	if (avformat_open_input(&fmt_ctx, argv[1], NULL, NULL) != 0 ||
+		avformat_find_stream_info(fmt_ctx, NULL) < 0)
+	{
+		LOG("Unable to open %s!\n", argv[1]);
+		return (EXIT_FAILURE);
+	}
+
+	codec = NULL;
+	idx = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+	if (idx < 0)
+		LOG_GOTO("Unable to find a video stream!\n", out0);
+
+	ctx = avcodec_alloc_context3(codec);
+	if (!ctx || avcodec_parameters_to_context(ctx,
+		fmt_ctx->streams[idx]->codecpar) < 0)
+	{
+		LOG_GOTO("Unable to create a codec context!\n", out1);
+	}
+
+	ctx->flags2 |= AV_CODEC_FLAG2_EXPORT_MVS;
+	if (avcodec_open2(ctx, codec, NULL) < 0)
+		LOG_GOTO("Unable to open the decoder!\n", out1);
+
+	if (ctx->pix_fmt != AV_PIX_FMT_YUV420P)
+		LOG_GOTO("Only yuv420p clips are supported!\n", out1);
+
+	if (dirty_init(ctx->width, ctx->height) < 0)
+		goto out1;
+
+	pkt  = av_packet_alloc();
+	cur  = av_frame_alloc();
+	ref  = av_frame_alloc();
+	diff = calloc((size_t)((ctx->width + TILE - 1) / TILE) *
+		((ctx->height + TILE - 1) / TILE), 1);
+	if (!pkt || !cur || !ref || !diff)
+		LOG_GOTO("Out of memory!\n", out2);
+
+	/* Decode everything, flushing the decoder at the end. */
+	while (1)
+	{
+		ret = av_read_frame(fmt_ctx, pkt);
+		if (ret >= 0 && pkt->stream_index != idx)
+		{
+			av_packet_unref(pkt);
+			continue;
+		}
+
+		if (avcodec_send_packet(ctx, ret >= 0 ? pkt : NULL) < 0 && ret >= 0)
+		{
+			av_packet_unref(pkt);
+			continue;
+		}
+		av_packet_unref(pkt);
+
+		while (avcodec_receive_frame(ctx, cur) >= 0)
+		{
+			process_frame(cur, ref, diff);
+
+			/* Same past reference as dirty.c: the last non-B frame. */
+			if (cur->pict_type == AV_PICTURE_TYPE_B)
+			{
+				av_frame_unref(cur);
+				continue;
+			}
+			av_frame_unref(ref);
+			av_frame_move_ref(ref, cur);
+		}
+
+		if (ret < 0)
+			break;
+	}
+
+	printf("{\"file\": ");
+	json_str(stdout, argv[1]);
+	printf(", \"codec\": \"%s\", \"width\": %d, \"height\": %d, "
+		"\"frames\": %lu, \"mv_frames\": %lu, "
+		"\"mv_ms_per_frame\": %.4f, \"diff_ms_per_frame\": %.4f, "
+		"\"mv_dirty_pct\": %.2f, \"diff_dirty_pct\": %.2f, "
+		"\"missed_pct\": %.3f, \"overshoot_pct\": %.2f, "
+		"\"frames_with_misses\": %lu, \"max_missed_error\": %d}\n",
+		codec->name, ctx->width, ctx->height, frames, mv_frames,
+		frames ? mv_secs * 1000.0 / frames : 0.0,
+		frames > 1 ? diff_secs * 1000.0 / (frames - 1) : 0.0,
+		tiles_total ? tiles_mv * 100.0 / tiles_total : 0.0,
+		tiles_total ? tiles_diff * 100.0 / tiles_total : 0.0,
+		tiles_total ? tiles_missed * 100.0 / tiles_total : 0.0,
+		tiles_total ? tiles_over * 100.0 / tiles_total : 0.0,
+		miss_frames, max_missed_error);
+
+	ret = 0;
+	goto out3;
+out2:
+	ret = -1;
+out3:
+	free(diff);
+	av_frame_free(&ref);
+	av_frame_free(&cur);
+	av_packet_free(&pkt);
+	dirty_finish();
+	avcodec_free_context(&ctx);
+	avformat_close_input(&fmt_ctx);
+	return (ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+out1:
+	avcodec_free_context(&ctx);
+out0:
+	avformat_close_input(&fmt_ctx);
+	return (EXIT_FAILURE);
+}
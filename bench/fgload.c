@@ -0,0 +1,196 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Foreground load: a CPU and cache bound workload (random
+ * read-modify-write over a per-thread working set), on every
+ * CPU by default, that reports its own throughput.
+ *
+ * Running it alone and then next to Anipaper shows how much
+ * the wallpaper interferes with a foreground application (see
+ * bench/interference.sh).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+/* Ops between clock checks. */
+#define CHECK_OPS 65536
+
+/* Per-thread state. */
+struct worker
+{
+	pthread_t thread;
+	uint64_t *buf;
+	size_t nwords;
+	uint64_t seed;
+	uint64_t ops;
+};
+
+/* Parameters. */
+static int nthreads;
+static double duration = 10.0;
+static size_t working_set_kb = 1024;
+
+/**
+ * @brief Current monotonic time, in seconds.
+ */
+static double now_secs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+/**
+ * @brief Worker: random read-modify-write over its buffer
+ * until the duration is over.
+ *
+ * @param arg Worker structure.
+ *
+ * @return Always returns NULL.
+ */
+static void *worker_thread(void *arg)
+{
+	struct worker *w;
+	double end;
+	uint64_t x;
+	size_t i;
+	int j;
+
+	w = (struct worker *)arg;
+	x = w->seed;
+	end = now_secs() + duration;
+
+	do
+	{
+		for (j = 0; j < CHECK_OPS; j++)
+		{
+			/* xorshift64. */
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			i = x % w->nwords;
+			w->buf[i] = w->buf[i] * 31 + x;
+		}
+		w->ops += CHECK_OPS;
+	} while (now_secs() < end);
+
+	return (NULL);
+}
+
+/**
+ * @brief Show program usage.
+ * @param prgname Program name.
+ */
+static void usage(const char *prgname)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prgname);
+	fprintf(stderr,
+		"  -t <N>   Threads (default: number of CPUs)\n"
+		"  -d <s>   Duration, in seconds (default: 10)\n"
+		"  -m <KiB> Working set per thread (default: 1024)\n"
+		"  -h       This help\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *workers;
+	uint64_t total;
+	double start;
+	double elapsed;
+	int c;
+	int i;
+
+	nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((c = getopt(argc, argv, "t:d:m:h")) != -1)
+	{
+		switch (c)
+		{
+			case 't':
+				nthreads = atoi(optarg);
+				break;
+			case 'd':
+				duration = atof(optarg);
+				break;
+			case 'm':
+				working_set_kb = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	if (nthreads <= 0 || duration <= 0 || !working_set_kb)
+		usage(argv[0]);
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		return (EXIT_FAILURE);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		workers[i].nwords = working_set_kb * 1024 / sizeof(uint64_t);
+		workers[i].buf = calloc(workers[i].nwords, sizeof(uint64_t));
+		workers[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+		if (!workers[i].buf)
+			return (EXIT_FAILURE);
+	}
+
+	start = now_secs();
+	for (i = 0; i < nthreads; i++)
+	{
+		if (pthread_create(&workers[i].thread, NULL, worker_thread,
+			&workers[i]))
+		{
+			fprintf(stderr, "Unable to create thread #%d!\n", i);
+			return (EXIT_FAILURE);
+		}
+	}
+
+	total = 0;
+	for (i = 0; i < nthreads; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].ops;
+		free(workers[i].buf);
+	}
+	elapsed = now_secs() - start;
+	free(workers);
+
+	printf("{\"threads\": %d, \"working_set_kb\": %zu, \"wall_s\": %.3f, "
+		"\"mops\": %.3f}\n", nthreads, working_set_kb, elapsed,
+		(double)total / elapsed / 1000000.0);
+
+	return (EXIT_SUCCESS);
+}
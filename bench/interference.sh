@@ -0,0 +1,118 @@
+#!/usr/bin/env bash
+
+# MIT License
+#
+# Copyright (c) 2021 Davidson Francis <davidsondfgl@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+#
+# Foreground interference benchmark.
+#
+# Runs a foreground load (bench/fgload, on every CPU) alone, and
+# then next to Anipaper playing a synthetic clip in real time
+# (--bench-paced), once for each background scheduling class
+# (--bg-sched). For each run, prints the foreground throughput
+# loss against the run alone, and the frames Anipaper dropped.
+#
+# All the parameters below can be overridden via environment, e.g:
+#   $ RES=2560x1440 FPS=60 CLASSES="none idle" ./interference.sh
+#
+
+# Paths
+CURDIR="$( cd -- "$(dirname "$0")" >/dev/null 2>&1 ; pwd -P )"
+cd "${CURDIR}/"
+
+# Colors
+GREEN="\033[1;32m"
+YELLOW="\033[1;33m"
+NC="\033[0m"
+
+# Parameters
+RES=${RES:-"1920x1080"}
+FPS=${FPS:-"60"}
+CODEC=${CODEC:-"mpeg4"}
+PATTERN=${PATTERN:-"shapes"}
+SECONDS_CLIP=${SECONDS_CLIP:-15}
+CLASSES=${CLASSES:-"none idle nice"}
+THREADS=${THREADS:-"0"}
+FG_ARGS=${FG_ARGS:-""}
+
+# Binaries
+ANIPAPER=${ANIPAPER:-"$(command -v anipaper || echo ../anipaper)"}
+SYNTH=${SYNTH:-"./synth"}
+FGLOAD=${FGLOAD:-"./fgload"}
+CLIPS="clips"
+
+# Extracts a numeric value from a JSON line: json_get <key> <line>
+function json_get()
+{
+	printf "%s\n" "$2" | sed -n "s/.*\"$1\": *\([-0-9.eE+]*\).*/\1/p"
+}
+
+if [ ! -x "${ANIPAPER}" ]; then
+	printf "Anipaper not found (set ANIPAPER or add it to PATH)!!\n"
+	exit 1
+fi
+
+if [ ! -x "${SYNTH}" ] || [ ! -x "${FGLOAD}" ]; then
+	printf "synth/fgload not found, please build them first with: make bench\n"
+	exit 1
+fi
+
+mkdir -p "${CLIPS}"
+clip="${CLIPS}/${PATTERN}_${RES}_${FPS}_${CODEC}.mkv"
+if [ ! -f "${clip}" ]; then
+	printf "${GREEN}Generating ${clip}...${NC}\n"
+	"${SYNTH}" -p "${PATTERN}" -r "${RES}" -f "${FPS}" -c "${CODEC}" \
+		-n $((FPS * SECONDS_CLIP)) -g $((FPS * 2)) "${clip}" || exit 1
+fi
+
+# The foreground load runs while the clip plays, with a margin
+# for the Anipaper startup.
+fg_secs=$((SECONDS_CLIP - 2))
+
+printf "${YELLOW}[+] Foreground alone...${NC}\n"
+alone=$("${FGLOAD}" -d "${fg_secs}" ${FG_ARGS})
+base=$(json_get mops "${alone}")
+printf "  %-6s fg: %10.3f Mops\n" "alone" "${base}"
+
+printf "${YELLOW}[+] Foreground next to Anipaper...${NC}\n"
+for class in ${CLASSES}; do
+	out=$(mktemp)
+	"${ANIPAPER}" --bench-paced --threads "${THREADS}" --bg-sched "${class}" \
+		"${clip}" > "${out}" 2>/dev/null &
+	pid=$!
+	sleep 1
+
+	fg=$("${FGLOAD}" -d "${fg_secs}" ${FG_ARGS})
+	wait "${pid}"
+
+	mops=$(json_get mops "${fg}")
+	res=$(tr -d '\n' < "${out}")
+	rm -f "${out}"
+
+	awk -v c="${class}" -v m="${mops}" -v b="${base}" \
+		-v d="$(json_get frames_dropped "${res}")" \
+		-v cpu="$(json_get cpu_ms_per_frame "${res}")" 'BEGIN {
+		printf "  %-6s fg: %10.3f Mops (%+6.2f%%), anipaper: %s dropped, " \
+			"%s cpu ms/frame\n", c, m, (m - b) * 100 / b, d, cpu
+	}'
+done
@@ -0,0 +1,629 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Occlusion engine checker and benchmark: generates random
+ * window layouts (nested, overlapping, off-screen, with negative
+ * coordinates and very large counts), clips them with
+ * is_visible() and compares calculate_area() against two
+ * oracles:
+ *
+ * - a brute-force pixel mask, for small screens;
+ * - a compressed grid (exact, 64-bit), for huge coordinates,
+ *   such as large multi-monitor roots.
+ *
+ * Both the sweep line and the pixel mask are then timed for
+ * increasing window counts.
+ *
+ * When built with -DFUZZ, a libFuzzer entry point is provided
+ * instead of main().
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "../anipaper.h"
+
+/* Layout kinds. */
+#define LAYOUT_RANDOM    0
+#define LAYOUT_NESTED    1
+#define LAYOUT_OVERLAP   2
+#define LAYOUT_OFFSCREEN 3
+#define LAYOUT_NEGATIVE  4
+#define LAYOUT_HUGE      5
+#define LAYOUT_NR        6
+static const char *const layout_names[] = {
+	"random", "nested", "overlap", "offscreen", "negative", "huge"
+};
+
+/* Max windows checked against the (cubic) compressed grid. */
+#define GRID_MAX_RECTS 256
+
+/* Window counts used in the timings. */
+static const int bench_counts[] = {10, 100, 1000, 10000};
+
+/* PRNG state. */
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+/**
+ * @brief xorshift64* PRNG, deterministic for a given seed.
+ *
+ * @return Returns the next pseudo-random number.
+ */
+static uint64_t rnd(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (rng_state * 0x2545F4914F6CDD1DULL);
+}
+
+/**
+ * @brief Returns a pseudo-random number in [lo, hi].
+ *
+ * @param lo Lower bound.
+ * @param hi Upper bound.
+ *
+ * @return Returns the number.
+ */
+static int rnd_range(int lo, int hi)
+{
+	return (int)(lo + (int64_t)(rnd() % ((uint64_t)((int64_t)hi - lo) + 1)));
+}
+
+/**
+ * @brief Gets the current monotonic time, in seconds.
+ *
+ * @return Returns the time.
+ */
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/**
+ * @brief Fills @p attr with @p n windows of a given layout
+ * kind, for a screen of @p sw x @p sh.
+ *
+ * @param attr Window list.
+ * @param n Number of windows.
+ * @param kind Layout kind (LAYOUT_*).
+ * @param sw Screen width.
+ * @param sh Screen height.
+ */
+static void gen_layout(XWindowAttributes *attr, int n, int kind,
+	int sw, int sh)
+{
+	int i;
+	int x, y, w, h;
+
+	memset(attr, 0, sizeof(*attr) * n);
+
+	for (i = 0; i < n; i++)
+	{
+		switch (kind)
+		{
+		/* Windows inside windows. */
+		case LAYOUT_NESTED:
+			if (i == 0 || rnd() % 4 == 0)
+			{
+				x = rnd_range(0, sw - 1);
+				y = rnd_range(0, sh - 1);
+				w = rnd_range(1, sw - x);
+				h = rnd_range(1, sh - y);
+			}
+			else
+			{
+				x = attr[i - 1].x;
+				y = attr[i - 1].y;
+				w = attr[i - 1].width;
+				h = attr[i - 1].height;
+				if (w > 2) { x++; w -= rnd_range(2, w); w = w < 1 ? 1 : w; }
+				if (h > 2) { y++; h -= rnd_range(2, h); h = h < 1 ? 1 : h; }
+			}
+			break;
+
+		/* Cascaded windows, sharing most of their area. */
+		case LAYOUT_OVERLAP:
+			w = sw / 2 + rnd_range(0, sw / 4);
+			h = sh / 2 + rnd_range(0, sh / 4);
+			x = (i * 3) % (sw - w + 1);
+			y = (i * 2) % (sh - h + 1);
+			break;
+
+		/* Partially or fully outside the screen. */
+		case LAYOUT_OFFSCREEN:
+			w = rnd_range(1, sw);
+			h = rnd_range(1, sh);
+			x = rnd_range(-w, 2 * sw);
+			y = rnd_range(-h, 2 * sh);
+			break;
+
+		/* Negative coordinates, sometimes larger than the screen. */
+		case LAYOUT_NEGATIVE:
+			x = rnd_range(-2 * sw, sw / 2);
+			y = rnd_range(-2 * sh, sh / 2);
+			w = rnd_range(1, 3 * sw);
+			h = rnd_range(1, 3 * sh);
+			break;
+
+		/* X11 limits: 16-bit coordinates and sizes. */
+		case LAYOUT_HUGE:
+			x = rnd_range(-32768, 32767);
+			y = rnd_range(-32768, 32767);
+			w = rnd_range(1, 65535);
+			h = rnd_range(1, 65535);
+			break;
+
+		default:
+			x = rnd_range(0, sw - 1);
+			y = rnd_range(0, sh - 1);
+			w = rnd_range(1, sw / 2 + 1);
+			h = rnd_range(1, sh / 2 + 1);
+			break;
+		}
+
+		attr[i].x = x;
+		attr[i].y = y;
+		attr[i].width = w;
+		attr[i].height = h;
+		attr[i].map_state = (rnd() % 16) ? IsViewable : IsUnmapped;
+	}
+}
+
+/**
+ * @brief Clips the windows exactly like screen_area_used()
+ * does, and builds the rectangle list.
+ *
+ * @param attr Window list (modified).
+ * @param n Number of windows.
+ * @param sw Screen width.
+ * @param sh Screen height.
+ * @param rects Output rectangle list.
+ *
+ * @return Returns the amount of visible rectangles.
+ */
+static int clip_layout(XWindowAttributes *attr, int n, int sw, int sh,
+	struct rect *rects)
+{
+	int i, nrects;
+
+	for (i = 0, nrects = 0; i < n; i++)
+	{
+		if (!is_visible(&attr[i], sw, sh))
+			continue;
+
+		rects[nrects].x1 = attr[i].x;
+		rects[nrects].y1 = attr[i].y;
+		rects[nrects].x2 = attr[i].width  + attr[i].x;
+		rects[nrects].y2 = attr[i].height + attr[i].y;
+		nrects++;
+	}
+	return (nrects);
+}
+
+/**
+ * @brief Brute-force oracle: paints each viewable window,
+ * clipped to the screen, into a pixel mask and counts the
+ * pixels set.
+ *
+ * @param attr Original (unclipped) window list.
+ * @param n Number of windows.
+ * @param sw Screen width.
+ * @param sh Screen height.
+ * @param mask Pixel mask, at least @p sw * @p sh bytes.
+ *
+ * @return Returns the area covered.
+ */
+static int64_t mask_area(const XWindowAttributes *attr, int n, int sw,
+	int sh, unsigned char *mask)
+{
+	int i, y;
+	int64_t x1, y1, x2, y2;
+	int64_t area;
+
+	memset(mask, 0, (size_t)sw * sh);
+
+	for (i = 0; i < n; i++)
+	{
+		if (attr[i].map_state != IsViewable)
+			continue;
+
+		x1 = attr[i].x;
+		y1 = attr[i].y;
+		x2 = x1 + attr[i].width;
+		y2 = y1 + attr[i].height;
+
+		x1 = x1 < 0 ? 0 : x1;
+		y1 = y1 < 0 ? 0 : y1;
+		x2 = x2 > sw ? sw : x2;
+		y2 = y2 > sh ? sh : y2;
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+
+		for (y = (int)y1; y < y2; y++)
+			memset(mask + (size_t)y * sw + x1, 1, (size_t)(x2 - x1));
+	}
+
+	area = 0;
+	for (i = 0; i < sw * sh; i++)
+		area += mask[i];
+
+	return (area);
+}
+
+/**
+ * @brief Comparison routine for the grid coordinates.
+ */
+static int cmp_i64(const void *a, const void *b)
+{
+	int64_t v1 = *(const int64_t *)a;
+	int64_t v2 = *(const int64_t *)b;
+	return ((v1 > v2) - (v1 < v2));
+}
+
+/**
+ * @brief Exact oracle for huge coordinates: compresses the
+ * edges of the (already clipped) rectangles into a grid and
+ * sums the area of every covered cell.
+ *
+ * @param rects Rectangle list.
+ * @param nrects Number of rectangles, up to GRID_MAX_RECTS.
+ *
+ * @return Returns the area covered, or -1 if error.
+ */
+static int64_t grid_area(const struct rect *rects, int nrects)
+{
+	int i, cx, cy;
+	int64_t xs[2 * GRID_MAX_RECTS];
+	int64_t ys[2 * GRID_MAX_RECTS];
+	int64_t area;
+
+	if (nrects > GRID_MAX_RECTS)
+		return (-1);
+
+	for (i = 0; i < nrects; i++)
+	{
+		xs[2 * i] = rects[i].x1; xs[2 * i + 1] = rects[i].x2;
+		ys[2 * i] = rects[i].y1; ys[2 * i + 1] = rects[i].y2;
+	}
+	qsort(xs, 2 * nrects, sizeof(*xs), cmp_i64);
+	qsort(ys, 2 * nrects, sizeof(*ys), cmp_i64);
+
+	area = 0;
+	for (cy = 0; cy + 1 < 2 * nrects; cy++)
+	{
+		if (ys[cy] == ys[cy + 1])
+			continue;
+		for (cx = 0; cx + 1 < 2 * nrects; cx++)
+		{
+			if (xs[cx] == xs[cx + 1])
+				continue;
+			for (i = 0; i < nrects; i++)
+			{
+				if (rects[i].x1 <= xs[cx] && xs[cx + 1] <= rects[i].x2 &&
+					rects[i].y1 <= ys[cy] && ys[cy + 1] <= rects[i].y2)
+				{
+					area += (xs[cx + 1] - xs[cx]) * (ys[cy + 1] - ys[cy]);
+					break;
+				}
+			}
+		}
+	}
+	return (area);
+}
+
+#ifndef FUZZ
+
+/**
+ * @brief Checks @p iters random layouts of each kind.
+ *
+ * @param iters Layouts per kind.
+ * @param verbose Prints every mismatch if non-zero.
+ *
+ * @return Returns the number of mismatches.
+ */
+static int check_layouts(int iters, int verbose)
+{
+	int it, kind, n, nrects;
+	int sw, sh;
+	int64_t got, expected;
+	int errors, checked;
+	unsigned char *mask;
+	struct rect *rects;
+	XWindowAttributes *attr, *clipped;
+
+	errors = 0;
+	mask    = malloc(256 * 256);
+	rects   = malloc(sizeof(*rects)   * GRID_MAX_RECTS);
+	attr    = malloc(sizeof(*attr)    * GRID_MAX_RECTS);
+	clipped = malloc(sizeof(*clipped) * GRID_MAX_RECTS);
+	if (!mask || !rects || !attr || !clipped)
+		LOG_GOTO("Unable to allocate check buffers!\n", out);
+
+	for (kind = 0; kind < LAYOUT_NR; kind++)
+	{
+		checked = 0;
+		for (it = 0; it < iters; it++)
+		{
+			/*
+			 * Small screens are checked pixel by pixel, huge
+			 * (multi-monitor) roots against the exact grid.
+			 */
+			if (kind == LAYOUT_HUGE)
+			{
+				sw = rnd_range(1, 65535);
+				sh = rnd_range(1, 65535);
+				n  = rnd_range(1, GRID_MAX_RECTS / 4);
+			}
+			else
+			{
+				sw = rnd_range(1, 256);
+				sh = rnd_range(1, 256);
+				n  = rnd_range(1, it % 8 ? 16 : GRID_MAX_RECTS);
+			}
+
+			gen_layout(attr, n, kind, sw, sh);
+			memcpy(clipped, attr, sizeof(*attr) * n);
+			nrects = clip_layout(clipped, n, sw, sh, rects);
+
+			got = calculate_area(rects, nrects);
+			if (kind == LAYOUT_HUGE)
+				expected = grid_area(rects, nrects);
+			else
+				expected = mask_area(attr, n, sw, sh, mask);
+
+			/* Area can never exceed the screen. */
+			if (got != expected || got > (int64_t)sw * sh)
+			{
+				errors++;
+				if (verbose)
+				{
+					fprintf(stderr, "mismatch: layout=%s screen=%dx%d "
+						"windows=%d visible=%d got=%" PRId64
+						" expected=%" PRId64 "\n", layout_names[kind],
+						sw, sh, n, nrects, got, expected);
+				}
+			}
+			checked++;
+		}
+		printf("check   %-10s %6d layouts  %s\n", layout_names[kind],
+			checked, errors ? "FAIL" : "ok");
+	}
+
+out:
+	free(clipped);
+	free(attr);
+	free(rects);
+	free(mask);
+	return (errors);
+}
+
+/**
+ * @brief Times calculate_area() and the pixel mask for
+ * increasing window counts, on a @p sw x @p sh screen.
+ *
+ * @param sw Screen width.
+ * @param sh Screen height.
+ * @param reps Repetitions per count.
+ */
+static void bench_layouts(int sw, int sh, int reps)
+{
+	int i, r, n, nrects;
+	double t0, t_sweep, t_mask;
+	int64_t a_sweep, a_mask;
+	unsigned char *mask;
+	struct rect *rects;
+	XWindowAttributes *attr, *clipped;
+	int nmax;
+
+	nmax    = bench_counts[sizeof(bench_counts)/sizeof(bench_counts[0]) - 1];
+	mask    = malloc((size_t)sw * sh);
+	rects   = malloc(sizeof(*rects)   * nmax);
+	attr    = malloc(sizeof(*attr)    * nmax);
+	clipped = malloc(sizeof(*clipped) * nmax);
+	if (!mask || !rects || !attr || !clipped)
+		LOG_GOTO("Unable to allocate bench buffers!\n", out);
+
+	printf("\n%8s %10s %14s %14s  %s\n", "windows", "visible",
+		"sweep (ms)", "mask (ms)", "area");
+
+	for (i = 0; i < (int)(sizeof(bench_counts)/sizeof(bench_counts[0])); i++)
+	{
+		n = bench_counts[i];
+		gen_layout(attr, n, LAYOUT_RANDOM, sw, sh);
+		memcpy(clipped, attr, sizeof(*attr) * n);
+		nrects = clip_layout(clipped, n, sw, sh, rects);
+
+		a_sweep = 0;
+		t0 = now();
+		for (r = 0; r < reps; r++)
+			a_sweep = calculate_area(rects, nrects);
+		t_sweep = (now() - t0) * 1000.0 / reps;
+
+		a_mask = 0;
+		t0 = now();
+		for (r = 0; r < reps; r++)
+			a_mask = mask_area(attr, n, sw, sh, mask);
+		t_mask = (now() - t0) * 1000.0 / reps;
+
+		printf("%8d %10d %14.3f %14.3f  %" PRId64 "%s\n", n, nrects,
+			t_sweep, t_mask, a_sweep, a_sweep != a_mask ? " MISMATCH" : "");
+	}
+
+out:
+	free(clipped);
+	free(attr);
+	free(rects);
+	free(mask);
+}
+
+/**
+ * @brief Show program usage.
+ *
+ * @param prgname Program name.
+ */
+static void usage(const char *prgname)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prgname);
+	fprintf(stderr,
+		"Options:\n"
+		"  -n <iters>   Random layouts checked per kind (default: 2000)\n"
+		"  -r <reps>    Timing repetitions per window count (default: 5)\n"
+		"  -s <seed>    PRNG seed\n"
+		"  -g <WxH>     Screen size used in the timings (default: 1920x1080)\n"
+		"  -c           Check only, do not time\n"
+		"  -v           Print every mismatch\n"
+		"  -h           This help\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int iters, reps;
+	int sw, sh;
+	int check_only, verbose;
+	int errors;
+
+	iters = 2000;
+	reps  = 5;
+	sw    = 1920;
+	sh    = 1080;
+	check_only = 0;
+	verbose    = 0;
+
+	while ((c = getopt(argc, argv, "n:r:s:g:cvh")) != -1)
+	{
+		switch (c)
+		{
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		case 's':
+			rng_state = strtoull(optarg, NULL, 0) | 1;
+			break;
+		case 'g':
+			if (sscanf(optarg, "%dx%d", &sw, &sh) != 2 || sw <= 0 || sh <= 0)
+				usage(argv[0]);
+			break;
+		case 'c':
+			check_only = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (iters <= 0 || reps <= 0)
+		usage(argv[0]);
+
+	errors = check_layouts(iters, verbose);
+	if (errors)
+		fprintf(stderr, "%d mismatch(es) found!\n", errors);
+
+	if (!check_only)
+		bench_layouts(sw, sh, reps);
+
+	return (errors ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+#else
+
+/*
+ * libFuzzer entry point.
+ *
+ * Input layout: screen width and height (2x uint16), followed
+ * by up to GRID_MAX_RECTS windows of 8 bytes each: x, y (int16),
+ * width, height (uint16), i.e., exactly what an X11 root may
+ * report.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	int i, n, nrects;
+	int sw, sh;
+	int64_t got, expected;
+	struct rect rects[GRID_MAX_RECTS];
+	XWindowAttributes attr;
+
+	if (size < 4)
+		return (0);
+
+	sw = data[0] | data[1] << 8;
+	sh = data[2] | data[3] << 8;
+	if (!sw || !sh)
+		return (0);
+
+	data += 4;
+	size -= 4;
+	n = (int)(size / 8);
+	n = n > GRID_MAX_RECTS ? GRID_MAX_RECTS : n;
+
+	for (i = 0, nrects = 0; i < n; i++, data += 8)
+	{
+		memset(&attr, 0, sizeof(attr));
+		attr.x         = (int16_t)(data[0] | data[1] << 8);
+		attr.y         = (int16_t)(data[2] | data[3] << 8);
+		attr.width     = data[4] | data[5] << 8;
+		attr.height    = data[6] | data[7] << 8;
+		attr.map_state = attr.width && attr.height ? IsViewable : IsUnmapped;
+
+		if (!is_visible(&attr, sw, sh))
+			continue;
+
+		rects[nrects].x1 = attr.x;
+		rects[nrects].y1 = attr.y;
+		rects[nrects].x2 = attr.width  + attr.x;
+		rects[nrects].y2 = attr.height + attr.y;
+		nrects++;
+	}
+
+	got      = calculate_area(rects, nrects);
+	expected = grid_area(rects, nrects);
+
+	if (got != expected || got < 0 || got > (int64_t)sw * sh)
+		abort();
+
+	return (0);
+}
+
+#endif /* FUZZ */
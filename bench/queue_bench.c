@@ -0,0 +1,458 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Queue microbenchmarks: drives the packet and picture queues
+ * (exactly as used by Anipaper) from a producer and a consumer
+ * thread, and reports the throughput, latency distribution and
+ * the amount of wakeups, for different queue sizes and
+ * producer/consumer speeds.
+ *
+ * An alternative queue (a bounded ring buffer, that does not
+ * allocate per item and only signals on empty/full transitions)
+ * is also measured, for comparison.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <SDL.h>
+#include <libavcodec/avcodec.h>
+
+#include "../queue.h"
+
+/* Termination flag, required by the queues. */
+int should_quit = 0;
+
+/* Queue implementations. */
+#define IMPL_PACKET  0
+#define IMPL_PICTURE 1
+#define IMPL_RING    2
+static const char *const impl_names[] = {"packet", "picture", "ring"};
+
+/* Alternative queue: bounded ring buffer. */
+struct ring
+{
+	int64_t *items;
+	int cap;
+	int head;
+	int count;
+	int end;
+	unsigned long wakeups;
+	SDL_mutex *mutex;
+	SDL_cond *not_empty;
+	SDL_cond *not_full;
+};
+
+/* Benchmark scenario. */
+struct scenario
+{
+	int impl;
+	int capacity;
+	int nitems;
+	int producer_us; /* Work per item, producer. */
+	int consumer_us; /* Work per item, consumer. */
+
+	/* Queues. */
+	struct packet_queue pkq;
+	struct picture_queue picq;
+	struct ring ring;
+
+	/* Results. */
+	int64_t *latencies;
+};
+
+/**
+ * @brief Get the current (monotonic) time, in nanoseconds.
+ *
+ * @return Returns the current time.
+ */
+static int64_t time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/**
+ * @brief Simulates @p us microseconds of work, without
+ * sleeping.
+ *
+ * @param us Amount of microseconds.
+ */
+static void busy_work(int us)
+{
+	int64_t end;
+	if (!us)
+		return;
+	end = time_ns() + (int64_t)us * 1000;
+	while (time_ns() < end);
+}
+
+/**
+ * @brief Initializes the ring buffer.
+ *
+ * @param r Ring buffer.
+ * @param cap Capacity.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int ring_init(struct ring *r, int cap)
+{
+	memset(r, 0, sizeof(*r));
+	r->cap = cap;
+	r->items = calloc(cap, sizeof(*r->items));
+	r->mutex = SDL_CreateMutex();
+	r->not_empty = SDL_CreateCond();
+	r->not_full  = SDL_CreateCond();
+	if (!r->items || !r->mutex || !r->not_empty || !r->not_full)
+		return (-1);
+	return (0);
+}
+
+/**
+ * @brief Releases the ring buffer.
+ *
+ * @param r Ring buffer.
+ */
+static void ring_finish(struct ring *r)
+{
+	free(r->items);
+	if (r->mutex)
+		SDL_DestroyMutex(r->mutex);
+	if (r->not_empty)
+		SDL_DestroyCond(r->not_empty);
+	if (r->not_full)
+		SDL_DestroyCond(r->not_full);
+}
+
+/**
+ * @brief Adds @p v to the ring buffer, blocking if full.
+ *
+ * @param r Ring buffer.
+ * @param v Value to be added.
+ */
+static void ring_put(struct ring *r, int64_t v)
+{
+	SDL_LockMutex(r->mutex);
+		while (r->count == r->cap)
+		{
+			SDL_CondWait(r->not_full, r->mutex);
+			r->wakeups++;
+		}
+		r->items[(r->head + r->count) % r->cap] = v;
+		if (++r->count == 1)
+			SDL_CondSignal(r->not_empty);
+	SDL_UnlockMutex(r->mutex);
+}
+
+/**
+ * @brief Signals the end of the items.
+ *
+ * @param r Ring buffer.
+ */
+static void ring_end(struct ring *r)
+{
+	SDL_LockMutex(r->mutex);
+		r->end = 1;
+		SDL_CondSignal(r->not_empty);
+	SDL_UnlockMutex(r->mutex);
+}
+
+/**
+ * @brief Removes a value from the ring buffer, blocking
+ * if empty.
+ *
+ * @param r Ring buffer.
+ * @param v Returned value.
+ *
+ * @return Returns 1 if success, -1 if the ring is empty
+ * and ended.
+ */
+static int ring_get(struct ring *r, int64_t *v)
+{
+	int ret = -1;
+	SDL_LockMutex(r->mutex);
+		while (!r->count && !r->end)
+		{
+			SDL_CondWait(r->not_empty, r->mutex);
+			r->wakeups++;
+		}
+		if (r->count)
+		{
+			*v = r->items[r->head];
+			r->head = (r->head + 1) % r->cap;
+			if (r->count-- == r->cap)
+				SDL_CondSignal(r->not_full);
+			ret = 1;
+		}
+	SDL_UnlockMutex(r->mutex);
+	return (ret);
+}
+
+/**
+ * @brief Producer thread: adds nitems timestamped items
+ * into the queue being measured.
+ *
+ * @param arg Scenario.
+ *
+ * @return Always 0.
+ */
+static int producer_thread(void *arg)
+{
+	int i;
+	AVPacket pkt;
+	struct scenario *sc = arg;
+
+	for (i = 0; i < sc->nitems; i++)
+	{
+		busy_work(sc->producer_us);
+
+		switch (sc->impl)
+		{
+			case IMPL_PACKET:
+				memset(&pkt, 0, sizeof(pkt));
+				pkt.pts = time_ns();
+				packet_queue_put(&sc->pkq, &pkt);
+				break;
+			case IMPL_PICTURE:
+				picture_queue_put(&sc->picq, NULL, (double)time_ns());
+				break;
+			case IMPL_RING:
+				ring_put(&sc->ring, time_ns());
+				break;
+		}
+	}
+
+	switch (sc->impl)
+	{
+		case IMPL_PACKET:  packet_queue_end(&sc->pkq);   break;
+		case IMPL_PICTURE: picture_queue_end(&sc->picq); break;
+		case IMPL_RING:    ring_end(&sc->ring);          break;
+	}
+	return (0);
+}
+
+/**
+ * @brief Removes one item from the queue being measured.
+ *
+ * @param sc Scenario.
+ * @param ts Returned item timestamp.
+ *
+ * @return Returns 1 if success, -1 if there are no more
+ * items.
+ */
+static int consume(struct scenario *sc, int64_t *ts)
+{
+	int ret;
+	double pts;
+	AVPacket pkt;
+	SDL_Texture *tex;
+
+	ret = -1;
+	switch (sc->impl)
+	{
+		case IMPL_PACKET:
+			ret = packet_queue_get(&sc->pkq, &pkt);
+			*ts = pkt.pts;
+			break;
+		case IMPL_PICTURE:
+			ret = picture_queue_get(&sc->picq, &tex, &pts);
+			*ts = (int64_t)pts;
+			break;
+		case IMPL_RING:
+			ret = ring_get(&sc->ring, ts);
+			break;
+	}
+	return (ret);
+}
+
+/**
+ * @brief Comparison routine to sort the latencies.
+ */
+static int cmp_i64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a;
+	int64_t y = *(const int64_t *)b;
+	return ((x > y) - (x < y));
+}
+
+/**
+ * @brief Runs a single scenario and prints its results.
+ *
+ * @param sc Scenario.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int run_scenario(struct scenario *sc)
+{
+	int n;
+	int64_t ts;
+	int64_t start;
+	int64_t elapsed;
+	unsigned long wakeups;
+	SDL_Thread *producer;
+
+	sc->latencies = malloc(sc->nitems * sizeof(*sc->latencies));
+	if (!sc->latencies)
+		return (-1);
+
+	if (init_packet_queue(&sc->pkq, sc->capacity) < 0 ||
+		init_picture_queue(&sc->picq, sc->capacity) < 0 ||
+		ring_init(&sc->ring, sc->capacity) < 0)
+	{
+		fprintf(stderr, "Unable to initialize queues!\n");
+		return (-1);
+	}
+
+	start = time_ns();
+	producer = SDL_CreateThread(producer_thread, "producer", sc);
+	if (!producer)
+		return (-1);
+
+	n = 0;
+	while (consume(sc, &ts) > 0)
+	{
+		if (n < sc->nitems)
+			sc->latencies[n++] = time_ns() - ts;
+		busy_work(sc->consumer_us);
+	}
+
+	SDL_WaitThread(producer, NULL);
+	elapsed = time_ns() - start;
+
+	wakeups = sc->pkq.wakeups + sc->picq.wakeups + sc->ring.wakeups;
+	qsort(sc->latencies, n, sizeof(*sc->latencies), cmp_i64);
+
+	printf("%-8s %5d %6d %6d %12.0f %9.2f %9.2f %9.2f %10.2f %8.3f\n",
+		impl_names[sc->impl], sc->capacity, sc->producer_us,
+		sc->consumer_us,
+		(double)n / ((double)elapsed / 1e9),
+		n ? sc->latencies[n / 2] / 1000.0 : 0.0,
+		n ? sc->latencies[(n * 90) / 100] / 1000.0 : 0.0,
+		n ? sc->latencies[(n * 99) / 100] / 1000.0 : 0.0,
+		n ? sc->latencies[n - 1] / 1000.0 : 0.0,
+		n ? (double)wakeups / n : 0.0);
+	fflush(stdout);
+
+	finish_packet_queue(&sc->pkq);
+	finish_picture_queue(&sc->picq);
+	ring_finish(&sc->ring);
+	free(sc->latencies);
+	return (0);
+}
+
+/**
+ * @brief Show program usage.
+ * @param prgname Program name.
+ */
+static void usage(const char *prgname)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prgname);
+	fprintf(stderr,
+		"  -n <items> Items per scenario (default: 20000)\n"
+		"  -w <us>    Work per item, for the slower side (default: 20)\n"
+		"  -h         This help\n");
+	exit(EXIT_FAILURE);
+}
+
+/* Main =). */
+int main(int argc, char **argv)
+{
+	int c;
+	int i, j, k;
+	int work;
+	int nitems;
+	int speeds[3][2];
+	struct scenario sc;
+
+	static const int capacities[] = {1, 8, 128};
+
+	nitems = 20000;
+	work   = 20;
+
+	while ((c = getopt(argc, argv, "n:w:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'n':
+				nitems = atoi(optarg);
+				break;
+			case 'w':
+				work = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	if (nitems <= 0 || work < 0)
+		usage(argv[0]);
+
+	/*
+	 * Speeds: balanced (no work at all), slow consumer and
+	 * slow producer.
+	 */
+	memset(speeds, 0, sizeof(speeds));
+	speeds[1][1] = work;
+	speeds[2][0] = work;
+
+	if (SDL_Init(0) < 0)
+	{
+		fprintf(stderr, "Unable to initialize SDL!\n");
+		return (EXIT_FAILURE);
+	}
+
+	printf("%-8s %5s %6s %6s %12s %9s %9s %9s %10s %8s\n",
+		"queue", "size", "prod", "cons", "items/s", "p50(us)",
+		"p90(us)", "p99(us)", "max(us)", "wake/it");
+
+	for (i = 0; i < 3; i++)
+	{
+		for (j = 0; j < (int)(sizeof(capacities)/sizeof(capacities[0])); j++)
+		{
+			for (k = 0; k < 3; k++)
+			{
+				memset(&sc, 0, sizeof(sc));
+				sc.impl = i;
+				sc.capacity = capacities[j];
+				sc.nitems = nitems;
+				sc.producer_us = speeds[k][0];
+				sc.consumer_us = speeds[k][1];
+				if (run_scenario(&sc) < 0)
+				{
+					SDL_Quit();
+					return (EXIT_FAILURE);
+				}
+			}
+		}
+	}
+
+	SDL_Quit();
+	return (EXIT_SUCCESS);
+}
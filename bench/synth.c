@@ -0,0 +1,625 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Synthetic video generator: produces deterministic clips (for a
+ * given seed) that can be used by benchmarks and tests, without
+ * depending on external files or the ffmpeg binary.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+
+/* Logs. */
+#define LOG_GOTO(log,lbl) \
+	do { \
+		fprintf(stderr, "INFO: " log); \
+		goto lbl; \
+	} while (0)
+
+#define LOG(...) \
+	fprintf(stderr, "INFO: " __VA_ARGS__)
+
+/* Patterns. */
+#define PATTERN_GRADIENT 0
+#define PATTERN_NOISE    1
+#define PATTERN_SHAPES   2
+#define PATTERN_STATIC   3
+static const char *const pattern_names[] = {
+	"gradient", "noise", "shapes", "static"
+};
+
+/* Amount of moving shapes. */
+#define NSHAPES 8
+
+/* Moving shape. */
+struct shape
+{
+	int x, y;   /* Position.     */
+	int w, h;   /* Size.         */
+	int dx, dy; /* Velocity.     */
+	int round;  /* Disc or rect. */
+	uint8_t y_val, u_val, v_val;
+};
+
+/* Generator parameters. */
+struct synth_params
+{
+	const char *output;
+	const char *codec;
+	enum AVPixelFormat pix_fmt;
+	int width;
+	int height;
+	int fps;
+	int nframes;
+	int gop;
+	int pattern;
+	uint32_t seed;
+
+	/* Pattern state. */
+	uint32_t rng;
+	struct shape shapes[NSHAPES];
+	uint8_t *background;
+};
+
+/**
+ * @brief Xorshift32 pseudo-random number generator: libc's
+ * rand() is not guaranteed to be the same everywhere, so
+ * use ours.
+ *
+ * @param state Generator state.
+ *
+ * @return Returns the next pseudo-random number.
+ */
+static uint32_t next_rand(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return (x);
+}
+
+/**
+ * @brief Initializes the pattern state (shapes positions
+ * and static background) for the given seed.
+ *
+ * @param sp Generator parameters.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int init_pattern(struct synth_params *sp)
+{
+	int i;
+	int x, y;
+	struct shape *s;
+
+	sp->rng = sp->seed ? sp->seed : 0x9e3779b9;
+
+	for (i = 0; i < NSHAPES; i++)
+	{
+		s = &sp->shapes[i];
+		s->w  = sp->width  / 16 + next_rand(&sp->rng) % (sp->width / 8 + 1);
+		s->h  = sp->height / 16 + next_rand(&sp->rng) % (sp->height / 8 + 1);
+		s->x  = next_rand(&sp->rng) % (sp->width  - s->w + 1);
+		s->y  = next_rand(&sp->rng) % (sp->height - s->h + 1);
+		s->dx = (int)(next_rand(&sp->rng) % 17) - 8;
+		s->dy = (int)(next_rand(&sp->rng) % 17) - 8;
+		s->round = next_rand(&sp->rng) & 1;
+		s->y_val = 64 + next_rand(&sp->rng) % 160;
+		s->u_val = next_rand(&sp->rng) & 0xFF;
+		s->v_val = next_rand(&sp->rng) & 0xFF;
+	}
+
+	/* Mostly-static scene: textured background, computed once. */
+	sp->background = malloc((size_t)sp->width * sp->height);
+	if (!sp->background)
+		return (-1);
+
+	for (y = 0; y < sp->height; y++)
+	{
+		for (x = 0; x < sp->width; x++)
+		{
+			sp->background[y * sp->width + x] =
+				(uint8_t)(((x * 160) / sp->width) +
+				(next_rand(&sp->rng) & 0x3F));
+		}
+	}
+	return (0);
+}
+
+/**
+ * @brief Fills a rectangle (or a disc inscribed in it) in
+ * a YUV420p frame.
+ *
+ * @param frm Destination frame.
+ * @param s Shape to be drawn.
+ */
+static void draw_shape(AVFrame *frm, const struct shape *s)
+{
+	int x, y;
+	int cx, cy;
+	int rx, ry;
+	long dx, dy;
+
+	cx = s->x + s->w / 2;
+	cy = s->y + s->h / 2;
+	rx = s->w / 2 ? s->w / 2 : 1;
+	ry = s->h / 2 ? s->h / 2 : 1;
+
+	for (y = s->y; y < s->y + s->h && y < frm->height; y++)
+	{
+		for (x = s->x; x < s->x + s->w && x < frm->width; x++)
+		{
+			if (s->round)
+			{
+				dx = x - cx;
+				dy = y - cy;
+				if (dx * dx * ry * ry + dy * dy * rx * rx >
+					(long)rx * rx * ry * ry)
+				{
+					continue;
+				}
+			}
+
+			frm->data[0][y * frm->linesize[0] + x] = s->y_val;
+			if (!(x & 1) && !(y & 1))
+			{
+				frm->data[1][(y/2) * frm->linesize[1] + x/2] = s->u_val;
+				frm->data[2][(y/2) * frm->linesize[2] + x/2] = s->v_val;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Moves a shape, bouncing on the frame borders.
+ *
+ * @param sp Generator parameters.
+ * @param s Shape to be moved.
+ */
+static void move_shape(struct synth_params *sp, struct shape *s)
+{
+	s->x += s->dx;
+	s->y += s->dy;
+	if (s->x < 0 || s->x + s->w > sp->width)
+	{
+		s->dx = -s->dx;
+		s->x += 2 * s->dx;
+	}
+	if (s->y < 0 || s->y + s->h > sp->height)
+	{
+		s->dy = -s->dy;
+		s->y += 2 * s->dy;
+	}
+	s->x = FFMAX(0, FFMIN(s->x, sp->width  - s->w));
+	s->y = FFMAX(0, FFMIN(s->y, sp->height - s->h));
+}
+
+/**
+ * @brief Generates the frame number @p n of the current
+ * pattern, in YUV420p.
+ *
+ * @param sp Generator parameters.
+ * @param frm Destination frame.
+ * @param n Frame number.
+ */
+static void fill_frame(struct synth_params *sp, AVFrame *frm, int n)
+{
+	int i;
+	int x, y;
+	int cw, ch;
+	struct shape tick;
+	uint8_t *yp, *up, *vp;
+
+	cw = (frm->width  + 1) / 2;
+	ch = (frm->height + 1) / 2;
+
+	for (y = 0; y < frm->height; y++)
+	{
+		yp = frm->data[0] + y * frm->linesize[0];
+		for (x = 0; x < frm->width; x++)
+		{
+			switch (sp->pattern)
+			{
+				case PATTERN_GRADIENT:
+					yp[x] = (uint8_t)(((x + y + n * 4) * 255) /
+						(frm->width + frm->height));
+					break;
+				case PATTERN_NOISE:
+					yp[x] = (uint8_t)next_rand(&sp->rng);
+					break;
+				case PATTERN_SHAPES:
+					yp[x] = (uint8_t)(16 + (y * 48) / frm->height);
+					break;
+				case PATTERN_STATIC:
+					yp[x] = sp->background[y * sp->width + x];
+					break;
+			}
+		}
+	}
+
+	for (y = 0; y < ch; y++)
+	{
+		up = frm->data[1] + y * frm->linesize[1];
+		vp = frm->data[2] + y * frm->linesize[2];
+		for (x = 0; x < cw; x++)
+		{
+			switch (sp->pattern)
+			{
+				case PATTERN_GRADIENT:
+					up[x] = (uint8_t)((x * 255) / cw + n);
+					vp[x] = (uint8_t)((y * 255) / ch - n);
+					break;
+				case PATTERN_NOISE:
+					up[x] = (uint8_t)next_rand(&sp->rng);
+					vp[x] = (uint8_t)next_rand(&sp->rng);
+					break;
+				default:
+					up[x] = 128;
+					vp[x] = 128;
+					break;
+			}
+		}
+	}
+
+	/* Moving shapes. */
+	if (sp->pattern == PATTERN_SHAPES)
+	{
+		for (i = 0; i < NSHAPES; i++)
+		{
+			draw_shape(frm, &sp->shapes[i]);
+			move_shape(sp, &sp->shapes[i]);
+		}
+	}
+
+	/*
+	 * Mostly static: a single small shape moving over the
+	 * background, and a small 'clock' square that changes
+	 * once per second.
+	 */
+	else if (sp->pattern == PATTERN_STATIC)
+	{
+		draw_shape(frm, &sp->shapes[0]);
+		move_shape(sp, &sp->shapes[0]);
+
+		tick.x = 0;
+		tick.y = 0;
+		tick.w = FFMAX(2, sp->width  / 32);
+		tick.h = FFMAX(2, sp->height / 32);
+		tick.round = 0;
+		tick.y_val = (uint8_t)((n / sp->fps) * 37);
+		tick.u_val = 128;
+		tick.v_val = 128;
+		draw_shape(frm, &tick);
+	}
+}
+
+/**
+ * @brief Receives all the available packets from the
+ * encoder and writes them into the output file.
+ *
+ * @param enc Encoder context.
+ * @param oc Output format context.
+ * @param st Output stream.
+ * @param pkt Temporary packet.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int write_packets(AVCodecContext *enc, AVFormatContext *oc,
+	AVStream *st, AVPacket *pkt)
+{
+	int ret;
+
+	while (1)
+	{
+		ret = avcodec_receive_packet(enc, pkt);
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+			return (0);
+		else if (ret < 0)
+			LOG_GOTO("Error while encoding frame!\n", out);
+
+		av_packet_rescale_ts(pkt, enc->time_base, st->time_base);
+		pkt->stream_index = st->index;
+
+		if (av_interleaved_write_frame(oc, pkt) < 0)
+			LOG_GOTO("Error while writing packet!\n", out);
+	}
+out:
+	return (-1);
+}
+
+/**
+ * @brief Generates the clip accordingly to the parameters
+ * @p sp.
+ *
+ * @param sp Generator parameters.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int generate(struct synth_params *sp)
+{
+	int i;
+	int ret;
+	AVStream *st;
+	AVPacket *pkt;
+	AVFrame *yuv;
+	AVFrame *frame;
+	AVFormatContext *oc;
+	AVCodecContext *enc;
+	const AVCodec *codec;
+	struct SwsContext *sws_ctx;
+
+	ret = -1;
+	oc  = NULL;
+	enc = NULL;
+	pkt = NULL;
+	yuv = NULL;
+	frame   = NULL;
+	sws_ctx = NULL;
+
+	codec = avcodec_find_encoder_by_name(sp->codec);
+	if (!codec)
+	{
+		LOG("Encoder \"%s\" not found!\n", sp->codec);
+		goto out0;
+	}
+
+	if (avformat_alloc_output_context2(&oc, NULL, NULL, sp->output) < 0)
+		LOG_GOTO("Unable to guess output format!\n", out0);
+
+	/* Bit-exact output: same seed, same file. */
+	oc->flags |= AVFMT_FLAG_BITEXACT;
+
+	st = avformat_new_stream(oc, NULL);
+	if (!st)
+		LOG_GOTO("Unable to create output stream!\n", out1);
+
+	enc = avcodec_alloc_context3(codec);
+	if (!enc)
+		LOG_GOTO("Unable to create encoder context!\n", out1);
+
+	enc->width     = sp->width;
+	enc->height    = sp->height;
+	enc->pix_fmt   = sp->pix_fmt;
+	enc->time_base = av_make_q(1, sp->fps);
+	enc->framerate = av_make_q(sp->fps, 1);
+	enc->gop_size  = sp->gop;
+	enc->thread_count = 1;
+	enc->flags |= AV_CODEC_FLAG_BITEXACT;
+	if (oc->oformat->flags & AVFMT_GLOBALHEADER)
+		enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+	if (avcodec_open2(enc, codec, NULL) < 0)
+		LOG_GOTO("Unable to open encoder (unsupported pixel format?)\n", out2);
+
+	st->time_base = enc->time_base;
+	if (avcodec_parameters_from_context(st->codecpar, enc) < 0)
+		LOG_GOTO("Unable to fill stream parameters!\n", out2);
+
+	/* Frames. */
+	yuv   = av_frame_alloc();
+	frame = av_frame_alloc();
+	pkt   = av_packet_alloc();
+	if (!yuv || !frame || !pkt)
+		LOG_GOTO("Unable to allocate frames/packet!\n", out3);
+
+	yuv->format = AV_PIX_FMT_YUV420P;
+	yuv->width  = sp->width;
+	yuv->height = sp->height;
+	frame->format = sp->pix_fmt;
+	frame->width  = sp->width;
+	frame->height = sp->height;
+	if (av_frame_get_buffer(yuv, 0) < 0 || av_frame_get_buffer(frame, 0) < 0)
+		LOG_GOTO("Unable to allocate frame buffers!\n", out3);
+
+	/* Patterns are YUV420p, convert if the user wants something else. */
+	if (sp->pix_fmt != AV_PIX_FMT_YUV420P)
+	{
+		sws_ctx = sws_getContext(sp->width, sp->height, AV_PIX_FMT_YUV420P,
+			sp->width, sp->height, sp->pix_fmt, SWS_POINT, NULL, NULL, NULL);
+		if (!sws_ctx)
+			LOG_GOTO("Unable to create a scale context!\n", out3);
+	}
+
+	if (!(oc->oformat->flags & AVFMT_NOFILE))
+		if (avio_open(&oc->pb, sp->output, AVIO_FLAG_WRITE) < 0)
+			LOG_GOTO("Unable to open output file!\n", out3);
+
+	if (avformat_write_header(oc, NULL) < 0)
+		LOG_GOTO("Unable to write output header!\n", out4);
+
+	for (i = 0; i < sp->nframes; i++)
+	{
+		if (av_frame_make_writable(yuv) < 0 ||
+			av_frame_make_writable(frame) < 0)
+		{
+			LOG_GOTO("Unable to make frame writable!\n", out4);
+		}
+
+		fill_frame(sp, yuv, i);
+
+		if (sws_ctx)
+		{
+			sws_scale(sws_ctx, (const uint8_t * const *)yuv->data,
+				yuv->linesize, 0, sp->height, frame->data, frame->linesize);
+			frame->pts = i;
+			if (avcodec_send_frame(enc, frame) < 0)
+				LOG_GOTO("Error while sending frame to encoder!\n", out4);
+		}
+		else
+		{
+			yuv->pts = i;
+			if (avcodec_send_frame(enc, yuv) < 0)
+				LOG_GOTO("Error while sending frame to encoder!\n", out4);
+		}
+
+		if (write_packets(enc, oc, st, pkt) < 0)
+			goto out4;
+	}
+
+	/* Flush encoder. */
+	avcodec_send_frame(enc, NULL);
+	if (write_packets(enc, oc, st, pkt) < 0)
+		goto out4;
+
+	av_write_trailer(oc);
+	ret = 0;
+
+out4:
+	if (!(oc->oformat->flags & AVFMT_NOFILE))
+		avio_closep(&oc->pb);
+out3:
+	sws_freeContext(sws_ctx);
+	av_packet_free(&pkt);
+	av_frame_free(&frame);
+	av_frame_free(&yuv);
+out2:
+	avcodec_free_context(&enc);
+out1:
+	avformat_free_context(oc);
+out0:
+	return (ret);
+}
+
+/**
+ * @brief Show program usage.
+ * @param prgname Program name.
+ */
+static void usage(const char *prgname)
+{
+	fprintf(stderr, "Usage: %s [options] <output-file>\n", prgname);
+	fprintf(stderr,
+		"  -p <pattern> One of: gradient, noise, shapes, static\n"
+		"     (default: shapes)\n"
+		"  -r <WxH>     Resolution (default: 1280x720)\n"
+		"  -f <fps>     Frame rate (default: 30)\n"
+		"  -n <frames>  Amount of frames (default: 300)\n"
+		"  -c <codec>   Encoder name (default: mpeg4)\n"
+		"  -g <gop>     GOP length (default: 60)\n"
+		"  -x <pixfmt>  Pixel format (default: yuv420p)\n"
+		"  -s <seed>    Seed (default: 1)\n"
+		"  -h           This help\n\n"
+		"The container is guessed from the output file extension.\n");
+	exit(EXIT_FAILURE);
+}
+
+/* Main =). */
+int main(int argc, char **argv)
+{
+	int i;
+	int c;
+	struct synth_params sp = {0};
+
+	sp.codec   = "mpeg4";
+	sp.pix_fmt = AV_PIX_FMT_YUV420P;
+	sp.width   = 1280;
+	sp.height  = 720;
+	sp.fps     = 30;
+	sp.nframes = 300;
+	sp.gop     = 60;
+	sp.pattern = PATTERN_SHAPES;
+	sp.seed    = 1;
+
+	while ((c = getopt(argc, argv, "p:r:f:n:c:g:x:s:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'p':
+				for (i = 0; i < (int)(sizeof(pattern_names) /
+					sizeof(pattern_names[0])); i++)
+				{
+					if (!strcmp(optarg, pattern_names[i]))
+						break;
+				}
+				if (i == (int)(sizeof(pattern_names)/sizeof(pattern_names[0])))
+					usage(argv[0]);
+				sp.pattern = i;
+				break;
+			case 'r':
+				if (sscanf(optarg, "%dx%d", &sp.width, &sp.height) != 2)
+					usage(argv[0]);
+				break;
+			case 'f':
+				sp.fps = atoi(optarg);
+				break;
+			case 'n':
+				sp.nframes = atoi(optarg);
+				break;
+			case 'c':
+				sp.codec = optarg;
+				break;
+			case 'g':
+				sp.gop = atoi(optarg);
+				break;
+			case 'x':
+				sp.pix_fmt = av_get_pix_fmt(optarg);
+				if (sp.pix_fmt == AV_PIX_FMT_NONE)
+					usage(argv[0]);
+				break;
+			case 's':
+				sp.seed = (uint32_t)strtoul(optarg, NULL, 10);
+				break;
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	if (optind >= argc)
+		usage(argv[0]);
+
+	/* Even dimensions keep the chroma planes simple. */
+	if (sp.width < 16 || sp.height < 16 || (sp.width & 1) ||
+		(sp.height & 1) || sp.fps <= 0 || sp.nframes <= 0 || sp.gop <= 0)
+	{
+		fprintf(stderr, "Invalid parameters!\n");
+		usage(argv[0]);
+	}
+
+	sp.output = argv[optind];
+
+	if (init_pattern(&sp) < 0)
+	{
+		LOG("Unable to initialize pattern!\n");
+		return (EXIT_FAILURE);
+	}
+
+	if (generate(&sp) < 0)
+	{
+		free(sp.background);
+		return (EXIT_FAILURE);
+	}
+
+	free(sp.background);
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,169 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <time.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "anipaper.h"
+
+/*
+ * CPU budget governor.
+ *
+ * The process CPU time is sampled periodically, and the usage
+ * over a sliding window is fed into a PI controller (velocity
+ * form), whose output, the 'effort' (between 0 and 1), sets the
+ * FPS cap and the quality ladder level. If even the minimum
+ * effort does not fit the budget, the playback is paused until
+ * the usage drops again, so the budget holds on average.
+ */
+
+/* Sampling period (ms) and window (samples). */
+#define BUDGET_PERIOD_MS 500
+#define BUDGET_WINDOW    4
+
+/* Controller gains, per period, for the relative error. */
+#define BUDGET_KP 0.30
+#define BUDGET_KI 0.10
+
+/* Lowest FPS cap. */
+#define BUDGET_MIN_FPS 5.0
+
+/* CPU time samples. */
+struct budget_sample
+{
+	double wall; /* Wall time (in seconds). */
+	double cpu;  /* CPU time (in seconds).  */
+};
+
+static struct budget_sample samples[BUDGET_WINDOW + 1];
+static int nsamples;
+static double budget;
+static double full_fps;
+static double effort;
+static double prev_error;
+static int paused;
+
+/**
+ * @brief Process CPU time (all threads), in seconds.
+ */
+static double cpu_secs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+/**
+ * @brief Initializes the governor.
+ *
+ * @param percent CPU budget, in % of one CPU.
+ * @param fps Stream frame rate, i.e: the FPS at full effort.
+ */
+void budget_init(double percent, double fps)
+{
+	budget   = percent;
+	full_fps = fps;
+	effort   = 1.0;
+	prev_error = 0.0;
+	paused   = 0;
+
+	samples[0].wall = time_secs();
+	samples[0].cpu  = cpu_secs();
+	nsamples = 1;
+
+	stats.cpu_budget = percent;
+}
+
+/**
+ * @brief Samples the CPU usage and, once per period, updates
+ * the controller. Should be called often (e.g: at each pause
+ * check), the rate is handled internally.
+ *
+ * @param p Output limits: FPS cap and quality ladder level.
+ * @param pause Output, set to 1 if the playback should be
+ * paused to hold the budget, 0 otherwise.
+ *
+ * @return Returns 1 if there are new limits, 0 otherwise.
+ */
+int budget_update(struct perf_profile *p, int *pause)
+{
+	struct budget_sample *first;
+	struct budget_sample *last;
+	double error;
+	double usage;
+	double now;
+	int i;
+
+	now = time_secs();
+	if ((now - samples[nsamples - 1].wall) * 1000.0 < BUDGET_PERIOD_MS)
+		return (0);
+
+	/* Slide the window. */
+	if (nsamples == BUDGET_WINDOW + 1)
+	{
+		for (i = 0; i < BUDGET_WINDOW; i++)
+			samples[i] = samples[i + 1];
+		nsamples--;
+	}
+	samples[nsamples].wall = now;
+	samples[nsamples].cpu  = cpu_secs();
+	nsamples++;
+
+	first = &samples[0];
+	last  = &samples[nsamples - 1];
+	usage = (last->cpu - first->cpu) * 100.0 / (last->wall - first->wall);
+	stats.cpu_usage = usage;
+
+	/* PI controller, velocity form: no integral windup. */
+	error  = (budget - usage) / budget;
+	effort += BUDGET_KP * (error - prev_error) + BUDGET_KI * error;
+	effort = FFMIN(FFMAX(effort, 0.0), 1.0);
+	prev_error = error;
+
+	/* Out of knobs: pause (usage above) and resume (below). */
+	if (effort == 0.0 && usage > budget)
+		paused = 1;
+	else if (usage < budget)
+		paused = 0;
+
+	p->fps_cap = FFMAX(full_fps * effort, BUDGET_MIN_FPS);
+	p->threads = -1;
+	p->occlusion = 100;
+	if (effort >= 0.75)
+		p->quality = 0;
+	else if (effort >= 0.5)
+		p->quality = 1;
+	else if (effort >= 0.25)
+		p->quality = 2;
+	else
+		p->quality = QUALITY_MAX;
+
+	*pause = paused;
+	return (1);
+}
@@ -0,0 +1,271 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/adler32.h>
+#include <libavutil/pixdesc.h>
+
+#include "anipaper.h"
+
+/*
+ * Golden-frame checksums.
+ *
+ * Each frame gets a line, like FFmpeg's framecrc muxer:
+ *
+ *   <index>, <pts>, <size>, 0x<adler32>
+ *
+ * where the checksum covers either the exact bytes handed to
+ * the texture (only the visible part of each plane, without
+ * the line padding) or the final rendered surface. The list
+ * is either written to a file or compared, line by line,
+ * against a previously written one.
+ */
+
+/* Max mismatches reported. */
+#define CHECKSUM_MAX_REPORTS 10
+
+static FILE *checksum_file;
+static int checksum_verify;
+static unsigned long checksum_frames;
+static unsigned long checksum_mismatches;
+
+/* Rendered surface buffer. */
+static uint8_t *surface;
+static size_t surface_size;
+
+/**
+ * @brief Writes (or checks against the reference) the
+ * line @p line.
+ *
+ * @param line Line to be written/checked, with the
+ * trailing new line.
+ */
+static void checksum_line(const char *line)
+{
+	char ref[128];
+
+	if (!checksum_verify)
+	{
+		fputs(line, checksum_file);
+		return;
+	}
+
+	if (!fgets(ref, sizeof(ref), checksum_file))
+		strcpy(ref, "(missing)\n");
+
+	if (strcmp(ref, line))
+	{
+		if (checksum_mismatches < CHECKSUM_MAX_REPORTS)
+		{
+			LOG("checksum mismatch:\n");
+			LOG("  expected: %s", ref);
+			LOG("  got:      %s", line);
+		}
+		checksum_mismatches++;
+	}
+}
+
+/**
+ * @brief Opens the checksum list @p file, for writing or
+ * for comparison (if @p verify is non-zero).
+ *
+ * @param file Checksum list.
+ * @param verify Non-zero to compare against @p file.
+ * @param source Source of the checksums ("texture" or
+ * "present").
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+int checksum_open(const char *file, int verify, const char *source)
+{
+	char header[64];
+
+	checksum_file = fopen(file, verify ? "r" : "w");
+	if (!checksum_file)
+	{
+		LOG("Unable to open checksum file (%s)!\n", file);
+		return (-1);
+	}
+
+	checksum_verify     = verify;
+	checksum_frames     = 0;
+	checksum_mismatches = 0;
+
+	snprintf(header, sizeof(header), "#anipaper checksum: %s\n", source);
+	checksum_line(header);
+	return (0);
+}
+
+/**
+ * @brief Adds a new frame, whose content was already
+ * hashed into @p adler.
+ *
+ * @param ts Frame timestamp, in stream time base units.
+ * @param size Amount of bytes hashed.
+ * @param adler Adler-32 checksum.
+ */
+static void checksum_add(int64_t ts, size_t size, uint32_t adler)
+{
+	char line[128];
+
+	snprintf(line, sizeof(line), "%lu, %" PRId64 ", %zu, 0x%08" PRIx32 "\n",
+		checksum_frames, ts, size, adler);
+	checksum_line(line);
+	checksum_frames++;
+}
+
+/**
+ * @brief Hashes the visible bytes of each plane of @p frm,
+ * i.e: exactly what is uploaded into the texture.
+ *
+ * @param frm Frame to be hashed.
+ */
+void checksum_frame(AVFrame *frm)
+{
+	int p, y;
+	int w, h;
+	size_t size;
+	uint32_t adler;
+	const AVPixFmtDescriptor *desc;
+
+	if (!checksum_file)
+		return;
+
+	desc = av_pix_fmt_desc_get(frm->format);
+	if (!desc)
+		return;
+
+	adler = 1;
+	size  = 0;
+
+	/* Planar YUV, as uploaded by SDL_UpdateYUVTexture. */
+	for (p = 0; p < 3; p++)
+	{
+		w = frm->width;
+		h = frm->height;
+		if (p)
+		{
+			w = AV_CEIL_RSHIFT(w, desc->log2_chroma_w);
+			h = AV_CEIL_RSHIFT(h, desc->log2_chroma_h);
+		}
+
+		for (y = 0; y < h; y++)
+		{
+			adler = av_adler32_update(adler,
+				frm->data[p] + (ptrdiff_t)y * frm->linesize[p], w);
+		}
+		size += (size_t)w * h;
+	}
+
+	checksum_add(frm->best_effort_timestamp, size, adler);
+}
+
+/**
+ * @brief Hashes the rendered surface of @p renderer, must
+ * be called after drawing and before presenting.
+ *
+ * @param renderer SDL renderer.
+ * @param ts Frame timestamp, in stream time base units.
+ */
+void checksum_surface(SDL_Renderer *renderer, int64_t ts)
+{
+	int w, h;
+	size_t size;
+	uint8_t *s;
+
+	if (!checksum_file)
+		return;
+
+	if (SDL_GetRendererOutputSize(renderer, &w, &h) < 0)
+		return;
+
+	size = (size_t)w * h * 4;
+	if (size > surface_size)
+	{
+		s = realloc(surface, size);
+		if (!s)
+		{
+			LOG("Unable to allocate the checksum surface!\n");
+			return;
+		}
+		surface = s;
+		surface_size = size;
+	}
+
+	if (SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_ARGB8888,
+		surface, w * 4) < 0)
+	{
+		LOG("Unable to read the rendered surface: %s\n", SDL_GetError());
+		return;
+	}
+
+	checksum_add(ts, size, av_adler32_update(1, surface, size));
+}
+
+/**
+ * @brief Finishes the checksum list, and, if comparing,
+ * reports the results.
+ *
+ * @return Returns 0 if success (and all frames match), -1
+ * otherwise.
+ */
+int checksum_close(void)
+{
+	char ref[128];
+	int ret;
+
+	if (!checksum_file)
+		return (0);
+
+	ret = 0;
+	if (checksum_verify)
+	{
+		/* Reference frames not seen. */
+		while (fgets(ref, sizeof(ref), checksum_file))
+		{
+			if (checksum_mismatches < CHECKSUM_MAX_REPORTS)
+				LOG("checksum missing frame: %s", ref);
+			checksum_mismatches++;
+		}
+
+		LOG("checksum: %lu frames, %lu mismatches\n", checksum_frames,
+			checksum_mismatches);
+		if (checksum_mismatches)
+			ret = -1;
+	}
+
+	fclose(checksum_file);
+	checksum_file = NULL;
+	free(surface);
+	surface = NULL;
+	surface_size = 0;
+	return (ret);
+}
@@ -0,0 +1,217 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "anipaper.h"
+
+/*
+ * Per-frame decode cost prediction.
+ *
+ * The decode time of a packet is modeled as a linear function
+ * of its size, one model per frame type known before decoding
+ * (key or not): cost = a + b * size. The models are fitted
+ * online by least squares, with exponentially decaying sums,
+ * so they follow the machine load and the current scene.
+ *
+ * The models are persisted per file (path, size and mtime)
+ * in the cache directory, so the next run starts with the
+ * predictions already learned.
+ */
+
+/* Forgetting factor of the sums, per sample. */
+#define COST_FORGET 0.995
+
+/* Samples needed before trusting the slope. */
+#define COST_MIN_SAMPLES 8
+
+/* Model classes. */
+#define COST_INTER 0
+#define COST_KEY   1
+#define COST_NR    2
+
+/* Weighted sums of a model (x: size in KiB, y: cost in ms). */
+struct cost_model
+{
+	double n;
+	double sx;
+	double sy;
+	double sxx;
+	double sxy;
+};
+
+static struct cost_model models[COST_NR];
+static char model_path[PATH_MAX + 64];
+
+/**
+ * @brief Gets the cache file path for the input file @p file:
+ * <cache dir>/anipaper/cost-<hash>, where the hash covers the
+ * absolute path, size and modification time.
+ *
+ * @param file Input file.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int get_model_path(const char *file)
+{
+	char path[PATH_MAX];
+	char key[PATH_MAX + 64];
+	struct stat st;
+
+	if (stat(file, &st) < 0 || !realpath(file, path))
+		return (-1);
+
+	snprintf(key, sizeof(key), "%s:%lld:%lld", path, (long long)st.st_size,
+		(long long)st.st_mtime);
+	return (cache_path(model_path, sizeof(model_path), "cost", key));
+}
+
+/**
+ * @brief Initializes the cost models of the input file @p file,
+ * loading the persisted ones, if any.
+ *
+ * @param file Input file.
+ */
+void cost_init(const char *file)
+{
+	struct cost_model m;
+	FILE *f;
+	int type;
+
+	memset(models, 0, sizeof(models));
+	model_path[0] = '\0';
+
+	if (get_model_path(file) < 0)
+		return;
+
+	f = fopen(model_path, "r");
+	if (!f)
+		return;
+
+	while (fscanf(f, "%d %lf %lf %lf %lf %lf", &type, &m.n, &m.sx, &m.sy,
+		&m.sxx, &m.sxy) == 6)
+	{
+		if (type >= 0 && type < COST_NR && m.n >= 0)
+			models[type] = m;
+	}
+	fclose(f);
+
+	LOG("cost: models loaded from %s\n", model_path);
+}
+
+/**
+ * @brief Persists the cost models, creating the cache
+ * directory if needed.
+ */
+void cost_save(void)
+{
+	FILE *f;
+	int i;
+
+	if (!model_path[0])
+		return;
+
+	cache_mkdir(model_path);
+	f = fopen(model_path, "w");
+	if (!f)
+	{
+		LOG("cost: unable to save the models to %s\n", model_path);
+		return;
+	}
+
+	for (i = 0; i < COST_NR; i++)
+	{
+		fprintf(f, "%d %.17g %.17g %.17g %.17g %.17g\n", i, models[i].n,
+			models[i].sx, models[i].sy, models[i].sxx, models[i].sxy);
+	}
+	fclose(f);
+}
+
+/**
+ * @brief Learns the decode cost @p secs of a packet of @p size
+ * bytes.
+ *
+ * @param size Packet size.
+ * @param key Non-zero if keyframe.
+ * @param secs Decode time (in seconds).
+ */
+void cost_learn(int size, int key, double secs)
+{
+	struct cost_model *m;
+	double x;
+	double y;
+
+	m = &models[key ? COST_KEY : COST_INTER];
+	x = size / 1024.0;
+	y = secs * 1000.0;
+
+	m->n   = m->n   * COST_FORGET + 1.0;
+	m->sx  = m->sx  * COST_FORGET + x;
+	m->sy  = m->sy  * COST_FORGET + y;
+	m->sxx = m->sxx * COST_FORGET + x * x;
+	m->sxy = m->sxy * COST_FORGET + x * y;
+}
+
+/**
+ * @brief Predicts the decode cost of a packet of @p size bytes.
+ *
+ * @param size Packet size.
+ * @param key Non-zero if keyframe.
+ *
+ * @return Returns the predicted decode time (in seconds).
+ */
+double cost_predict(int size, int key)
+{
+	struct cost_model *m;
+	double det;
+	double a;
+	double b;
+
+	m = &models[key ? COST_KEY : COST_INTER];
+
+	/* Never seen a keyframe: at least as expensive as the others. */
+	if (!m->n && key)
+		m = &models[COST_INTER];
+	if (!m->n)
+		return (0.0);
+
+	/* Not enough (or too similar) samples: the average cost. */
+	det = m->n * m->sxx - m->sx * m->sx;
+	if (m->n < COST_MIN_SAMPLES || det <= 1e-9 * m->n * m->n)
+		return (m->sy / m->n / 1000.0);
+
+	b = (m->n * m->sxy - m->sx * m->sy) / det;
+	a = (m->sy - b * m->sx) / m->n;
+	return (FFMAX(a + b * size / 1024.0, 0.0) / 1000.0);
+}
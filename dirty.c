@@ -0,0 +1,560 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/motion_vector.h>
+
+#include "anipaper.h"
+
+/*
+ * Dirty regions from motion vectors.
+ *
+ * Decoders that export motion vectors (side data) already
+ * know which blocks are just a copy of their reference: the
+ * ones predicted from the past with a zero vector. The frame
+ * is split in tiles and a tile is 'clean' only if it is
+ * entirely covered by such blocks, everything else (intra
+ * blocks, moving blocks, blocks predicted from the future,
+ * areas without vectors) is dirty. No pixel is compared.
+ *
+ * The vectors only tell the direction of the reference, not
+ * which frame: the past reference is taken as the last frame
+ * (in display order) that is not a B-frame, which is also the
+ * one skipped blocks copy from. Without B-frames, that is just
+ * the previous frame.
+ *
+ * The textures are recycled (instead of created for every
+ * frame), so a texture still holds some older frame: both the
+ * frame held and the one uploaded are followed back, through
+ * their references, to a common frame, and only the union of
+ * the dirty tiles along the way needs to be uploaded. Anything
+ * not reachable that way (keyframes, frames without side data,
+ * textures older than the history) is fully uploaded.
+ *
+ * Note: residuals and reference indices are not exported, so
+ * a zero vector block with residual (or copying an older
+ * reference) is missed; bench/dirty_bench measures how often
+ * this happens against a pixel-diff.
+ */
+
+/* Tile size (in pixels), a multiple of the chroma subsampling. */
+#define DIRTY_TILE 16
+
+/* Motion vector units: smallest partition (4x4). */
+#define DIRTY_UNIT 4
+
+/* Masks kept, i.e: how old a recycled texture might be. */
+#define DIRTY_HISTORY 16
+
+/* Recycled textures: the picture queue plus the in-flight ones. */
+#define DIRTY_POOL 16
+
+/* Dirty area (in %) above which a full upload is done. */
+#define DIRTY_FULL_AREA 60
+
+/* Unit states. */
+#define UNIT_UNKNOWN 0
+#define UNIT_STATIC  1
+#define UNIT_MOVING  2
+
+/* Dirty tiles of a frame. */
+struct dirty_mask
+{
+	unsigned long seq; /* Frame sequence number.  */
+	unsigned long ref; /* Past reference, 0 none. */
+	int full;          /* Everything is dirty.    */
+	uint8_t *tiles;    /* 1 if dirty, 0 if clean. */
+};
+
+/* Recycled texture. */
+struct dirty_texture
+{
+	SDL_Texture *tex;
+	unsigned long seq; /* Frame held, 0 if none. */
+	int spare;         /* Available for reuse.   */
+};
+
+static int frame_w, frame_h;
+static int tiles_w, tiles_h;
+static int units_w, units_h;
+static uint8_t *units;
+static uint8_t *tiles_union;
+static struct dirty_mask masks[DIRTY_HISTORY];
+static unsigned long cur_seq;
+static unsigned long last_anchor;
+static int next_full;
+
+static struct dirty_texture pool[DIRTY_POOL];
+static SDL_mutex *pool_mutex;
+
+/**
+ * @brief Initializes the dirty tracking for frames of
+ * @p width x @p height pixels.
+ *
+ * @param width Frame width.
+ * @param height Frame height.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+int dirty_init(int width, int height)
+{
+	int i;
+
+	frame_w = width;
+	frame_h = height;
+	tiles_w = (width  + DIRTY_TILE - 1) / DIRTY_TILE;
+	tiles_h = (height + DIRTY_TILE - 1) / DIRTY_TILE;
+	units_w = tiles_w * (DIRTY_TILE / DIRTY_UNIT);
+	units_h = tiles_h * (DIRTY_TILE / DIRTY_UNIT);
+
+	units = calloc((size_t)units_w * units_h, 1);
+	tiles_union = calloc((size_t)tiles_w * tiles_h, 1);
+	if (!units || !tiles_union)
+		LOG_GOTO("Unable to allocate the dirty masks!\n", out);
+
+	for (i = 0; i < DIRTY_HISTORY; i++)
+	{
+		masks[i].tiles = calloc((size_t)tiles_w * tiles_h, 1);
+		if (!masks[i].tiles)
+			LOG_GOTO("Unable to allocate the dirty masks!\n", out);
+	}
+
+	pool_mutex = SDL_CreateMutex();
+	if (!pool_mutex)
+		LOG_GOTO("Unable to create the texture pool mutex!\n", out);
+
+	cur_seq = 0;
+	last_anchor = 0;
+	next_full = 1;
+	return (0);
+out:
+	dirty_finish();
+	return (-1);
+}
+
+/**
+ * @brief Releases the dirty tracking resources, including
+ * the spare textures.
+ */
+void dirty_finish(void)
+{
+	int i;
+
+	for (i = 0; i < DIRTY_POOL; i++)
+	{
+		if (pool[i].tex && pool[i].spare)
+			SDL_DestroyTexture(pool[i].tex);
+		pool[i].tex = NULL;
+	}
+	for (i = 0; i < DIRTY_HISTORY; i++)
+	{
+		free(masks[i].tiles);
+		masks[i].tiles = NULL;
+	}
+
+	free(units);
+	free(tiles_union);
+	units = tiles_union = NULL;
+
+	if (pool_mutex)
+		SDL_DestroyMutex(pool_mutex);
+	pool_mutex = NULL;
+}
+
+/**
+ * @brief Sets the units covered by the block @p mv to
+ * @p state: moving units always win over static ones.
+ *
+ * @param mv Motion vector (block).
+ * @param state UNIT_STATIC or UNIT_MOVING.
+ */
+static void mark_block(const AVMotionVector *mv, int state)
+{
+	int x1, y1, x2, y2;
+	int x, y;
+	uint8_t *u;
+
+	/* dst_x/dst_y are the block center. */
+	x1 = FFMAX(mv->dst_x - mv->w / 2, 0);
+	y1 = FFMAX(mv->dst_y - mv->h / 2, 0);
+	x2 = FFMIN(mv->dst_x - mv->w / 2 + mv->w, frame_w);
+	y2 = FFMIN(mv->dst_y - mv->h / 2 + mv->h, frame_h);
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	/*
+	 * Static: only the units entirely inside; moving: every
+	 * unit touched.
+	 */
+	if (state == UNIT_STATIC)
+	{
+		x1 = (x1 + DIRTY_UNIT - 1) / DIRTY_UNIT;
+		y1 = (y1 + DIRTY_UNIT - 1) / DIRTY_UNIT;
+		x2 = (x2 == frame_w) ? units_w : x2 / DIRTY_UNIT;
+		y2 = (y2 == frame_h) ? units_h : y2 / DIRTY_UNIT;
+	}
+	else
+	{
+		x1 /= DIRTY_UNIT;
+		y1 /= DIRTY_UNIT;
+		x2 = (x2 + DIRTY_UNIT - 1) / DIRTY_UNIT;
+		y2 = (y2 + DIRTY_UNIT - 1) / DIRTY_UNIT;
+	}
+
+	for (y = y1; y < y2; y++)
+	{
+		u = units + (size_t)y * units_w;
+		for (x = x1; x < x2; x++)
+			if (u[x] != UNIT_MOVING)
+				u[x] = state;
+	}
+}
+
+/**
+ * @brief Computes the dirty tiles of the decoded frame
+ * @p frm, relative to its past reference, from its
+ * motion vectors. Must be called for every decoded frame,
+ * even the ones that will not be uploaded.
+ *
+ * @param frm Decoded frame.
+ *
+ * @return Returns the dirty area (in %), or -1 if the frame
+ * is entirely dirty (keyframe, no motion vectors...).
+ */
+int dirty_frame(AVFrame *frm)
+{
+	const AVMotionVector *mvs;
+	struct dirty_mask *m;
+	AVFrameSideData *sd;
+	int tile_units;
+	int ndirty;
+	int nmvs;
+	int tx, ty;
+	int x, y;
+	int i;
+
+	cur_seq++;
+	m = &masks[cur_seq % DIRTY_HISTORY];
+	m->seq = cur_seq;
+	m->ref = last_anchor;
+	m->full = 1;
+
+	/* Every frame but the B-frames may be referred to. */
+	if (frm->pict_type != AV_PICTURE_TYPE_B)
+		last_anchor = cur_seq;
+
+	sd = av_frame_get_side_data(frm, AV_FRAME_DATA_MOTION_VECTORS);
+	if (next_full || !sd || !m->ref ||
+		frm->pict_type == AV_PICTURE_TYPE_I ||
+		frm->width != frame_w || frm->height != frame_h)
+	{
+		next_full = 0;
+		return (-1);
+	}
+
+	mvs  = (const AVMotionVector *)sd->data;
+	nmvs = sd->size / sizeof(*mvs);
+
+	memset(units, UNIT_UNKNOWN, (size_t)units_w * units_h);
+	for (i = 0; i < nmvs; i++)
+	{
+		if (mvs[i].source < 0 && !mvs[i].motion_x && !mvs[i].motion_y)
+			mark_block(&mvs[i], UNIT_STATIC);
+		else
+			mark_block(&mvs[i], UNIT_MOVING);
+	}
+
+	/* A tile is clean only if all its units are static. */
+	tile_units = DIRTY_TILE / DIRTY_UNIT;
+	ndirty = 0;
+	for (ty = 0; ty < tiles_h; ty++)
+	{
+		for (tx = 0; tx < tiles_w; tx++)
+		{
+			m->tiles[ty * tiles_w + tx] = 0;
+			for (y = ty * tile_units; y < (ty + 1) * tile_units; y++)
+			{
+				for (x = tx * tile_units; x < (tx + 1) * tile_units; x++)
+				{
+					if (units[(size_t)y * units_w + x] != UNIT_STATIC)
+					{
+						m->tiles[ty * tiles_w + tx] = 1;
+						goto next_tile;
+					}
+				}
+			}
+		next_tile:
+			ndirty += m->tiles[ty * tiles_w + tx];
+		}
+	}
+
+	m->full = 0;
+	return (ndirty * 100 / (tiles_w * tiles_h));
+}
+
+/**
+ * @brief Returns the dirty tiles of the last frame passed
+ * to dirty_frame() (NULL if entirely dirty), and the tile
+ * grid size.
+ *
+ * @param w Output, tiles per row.
+ * @param h Output, tiles per column.
+ *
+ * @return Returns the tiles (1 if dirty, 0 if clean).
+ */
+const uint8_t *dirty_tiles(int *w, int *h)
+{
+	struct dirty_mask *m;
+
+	*w = tiles_w;
+	*h = tiles_h;
+	m = &masks[cur_seq % DIRTY_HISTORY];
+	return (m->full ? NULL : m->tiles);
+}
+
+/**
+ * @brief Forgets the textures in use (destroyed elsewhere,
+ * e.g: by a picture queue flush) and forces the next frame to
+ * be fully uploaded.
+ */
+void dirty_reset(void)
+{
+	int i;
+
+	SDL_LockMutex(pool_mutex);
+		for (i = 0; i < DIRTY_POOL; i++)
+			if (pool[i].tex && !pool[i].spare)
+				pool[i].tex = NULL;
+	SDL_UnlockMutex(pool_mutex);
+	last_anchor = 0;
+	next_full = 1;
+}
+
+/**
+ * @brief Gets a texture to upload a frame into: the spare
+ * one holding the most recent frame, a new one if none, or
+ * NULL if out of memory.
+ *
+ * @param renderer SDL renderer.
+ * @param seq Output, frame held by the texture, 0 if none.
+ *
+ * @return Returns the texture.
+ */
+static SDL_Texture *get_texture(SDL_Renderer *renderer, unsigned long *seq)
+{
+	struct dirty_texture *t;
+	SDL_Texture *tex;
+	int i;
+
+	t = NULL;
+	SDL_LockMutex(pool_mutex);
+		for (i = 0; i < DIRTY_POOL; i++)
+			if (pool[i].tex && pool[i].spare && (!t || pool[i].seq > t->seq))
+				t = &pool[i];
+
+		/* None available, create (and track, if possible) a new one. */
+		if (!t)
+		{
+			tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12,
+				SDL_TEXTUREACCESS_STREAMING, frame_w, frame_h);
+			for (i = 0; i < DIRTY_POOL && tex; i++)
+			{
+				if (!pool[i].tex)
+				{
+					t = &pool[i];
+					t->tex = tex;
+					t->seq = 0;
+					break;
+				}
+			}
+			*seq = 0;
+		}
+
+		if (t)
+		{
+			tex = t->tex;
+			*seq = t->seq;
+			t->seq = cur_seq;
+			t->spare = 0;
+		}
+	SDL_UnlockMutex(pool_mutex);
+	return (tex);
+}
+
+/**
+ * @brief Uploads the rectangle @p r of the frame @p frm
+ * into @p tex.
+ *
+ * @param tex Texture.
+ * @param frm Frame (YUV420P).
+ * @param r Rectangle, even coordinates.
+ */
+static void upload_rect(SDL_Texture *tex, AVFrame *frm, SDL_Rect *r)
+{
+	SDL_UpdateYUVTexture(tex, r,
+		frm->data[0] + (ptrdiff_t)r->y * frm->linesize[0] + r->x,
+		frm->linesize[0],
+		frm->data[1] + (ptrdiff_t)(r->y / 2) * frm->linesize[1] + r->x / 2,
+		frm->linesize[1],
+		frm->data[2] + (ptrdiff_t)(r->y / 2) * frm->linesize[2] + r->x / 2,
+		frm->linesize[2]);
+}
+
+/**
+ * @brief Uploads the frame @p frm (the last one passed to
+ * dirty_frame()) into a recycled texture, only the regions
+ * that changed since the frame the texture holds.
+ *
+ * The dirty tiles are merged into horizontal spans, one per
+ * tile row, and consecutive rows with the same span into a
+ * single rectangle.
+ *
+ * @param renderer SDL renderer.
+ * @param frm Frame to be uploaded (YUV420P).
+ * @param area Output, uploaded area (in %).
+ *
+ * @return Returns the texture, or NULL if error.
+ */
+SDL_Texture *dirty_upload(SDL_Renderer *renderer, AVFrame *frm,
+	double *area)
+{
+	struct dirty_mask *m;
+	SDL_Texture *tex;
+	SDL_Rect r;
+	unsigned long seq;
+	unsigned long cur;
+	unsigned long s;
+	int x1, x2;
+	int ndirty;
+	int ntiles;
+	int ty;
+	int i;
+
+	tex = get_texture(renderer, &seq);
+	if (!tex)
+		return (NULL);
+
+	/*
+	 * Union of the dirty tiles from the frame held and from
+	 * this one back to a common reference: always follow the
+	 * newest of both, references are older.
+	 */
+	ntiles = tiles_w * tiles_h;
+	if (!seq)
+		goto full;
+
+	memset(tiles_union, 0, ntiles);
+	for (cur = cur_seq; cur != seq; )
+	{
+		s = FFMAX(cur, seq);
+		m = &masks[s % DIRTY_HISTORY];
+		if (m->full || m->seq != s || !m->ref)
+			goto full;
+		for (i = 0; i < ntiles; i++)
+			tiles_union[i] |= m->tiles[i];
+
+		if (s == cur)
+			cur = m->ref;
+		else
+			seq = m->ref;
+	}
+
+	for (i = 0, ndirty = 0; i < ntiles; i++)
+		ndirty += tiles_union[i];
+	if (ndirty * 100 > ntiles * DIRTY_FULL_AREA)
+		goto full;
+
+	r.w = 0;
+	for (ty = 0; ty < tiles_h; ty++)
+	{
+		for (x1 = 0; x1 < tiles_w && !tiles_union[ty * tiles_w + x1]; x1++);
+		for (x2 = tiles_w; x2 > x1 && !tiles_union[ty * tiles_w + x2 - 1]; x2--);
+
+		/* Same span as the previous row: grow the rectangle. */
+		if (r.w && x1 < x2 && r.x == x1 * DIRTY_TILE &&
+			r.x + r.w == FFMIN(x2 * DIRTY_TILE, frame_w) &&
+			r.y + r.h == ty * DIRTY_TILE)
+		{
+			r.h = FFMIN((ty + 1) * DIRTY_TILE, frame_h) - r.y;
+			continue;
+		}
+
+		if (r.w)
+			upload_rect(tex, frm, &r);
+		r.w = 0;
+
+		if (x1 < x2)
+		{
+			r.x = x1 * DIRTY_TILE;
+			r.y = ty * DIRTY_TILE;
+			r.w = FFMIN(x2 * DIRTY_TILE, frame_w) - r.x;
+			r.h = FFMIN((ty + 1) * DIRTY_TILE, frame_h) - r.y;
+		}
+	}
+	if (r.w)
+		upload_rect(tex, frm, &r);
+
+	*area = ndirty * 100.0 / ntiles;
+	return (tex);
+full:
+	SDL_UpdateYUVTexture(tex, NULL,
+		frm->data[0], frm->linesize[0],
+		frm->data[1], frm->linesize[1],
+		frm->data[2], frm->linesize[2]);
+	*area = 100.0;
+	return (tex);
+}
+
+/**
+ * @brief Gives back the texture @p tex, already presented
+ * (or dropped), for reuse.
+ *
+ * @param tex Texture.
+ */
+void dirty_release(SDL_Texture *tex)
+{
+	int i;
+
+	SDL_LockMutex(pool_mutex);
+		for (i = 0; i < DIRTY_POOL; i++)
+		{
+			if (pool[i].tex == tex && !pool[i].spare)
+			{
+				pool[i].spare = 1;
+				SDL_UnlockMutex(pool_mutex);
+				return;
+			}
+		}
+	SDL_UnlockMutex(pool_mutex);
+
+	/* Not tracked. */
+	SDL_DestroyTexture(tex);
+}
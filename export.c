@@ -0,0 +1,403 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+
+#include "anipaper.h"
+#include "queue.h"
+
+/*
+ * Frame export.
+ *
+ * The decode thread only takes a new reference of each frame
+ * and adds it to a bounded job queue: the conversion (if any)
+ * and the writing happen as background tasks of the task pool
+ * (its own one, if none is running), with a scale context and
+ * buffer per pool worker, so the export throughput scales with
+ * the amount of cores.
+ */
+
+/* Max workers, plus a slot for tasks run inline. */
+#define EXPORT_MAX_THREADS 65
+
+/* Queue slots per worker. */
+#define EXPORT_JOBS_PER_THREAD 2
+
+/* Formats. */
+const char *const export_format_names[EXPORT_FMT_NR] = {"ppm", "pam", "yuv"};
+
+/* Export job: a frame and its number. */
+struct export_job
+{
+	AVFrame *frame;
+	unsigned long index;
+};
+
+/* Per-worker state. */
+struct export_worker
+{
+	struct SwsContext *sws_ctx;
+	uint8_t *buf;
+	int buf_size;
+};
+
+/* Bounded job queue (ring buffer). */
+static struct export_job *jobs;
+static int max_jobs;
+static int first_job;
+static int njobs;
+static int outstanding;
+static SDL_mutex *export_mutex;
+static SDL_cond *export_cond;
+
+/* Workers state, pool started by the export (if so). */
+static struct export_worker workers[EXPORT_MAX_THREADS];
+static int own_pool;
+
+/* Parameters. */
+static const char *export_dir;
+static int export_fmt;
+static unsigned long export_first;
+static unsigned long export_last;
+static unsigned long next_index;
+
+/* Results, protected by export_mutex. */
+static unsigned long frames_written;
+static unsigned long frames_failed;
+static uint64_t bytes_written;
+static double begin_secs;
+
+/**
+ * @brief Converts (if needed) and writes the frame
+ * @p job into the export directory.
+ *
+ * @param w Worker.
+ * @param job Job to be written.
+ *
+ * @return Returns the amount of bytes written, or -1
+ * if error.
+ */
+static int write_frame(struct export_worker *w, struct export_job *job)
+{
+	FILE *f;
+	int ret;
+	int size;
+	char filename[1024];
+	enum AVPixelFormat dst_fmt;
+	uint8_t *dst_data[4];
+	int dst_linesize[4];
+	AVFrame *frm;
+
+	frm = job->frame;
+	ret = -1;
+
+	snprintf(filename, sizeof(filename), "%s/frame_%06lu.%s", export_dir,
+		job->index, export_format_names[export_fmt]);
+
+	/* Raw YUV: the decoded planes, as is. */
+	if (export_fmt == EXPORT_FMT_YUV)
+		dst_fmt = frm->format;
+	else if (export_fmt == EXPORT_FMT_PAM)
+		dst_fmt = AV_PIX_FMT_RGBA;
+	else
+		dst_fmt = AV_PIX_FMT_RGB24;
+
+	size = av_image_get_buffer_size(dst_fmt, frm->width, frm->height, 1);
+	if (size < 0)
+		return (-1);
+
+	if (size > w->buf_size)
+	{
+		av_free(w->buf);
+		w->buf = av_malloc(size);
+		w->buf_size = w->buf ? size : 0;
+		if (!w->buf)
+			return (-1);
+	}
+
+	if (export_fmt == EXPORT_FMT_YUV)
+	{
+		if (av_image_copy_to_buffer(w->buf, size,
+			(const uint8_t * const *)frm->data, frm->linesize, dst_fmt,
+			frm->width, frm->height, 1) < 0)
+		{
+			return (-1);
+		}
+	}
+
+	/* RGB: convert straight into the (packed) buffer. */
+	else
+	{
+		w->sws_ctx = sws_getCachedContext(w->sws_ctx,
+			frm->width, frm->height, frm->format,
+			frm->width, frm->height, dst_fmt,
+			SWS_BILINEAR, NULL, NULL, NULL);
+		if (!w->sws_ctx)
+			return (-1);
+
+		av_image_fill_arrays(dst_data, dst_linesize, w->buf, dst_fmt,
+			frm->width, frm->height, 1);
+		sws_scale(w->sws_ctx, (const uint8_t * const *)frm->data,
+			frm->linesize, 0, frm->height, dst_data, dst_linesize);
+	}
+
+	f = fopen(filename, "wb");
+	if (!f)
+		return (-1);
+
+	if (export_fmt == EXPORT_FMT_PPM)
+		fprintf(f, "P6\n%d %d\n255\n", frm->width, frm->height);
+	else if (export_fmt == EXPORT_FMT_PAM)
+	{
+		fprintf(f, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\n"
+			"TUPLTYPE RGB_ALPHA\nENDHDR\n", frm->width, frm->height);
+	}
+
+	/* Packed buffer: a single write is enough. */
+	if (fwrite(w->buf, 1, size, f) == (size_t)size)
+		ret = size;
+
+	if (fclose(f) != 0)
+		ret = -1;
+	return (ret);
+}
+
+/**
+ * @brief Export task: takes the oldest job from the queue
+ * and writes it.
+ *
+ * @param arg Unused.
+ * @param job_nr Unused.
+ */
+static void export_task(void *arg, int job_nr)
+{
+	int ret;
+	struct export_job job;
+	struct export_worker *w;
+
+	((void)arg);
+	((void)job_nr);
+
+	/* Tasks run inline (no worker) share the first slot. */
+	w = &workers[pool_worker() + 1];
+
+	SDL_LockMutex(export_mutex);
+		job = jobs[first_job];
+		first_job = (first_job + 1) % max_jobs;
+		njobs--;
+	SDL_UnlockMutex(export_mutex);
+
+	ret = write_frame(w, &job);
+	av_frame_free(&job.frame);
+
+	SDL_LockMutex(export_mutex);
+		if (ret < 0)
+		{
+			if (!frames_failed)
+				LOG("Unable to export frame %lu!\n", job.index);
+			frames_failed++;
+		}
+		else
+		{
+			frames_written++;
+			bytes_written += ret;
+		}
+
+		/* Wake up the (possibly) blocked producer. */
+		outstanding--;
+		SDL_CondBroadcast(export_cond);
+	SDL_UnlockMutex(export_mutex);
+}
+
+/**
+ * @brief Initializes the export: creates the output
+ * directory @p dir (if needed) and the task pool, if
+ * not running yet.
+ *
+ * @param dir Output directory.
+ * @param fmt Output format (EXPORT_FMT_*).
+ * @param first First frame to be exported.
+ * @param last Last frame to be exported (inclusive).
+ * @param threads Number of pool workers, if started here (0
+ * for the number of CPUs).
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+int export_init(const char *dir, int fmt, unsigned long first,
+	unsigned long last, int threads)
+{
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+		LOG_GOTO("Unable to create the export directory!\n", out0);
+
+	export_dir   = dir;
+	export_fmt   = fmt;
+	export_first = first;
+	export_last  = last;
+	next_index   = 0;
+
+	if (!pool_size())
+	{
+		if (pool_init(threads) < 0)
+			goto out0;
+		own_pool = 1;
+	}
+
+	max_jobs = pool_size() * EXPORT_JOBS_PER_THREAD;
+	jobs = calloc(max_jobs, sizeof(*jobs));
+	if (!jobs)
+		LOG_GOTO("Unable to allocate the export queue!\n", out0);
+
+	export_mutex = SDL_CreateMutex();
+	export_cond  = SDL_CreateCond();
+	if (!export_mutex || !export_cond)
+		LOG_GOTO("Unable to create the export mutex!\n", out1);
+
+	LOG("export: %s (%s), %d threads\n", dir,
+		export_format_names[fmt], pool_size());
+
+	begin_secs = time_secs();
+	return (0);
+out1:
+	if (export_cond)
+		SDL_DestroyCond(export_cond);
+	if (export_mutex)
+		SDL_DestroyMutex(export_mutex);
+	export_cond = NULL;
+	export_mutex = NULL;
+	free(jobs);
+	jobs = NULL;
+out0:
+	if (own_pool)
+		pool_finish();
+	own_pool = 0;
+	return (-1);
+}
+
+/**
+ * @brief Adds the frame @p frm to the export queue (if in
+ * the frame range), waiting if the queue is full.
+ *
+ * @param frm Frame to be exported, the caller keeps its
+ * own reference.
+ *
+ * @return Returns 0 if success, 1 if the frame range is
+ * over (there is no need to decode anything else) or -1
+ * if error.
+ */
+int export_frame(AVFrame *frm)
+{
+	unsigned long index;
+	AVFrame *ref;
+
+	index = next_index++;
+
+	if (index > export_last)
+		return (1);
+	if (index < export_first)
+		return (0);
+
+	/* A new reference only, no copy. */
+	ref = av_frame_clone(frm);
+	if (!ref)
+		return (-1);
+
+	SDL_LockMutex(export_mutex);
+		while (outstanding == max_jobs && !should_quit)
+			SDL_CondWait(export_cond, export_mutex);
+
+		if (should_quit)
+		{
+			SDL_UnlockMutex(export_mutex);
+			av_frame_free(&ref);
+			return (-1);
+		}
+
+		jobs[(first_job + njobs) % max_jobs] =
+			(struct export_job){ref, index};
+		njobs++;
+		outstanding++;
+	SDL_UnlockMutex(export_mutex);
+
+	pool_submit(export_task, NULL, POOL_PRIO_BACKGROUND);
+
+	return (index == export_last);
+}
+
+/**
+ * @brief Waits for all the pending frames to be written,
+ * releases the workers state (and the task pool, if started
+ * by the export) and reports the results.
+ *
+ * @return Returns 0 if all frames were written, -1
+ * otherwise.
+ */
+int export_finish(void)
+{
+	int i;
+	double elapsed;
+
+	if (!export_mutex)
+		return (0);
+
+	SDL_LockMutex(export_mutex);
+		while (outstanding)
+			SDL_CondWait(export_cond, export_mutex);
+	SDL_UnlockMutex(export_mutex);
+
+	if (own_pool)
+		pool_finish();
+	own_pool = 0;
+
+	for (i = 0; i < EXPORT_MAX_THREADS; i++)
+	{
+		sws_freeContext(workers[i].sws_ctx);
+		av_free(workers[i].buf);
+		workers[i].sws_ctx = NULL;
+		workers[i].buf = NULL;
+		workers[i].buf_size = 0;
+	}
+
+	elapsed = time_secs() - begin_secs;
+	LOG("export: %lu frames (%.1f MiB) in %.3fs, %.1f fps, %lu failed\n",
+		frames_written, (double)bytes_written / (1024.0 * 1024.0), elapsed,
+		elapsed > 0 ? frames_written / elapsed : 0.0, frames_failed);
+
+	SDL_DestroyCond(export_cond);
+	SDL_DestroyMutex(export_mutex);
+	export_cond = NULL;
+	export_mutex = NULL;
+	free(jobs);
+	jobs = NULL;
+
+	return (frames_failed ? -1 : 0);
+}
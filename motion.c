@@ -0,0 +1,262 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "anipaper.h"
+
+/*
+ * Motion-adaptive frame rate.
+ *
+ * The activity of each frame is the mean absolute difference
+ * of the luma against the previous frame, over one row out of
+ * MOTION_ROW_STEP (the rows are contiguous, so the compiler
+ * turns the kernel into SAD instructions, e.g: psadbw), split
+ * in bands over the task pool, if running.
+ *
+ * Low-motion scenes are shown at half or a quarter of the
+ * stream frame rate: the rate drops one step at a time, only
+ * after the (smoothed) activity stays low for MOTION_HOLD_MS,
+ * and goes back up as soon as a single frame moves enough.
+ */
+
+/* Rows sampled, one out of MOTION_ROW_STEP. */
+#define MOTION_ROW_STEP 4
+
+/* Largest frame rate divisor. */
+#define MOTION_MAX_DIV 4
+
+/* Largest amount of bands. */
+#define MOTION_MAX_BANDS 16
+
+/* Smoothing factor of the activity (EMA). */
+#define MOTION_ALPHA 0.1
+
+static AVFrame *prev;
+static double full_fps;
+static double activity;
+static double low_since;
+static int divisor;
+
+/* Frame being measured and SAD of each band. */
+struct motion_bands
+{
+	AVFrame *frm;
+	int nbands;
+	uint64_t sad[MOTION_MAX_BANDS];
+};
+
+/**
+ * @brief Initializes the motion-adaptive frame rate.
+ *
+ * @param fps Stream frame rate, i.e: the full rate.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+int motion_init(double fps)
+{
+	prev = av_frame_alloc();
+	if (!prev)
+		LOG_GOTO("Unable to allocate the motion reference frame!\n", out);
+
+	full_fps = fps;
+	divisor = 1;
+	activity = -1.0;
+	stats.motion_fps = fps;
+	return (0);
+out:
+	return (-1);
+}
+
+/**
+ * @brief Releases the motion reference frame.
+ */
+void motion_finish(void)
+{
+	av_frame_free(&prev);
+}
+
+/**
+ * @brief Sum of absolute differences of @p n bytes.
+ *
+ * @param a First row.
+ * @param b Second row.
+ * @param n Amount of bytes.
+ *
+ * @return Returns the SAD.
+ */
+static unsigned sad_row(const uint8_t *a, const uint8_t *b, int n)
+{
+	unsigned sad;
+	int i;
+
+	sad = 0;
+	for (i = 0; i < n; i++)
+		sad += abs(a[i] - b[i]);
+	return (sad);
+}
+
+/**
+ * @brief SAD of the band @p band of the sampled rows.
+ *
+ * @param arg Bands.
+ * @param band Band index.
+ */
+static void band_sad(void *arg, int band)
+{
+	struct motion_bands *mb;
+	AVFrame *frm;
+	uint64_t sad;
+	int rows;
+	int y;
+
+	mb = (struct motion_bands *)arg;
+	frm = mb->frm;
+	rows = (frm->height + MOTION_ROW_STEP - 1) / MOTION_ROW_STEP;
+
+	sad = 0;
+	for (y = (int)((int64_t)rows * band / mb->nbands) * MOTION_ROW_STEP;
+		y < (int)((int64_t)rows * (band + 1) / mb->nbands) * MOTION_ROW_STEP;
+		y += MOTION_ROW_STEP)
+	{
+		sad += sad_row(frm->data[0] + (ptrdiff_t)y * frm->linesize[0],
+			prev->data[0] + (ptrdiff_t)y * prev->linesize[0], frm->width);
+	}
+	mb->sad[band] = sad;
+}
+
+/**
+ * @brief Activity of @p frm against the previous frame: mean
+ * absolute luma difference, over the sampled rows.
+ *
+ * @param frm Frame (8-bit luma in the first plane).
+ * @param pts Frame pts (in seconds), the deadline of its bands.
+ *
+ * @return Returns the activity, or -1 if there is no previous
+ * frame to compare with.
+ */
+static double frame_activity(AVFrame *frm, double pts)
+{
+	struct motion_bands mb;
+	uint64_t sad;
+	int rows;
+	int i;
+
+	if (!prev->data[0] || prev->width != frm->width ||
+		prev->height != frm->height)
+	{
+		return (-1.0);
+	}
+
+	rows = (frm->height + MOTION_ROW_STEP - 1) / MOTION_ROW_STEP;
+	mb.frm = frm;
+	mb.nbands = FFMIN(pool_size() + 1, FFMIN(MOTION_MAX_BANDS, rows));
+	pool_run(band_sad, &mb, mb.nbands, pts);
+
+	for (i = 0, sad = 0; i < mb.nbands; i++)
+		sad += mb.sad[i];
+	return ((double)sad / ((double)rows * frm->width));
+}
+
+/**
+ * @brief Frame rate divisor wanted for the activity @p act.
+ *
+ * @param act Activity.
+ *
+ * @return Returns the divisor.
+ */
+static int wanted_divisor(double act)
+{
+	if (act < MOTION_LOW_ACTIVITY)
+		return (MOTION_MAX_DIV);
+	else if (act < MOTION_MID_ACTIVITY)
+		return (2);
+	return (1);
+}
+
+/**
+ * @brief Measures the activity of the decoded frame @p frm
+ * (keeping a reference to it, for the next one) and returns
+ * the frame rate it deserves.
+ *
+ * @param frm Decoded frame, in system memory.
+ * @param pts Frame pts (in seconds).
+ *
+ * @return Returns the frame rate.
+ */
+double motion_fps(AVFrame *frm, double pts)
+{
+	double act;
+	int want;
+
+	act = frame_activity(frm, pts);
+	av_frame_unref(prev);
+	if (av_frame_ref(prev, frm) < 0)
+		LOG("Unable to keep the motion reference frame!\n");
+
+	if (act < 0)
+		goto out;
+
+	/* Seeked back (e.g: loop). */
+	if (pts < low_since)
+		low_since = pts;
+
+	if (activity < 0)
+		activity = act;
+	else
+		activity += MOTION_ALPHA * (act - activity);
+
+	/* Moving: back to the rate it needs, right away. */
+	want = wanted_divisor(act);
+	if (want < divisor)
+	{
+		divisor = want;
+		low_since = pts;
+	}
+
+	/* Still for long enough: one step down. */
+	else if (wanted_divisor(activity) > divisor)
+	{
+		if ((pts - low_since) * 1000.0 >= MOTION_HOLD_MS &&
+			divisor < MOTION_MAX_DIV)
+		{
+			divisor *= 2;
+			low_since = pts;
+		}
+	}
+	else
+		low_since = pts;
+
+out:
+	stats.motion_fps = FFMIN(FFMAX(full_fps / divisor, MOTION_MIN_FPS),
+		full_fps);
+	return (stats.motion_fps);
+}
@@ -0,0 +1,406 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "anipaper.h"
+
+/*
+ * Frame pacing accuracy measurement.
+ *
+ * The main thread records the pts and the actual present time
+ * of every frame shown, and the pause thread records when the
+ * playback was paused and resumed. At the end, each frame is
+ * compared against its ideal schedule: the pts elapsed since
+ * the first frame (unwrapped across loop seams), plus the
+ * time spent paused.
+ */
+
+/* Presented frame. */
+struct pacing_sample
+{
+	double pts;     /* Frame pts (in seconds).           */
+	double present; /* Time it was presented (in seconds). */
+};
+
+/* Pause interval. */
+struct pacing_pause
+{
+	double start; /* Pause time (in seconds).  */
+	double end;   /* Resume time (in seconds). */
+};
+
+/* Max pauses recorded. */
+#define PACING_MAX_PAUSES 64
+
+/* Frames after a seam/resume considered part of it. */
+#define PACING_SETTLE_FRAMES 3
+
+static struct pacing_sample *samples;
+static int nsamples;
+static int max_samples;
+static int overflow;
+
+static struct pacing_pause pauses[PACING_MAX_PAUSES];
+static int npauses;
+
+static double begin_secs;
+static double duration_secs;
+
+/**
+ * @brief Starts a new pacing measurement, that lasts
+ * @p duration seconds.
+ *
+ * @param duration Measurement length (in seconds).
+ */
+void pacing_begin(double duration)
+{
+	begin_secs    = time_secs();
+	duration_secs = duration;
+	nsamples = 0;
+	npauses  = 0;
+	overflow = 0;
+}
+
+/**
+ * @brief Checks if the measurement is over.
+ *
+ * @return Returns 1 if over, 0 otherwise.
+ */
+int pacing_done(void)
+{
+	return (time_secs() - begin_secs >= duration_secs);
+}
+
+/**
+ * @brief Pause schedule used to exercise pause/resume: the
+ * playback is paused from 40% of the measurement, for 10% of
+ * its length (at most 1 second).
+ *
+ * @return Returns 1 if the playback should be paused now,
+ * 0 otherwise.
+ */
+int pacing_should_pause(void)
+{
+	double elapsed;
+	double len;
+
+	elapsed = time_secs() - begin_secs;
+	len = fmin(duration_secs * 0.1, 1.0);
+
+	return (elapsed >= duration_secs * 0.4 &&
+		elapsed < duration_secs * 0.4 + len);
+}
+
+/**
+ * @brief Records a presented frame.
+ *
+ * @param pts Frame pts (in seconds).
+ * @param present Time it was presented (in seconds).
+ */
+void pacing_record(double pts, double present)
+{
+	struct pacing_sample *s;
+
+	if (overflow)
+		return;
+
+	if (nsamples == max_samples)
+	{
+		s = realloc(samples, sizeof(*samples) *
+			(max_samples ? max_samples * 2 : 1024));
+		if (!s)
+		{
+			LOG("Unable to record more pacing samples!\n");
+			overflow = 1;
+			return;
+		}
+		samples = s;
+		max_samples = max_samples ? max_samples * 2 : 1024;
+	}
+
+	samples[nsamples].pts = pts;
+	samples[nsamples].present = present;
+	nsamples++;
+}
+
+/**
+ * @brief Records a pause (if @p paused is non-zero) or a
+ * resume at time @p t.
+ *
+ * @param paused Non-zero if paused, 0 if resumed.
+ * @param t Event time (in seconds).
+ */
+void pacing_pause_event(int paused, double t)
+{
+	if (paused)
+	{
+		if (npauses == PACING_MAX_PAUSES)
+			return;
+		pauses[npauses].start = t;
+		pauses[npauses].end = -1.0;
+		npauses++;
+	}
+	else if (npauses && pauses[npauses - 1].end < 0)
+		pauses[npauses - 1].end = t;
+}
+
+/**
+ * @brief Time spent paused before @p t.
+ *
+ * @param t Time (in seconds).
+ *
+ * @return Returns the amount of seconds paused.
+ */
+static double paused_before(double t)
+{
+	int i;
+	double end;
+	double total;
+
+	for (i = 0, total = 0.0; i < npauses; i++)
+	{
+		if (pauses[i].start >= t)
+			break;
+		end = pauses[i].end < 0 ? t : fmin(pauses[i].end, t);
+		total += end - pauses[i].start;
+	}
+	return (total);
+}
+
+/**
+ * @brief Comparison routine to sort doubles.
+ */
+static int cmp_double(const void *a, const void *b)
+{
+	double d1 = *(const double *)a;
+	double d2 = *(const double *)b;
+	return ((d1 > d2) - (d1 < d2));
+}
+
+/**
+ * @brief Gets the percentile @p p of the sorted array @p v.
+ *
+ * @param v Sorted array.
+ * @param n Array size.
+ * @param p Percentile, between 0 and 1.
+ *
+ * @return Returns the percentile value.
+ */
+static double percentile(const double *v, int n, double p)
+{
+	if (n <= 0)
+		return (0.0);
+	return (v[(int)(p * (n - 1) + 0.5)]);
+}
+
+/**
+ * @brief Analyzes the recorded frames and dumps the results
+ * as a JSON object into @p f.
+ *
+ * @param f Output file.
+ * @param file Input file.
+ * @param tolerance_ms Max p99 error allowed (in ms).
+ *
+ * @return Returns 0 if the pacing is within the tolerance
+ * and no frame was missed or duplicated, -1 otherwise.
+ */
+int pacing_report(FILE *f, const char *file, double tolerance_ms)
+{
+	int i, j;
+	int pass;
+	int seams;
+	int late;
+	int missed;
+	int duplicated;
+	int seam_settle;
+	int resume_settle;
+	double d;
+	double period;
+	double offset;
+	double loop_offset;
+	double upts, upts0;
+	double ideal_delta;
+	double seam_max;
+	double resume_max;
+	double *err, *abs_err, *jitter;
+
+	err = calloc(nsamples + 1, sizeof(double) * 3);
+	if (!err)
+	{
+		LOG("Unable to allocate pacing buffers!\n");
+		return (-1);
+	}
+	abs_err = err + nsamples + 1;
+	jitter  = abs_err + nsamples + 1;
+
+	/* Nominal frame period: smallest pts step seen. */
+	for (i = 1, period = 0.0; i < nsamples; i++)
+	{
+		d = samples[i].pts - samples[i - 1].pts;
+		if (d > 0 && (period == 0.0 || d < period))
+			period = d;
+	}
+	if (period == 0.0)
+		period = 0.04;
+
+	seams      = 0;
+	late       = 0;
+	missed     = 0;
+	duplicated = 0;
+	seam_max   = 0.0;
+	resume_max = 0.0;
+	loop_offset = 0.0;
+	upts0 = nsamples ? samples[0].pts : 0.0;
+
+	for (i = 0; i < nsamples; i++)
+	{
+		ideal_delta = period;
+
+		if (i)
+		{
+			d = samples[i].pts - samples[i - 1].pts;
+
+			/*
+			 * Loop seam: the pts went back, the player keeps the
+			 * last frame delay, so do we.
+			 */
+			if (d < -period / 2)
+			{
+				loop_offset += samples[i - 1].pts - samples[i].pts + period;
+				seams++;
+			}
+			else if (d < period / 2)
+				duplicated++;
+			else
+			{
+				missed += (int)(d / period + 0.5) - 1;
+				ideal_delta = d;
+			}
+
+			/* Interval error, excluding the time paused between them. */
+			jitter[i - 1] = fabs((samples[i].present - samples[i - 1].present) -
+				(paused_before(samples[i].present) -
+				 paused_before(samples[i - 1].present)) - ideal_delta) * 1000.0;
+		}
+
+		upts = samples[i].pts + loop_offset;
+		err[i] = (samples[i].present - samples[0].present) -
+			(upts - upts0) - paused_before(samples[i].present);
+	}
+
+	/*
+	 * The absolute start latency is irrelevant: remove the
+	 * median error, so a constant offset does not count.
+	 */
+	for (i = 0; i < nsamples; i++)
+		abs_err[i] = err[i];
+	qsort(abs_err, nsamples, sizeof(double), cmp_double);
+	offset = percentile(abs_err, nsamples, 0.5);
+
+	/* Worst error in the first frames after each seam/resume. */
+	seam_settle = 0;
+	resume_settle = 0;
+	for (i = 0, j = 0; i < nsamples; i++)
+	{
+		err[i] = fabs(err[i] - offset) * 1000.0;
+		abs_err[i] = err[i];
+
+		if (err[i] > period * 500.0)
+			late++;
+
+		if (i && samples[i].pts - samples[i - 1].pts < -period / 2)
+			seam_settle = PACING_SETTLE_FRAMES;
+
+		for (; j < npauses && pauses[j].end >= 0 &&
+			pauses[j].end <= samples[i].present; j++)
+		{
+			resume_settle = PACING_SETTLE_FRAMES;
+		}
+
+		if (seam_settle)
+		{
+			seam_max = fmax(seam_max, err[i]);
+			seam_settle--;
+		}
+		if (resume_settle)
+		{
+			resume_max = fmax(resume_max, err[i]);
+			resume_settle--;
+		}
+	}
+
+	qsort(abs_err, nsamples, sizeof(double), cmp_double);
+	qsort(jitter, nsamples > 1 ? nsamples - 1 : 0, sizeof(double),
+		cmp_double);
+
+	pass = !overflow && nsamples > 1 && !missed && !duplicated &&
+		percentile(abs_err, nsamples, 0.99) <= tolerance_ms;
+
+	fprintf(f, "{\n  \"file\": ");
+	json_str(f, file);
+	fprintf(f,
+		",\n"
+		"  \"duration_s\": %.3f,\n"
+		"  \"frames\": %d,\n"
+		"  \"period_ms\": %.3f,\n"
+		"  \"error_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+		"\"max\": %.3f},\n"
+		"  \"jitter_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n"
+		"  \"late\": %d,\n"
+		"  \"missed\": %d,\n"
+		"  \"duplicated\": %d,\n"
+		"  \"frames_dropped\": %lu,\n"
+		"  \"frames_skipped\": %lu,\n"
+		"  \"seams\": %d,\n"
+		"  \"seam_max_error_ms\": %.3f,\n"
+		"  \"pauses\": %d,\n"
+		"  \"resume_max_error_ms\": %.3f,\n"
+		"  \"tolerance_ms\": %.3f,\n"
+		"  \"pass\": %s\n"
+		"}\n",
+		duration_secs, nsamples, period * 1000.0,
+		percentile(abs_err, nsamples, 0.5),
+		percentile(abs_err, nsamples, 0.9),
+		percentile(abs_err, nsamples, 0.99),
+		nsamples ? abs_err[nsamples - 1] : 0.0,
+		percentile(jitter, nsamples - 1, 0.5),
+		percentile(jitter, nsamples - 1, 0.99),
+		nsamples > 1 ? jitter[nsamples - 2] : 0.0,
+		late, missed, duplicated, stats.frames_dropped,
+		stats.frames_skipped, seams, seam_max, npauses, resume_max,
+		tolerance_ms, pass ? "true" : "false");
+
+	free(err);
+	free(samples);
+	samples = NULL;
+	max_samples = nsamples = 0;
+	return (pass ? 0 : -1);
+}
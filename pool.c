@@ -0,0 +1,560 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "anipaper.h"
+
+/*
+ * Work-stealing task pool.
+ *
+ * Each worker owns a deque per priority: tasks submitted from a
+ * worker go to its own deques (and are popped LIFO, while the
+ * data is still hot in its caches), tasks submitted from other
+ * threads are spread over the workers. An idle worker steals
+ * from the other end (FIFO) of the other workers' deques, so no
+ * core sits idle while there is work queued anywhere.
+ *
+ * Higher priority tasks always go first: POOL_PRIO_FRAME is for
+ * the frames about to be presented (the thread that submits
+ * them also helps running them, and waits for all), and
+ * POOL_PRIO_BACKGROUND for everything that has no deadline
+ * (e.g: exports). Frame tasks carry the pts of their frame as
+ * deadline: their deques are kept sorted by it, and workers
+ * always take the earliest one queued anywhere.
+ *
+ * Without a running pool, the tasks run right away, in the
+ * calling thread.
+ */
+
+/* Largest pool. */
+#define POOL_MAX_THREADS 64
+
+/* Tasks per deque. */
+#define POOL_DEQUE_SIZE 256
+
+/* Batch of tasks (pool_run()), waited for by the submitter. */
+struct pool_batch
+{
+	int remaining;
+};
+
+/* Task. */
+struct pool_task
+{
+	void (*fn)(void *arg, int job);
+	void *arg;
+	int job;
+	double deadline;
+	struct pool_batch *batch;
+};
+
+/* Deque (ring buffer): top is the oldest task, bottom the newest. */
+struct pool_deque
+{
+	struct pool_task tasks[POOL_DEQUE_SIZE];
+	int top;
+	int count;
+};
+
+/* Worker. */
+struct pool_worker
+{
+	SDL_Thread *thread;
+	SDL_mutex *mutex;
+	struct pool_deque deques[POOL_PRIO_NR];
+	int index;
+};
+
+static struct pool_worker workers[POOL_MAX_THREADS];
+static int nworkers;
+static int next_worker;
+static SDL_TLSID worker_tls;
+
+/*
+ * Queued tasks, end flag, batches, next worker and stats,
+ * protected by pool_mutex.
+ */
+static int pending;
+static int pool_end;
+static SDL_mutex *pool_mutex;
+static SDL_cond *pool_cond;
+static SDL_cond *done_cond;
+
+/**
+ * @brief Gets the index of the worker running the caller.
+ *
+ * @return Returns the worker index, or -1 if the caller is
+ * not a worker.
+ */
+int pool_worker(void)
+{
+	struct pool_worker *w;
+
+	if (!nworkers)
+		return (-1);
+
+	w = SDL_TLSGet(worker_tls);
+	return (w ? w->index : -1);
+}
+
+/**
+ * @brief Gets the amount of workers.
+ *
+ * @return Returns the amount of workers, 0 if the pool is
+ * not running.
+ */
+int pool_size(void)
+{
+	return (nworkers);
+}
+
+/**
+ * @brief Pushes the task @p t into the bottom of the deque
+ * @p prio of the worker @p w, or in deadline order if a frame
+ * task.
+ *
+ * @param w Worker.
+ * @param prio Priority (POOL_PRIO_*).
+ * @param t Task.
+ *
+ * @return Returns 0 if success, -1 if the deque is full.
+ */
+static int push_task(struct pool_worker *w, int prio, struct pool_task *t)
+{
+	struct pool_deque *d;
+	int i;
+
+	d = &w->deques[prio];
+	SDL_LockMutex(w->mutex);
+		if (d->count == POOL_DEQUE_SIZE)
+		{
+			SDL_UnlockMutex(w->mutex);
+			return (-1);
+		}
+
+		/* Later deadlines move down, equal ones keep their order. */
+		for (i = d->count; prio == POOL_PRIO_FRAME && i > 0; i--)
+		{
+			if (d->tasks[(d->top + i - 1) % POOL_DEQUE_SIZE].deadline <=
+				t->deadline)
+			{
+				break;
+			}
+			d->tasks[(d->top + i) % POOL_DEQUE_SIZE] =
+				d->tasks[(d->top + i - 1) % POOL_DEQUE_SIZE];
+		}
+		d->tasks[(d->top + i) % POOL_DEQUE_SIZE] = *t;
+		d->count++;
+	SDL_UnlockMutex(w->mutex);
+
+	SDL_LockMutex(pool_mutex);
+		pending++;
+		SDL_CondSignal(pool_cond);
+	SDL_UnlockMutex(pool_mutex);
+	return (0);
+}
+
+/**
+ * @brief Pops a task from the deque @p prio of the worker
+ * @p w: the newest one if the owner, the oldest one if
+ * stealing, and always the earliest deadline if a frame task.
+ *
+ * @param w Worker.
+ * @param prio Priority (POOL_PRIO_*).
+ * @param steal Non-zero if stealing.
+ * @param t Output task.
+ *
+ * @return Returns 1 if a task was taken, 0 otherwise.
+ */
+static int pop_task(struct pool_worker *w, int prio, int steal,
+	struct pool_task *t)
+{
+	struct pool_deque *d;
+
+	d = &w->deques[prio];
+	SDL_LockMutex(w->mutex);
+		if (!d->count)
+		{
+			SDL_UnlockMutex(w->mutex);
+			return (0);
+		}
+
+		if (steal || prio == POOL_PRIO_FRAME)
+		{
+			*t = d->tasks[d->top];
+			d->top = (d->top + 1) % POOL_DEQUE_SIZE;
+		}
+		else
+			*t = d->tasks[(d->top + d->count - 1) % POOL_DEQUE_SIZE];
+		d->count--;
+	SDL_UnlockMutex(w->mutex);
+
+	SDL_LockMutex(pool_mutex);
+		pending--;
+		if (steal)
+			stats.pool_steals++;
+	SDL_UnlockMutex(pool_mutex);
+	return (1);
+}
+
+/**
+ * @brief Takes the frame task with the earliest deadline
+ * queued in any worker, the own one first if tied.
+ *
+ * @param self Worker index, or -1.
+ * @param t Output task.
+ *
+ * @return Returns 1 if a task was taken, 0 otherwise.
+ */
+static int take_earliest(int self, struct pool_task *t)
+{
+	struct pool_deque *d;
+	double best;
+	int victim;
+	int i;
+
+	best = 0;
+	do
+	{
+		victim = -1;
+		for (i = 0; i < nworkers; i++)
+		{
+			d = &workers[i].deques[POOL_PRIO_FRAME];
+			SDL_LockMutex(workers[i].mutex);
+				if (d->count && (victim < 0 ||
+					d->tasks[d->top].deadline < best ||
+					(d->tasks[d->top].deadline == best && i == self)))
+				{
+					victim = i;
+					best = d->tasks[d->top].deadline;
+				}
+			SDL_UnlockMutex(workers[i].mutex);
+		}
+
+		if (victim < 0)
+			return (0);
+
+	/* Taken by someone else meanwhile: look again. */
+	} while (!pop_task(&workers[victim], POOL_PRIO_FRAME, victim != self, t));
+
+	return (1);
+}
+
+/**
+ * @brief Takes the next task for the worker @p self (or for
+ * a non-worker, if -1): by priority, own deques first, then
+ * the others'.
+ *
+ * @param self Worker index, or -1.
+ * @param lowest Lowest priority taken.
+ * @param t Output task.
+ *
+ * @return Returns 1 if a task was taken, 0 otherwise.
+ */
+static int take_task(int self, int lowest, struct pool_task *t)
+{
+	int prio;
+	int i;
+	int v;
+
+	for (prio = 0; prio <= lowest; prio++)
+	{
+		if (prio == POOL_PRIO_FRAME)
+		{
+			if (take_earliest(self, t))
+				return (1);
+			continue;
+		}
+
+		if (self >= 0 && pop_task(&workers[self], prio, 0, t))
+			return (1);
+
+		for (i = 1; i <= nworkers; i++)
+		{
+			v = (self + i + nworkers) % nworkers;
+			if (v != self && pop_task(&workers[v], prio, 1, t))
+				return (1);
+		}
+	}
+	return (0);
+}
+
+/**
+ * @brief Runs the task @p t and, if part of a batch, signals
+ * its submitter once the batch is over.
+ *
+ * @param t Task.
+ */
+static void run_task(struct pool_task *t)
+{
+	t->fn(t->arg, t->job);
+
+	SDL_LockMutex(pool_mutex);
+		stats.pool_tasks++;
+		if (t->batch && !--t->batch->remaining)
+			SDL_CondBroadcast(done_cond);
+	SDL_UnlockMutex(pool_mutex);
+}
+
+/**
+ * @brief Gets the worker to queue a task submitted by the
+ * caller into: its own one if a worker, the next one in turn
+ * otherwise.
+ *
+ * @return Returns the worker.
+ */
+static struct pool_worker *target_worker(void)
+{
+	int self;
+	int i;
+
+	self = pool_worker();
+	if (self >= 0)
+		return (&workers[self]);
+
+	SDL_LockMutex(pool_mutex);
+		i = next_worker;
+		next_worker = (next_worker + 1) % nworkers;
+	SDL_UnlockMutex(pool_mutex);
+	return (&workers[i]);
+}
+
+/**
+ * @brief Worker thread: runs (or steals) tasks until the
+ * pool ends.
+ *
+ * @param arg Worker structure.
+ *
+ * @return Always returns 0.
+ */
+static int pool_worker_thread(void *arg)
+{
+	struct pool_worker *w;
+	struct pool_task t;
+
+	w = (struct pool_worker *)arg;
+	SDL_TLSSet(worker_tls, w, NULL);
+
+	while (1)
+	{
+		if (take_task(w->index, POOL_PRIO_NR - 1, &t))
+		{
+			run_task(&t);
+			continue;
+		}
+
+		SDL_LockMutex(pool_mutex);
+			while (!pending && !pool_end)
+				SDL_CondWait(pool_cond, pool_mutex);
+
+			if (!pending && pool_end)
+			{
+				SDL_UnlockMutex(pool_mutex);
+				break;
+			}
+		SDL_UnlockMutex(pool_mutex);
+	}
+	return (0);
+}
+
+/**
+ * @brief Starts the pool with @p threads workers.
+ *
+ * @param threads Number of workers (0 for the number of CPUs).
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+int pool_init(int threads)
+{
+	int i;
+
+	if (threads <= 0)
+		threads = SDL_GetCPUCount();
+	threads = FFMIN(FFMAX(threads, 1), POOL_MAX_THREADS);
+
+	worker_tls = SDL_TLSCreate();
+	pool_mutex = SDL_CreateMutex();
+	pool_cond  = SDL_CreateCond();
+	done_cond  = SDL_CreateCond();
+	if (!worker_tls || !pool_mutex || !pool_cond || !done_cond)
+		LOG_GOTO("Unable to create the task pool locks!\n", out);
+
+	pending = 0;
+	pool_end = 0;
+	next_worker = 0;
+
+	/* All the deques exist before any worker looks for tasks. */
+	for (i = 0; i < threads; i++)
+	{
+		workers[i].index = i;
+		workers[i].mutex = SDL_CreateMutex();
+		if (!workers[i].mutex)
+			LOG_GOTO("Unable to create the task pool locks!\n", out1);
+	}
+	nworkers = threads;
+
+	for (i = 0; i < threads; i++)
+	{
+		workers[i].thread = SDL_CreateThread(pool_worker_thread, "pool",
+			&workers[i]);
+		if (!workers[i].thread)
+		{
+			pool_finish();
+			LOG_GOTO("Unable to create the task pool threads!\n", out0);
+		}
+	}
+
+	stats.pool_threads = nworkers;
+	LOG("pool: %d threads\n", nworkers);
+	return (0);
+out1:
+	while (i--)
+	{
+		SDL_DestroyMutex(workers[i].mutex);
+		workers[i].mutex = NULL;
+	}
+out:
+	if (done_cond)
+		SDL_DestroyCond(done_cond);
+	if (pool_cond)
+		SDL_DestroyCond(pool_cond);
+	if (pool_mutex)
+		SDL_DestroyMutex(pool_mutex);
+	done_cond = pool_cond = NULL;
+	pool_mutex = NULL;
+out0:
+	return (-1);
+}
+
+/**
+ * @brief Runs the tasks still queued and stops the pool,
+ * if running.
+ */
+void pool_finish(void)
+{
+	int i;
+
+	if (!pool_mutex)
+		return;
+
+	SDL_LockMutex(pool_mutex);
+		pool_end = 1;
+		SDL_CondBroadcast(pool_cond);
+	SDL_UnlockMutex(pool_mutex);
+
+	/* Workers may still steal from the others until all are done. */
+	for (i = 0; i < nworkers; i++)
+	{
+		SDL_WaitThread(workers[i].thread, NULL);
+		workers[i].thread = NULL;
+	}
+	for (i = 0; i < nworkers; i++)
+	{
+		SDL_DestroyMutex(workers[i].mutex);
+		workers[i].mutex = NULL;
+	}
+	nworkers = 0;
+
+	SDL_DestroyCond(done_cond);
+	SDL_DestroyCond(pool_cond);
+	SDL_DestroyMutex(pool_mutex);
+	done_cond = pool_cond = NULL;
+	pool_mutex = NULL;
+}
+
+/**
+ * @brief Submits the task @p fn(@p arg, 0) with priority
+ * @p prio, without waiting for it.
+ *
+ * If the pool is not running (or is full), the task runs
+ * right away, in the calling thread.
+ *
+ * @param fn Task routine.
+ * @param arg Task argument.
+ * @param prio Priority (POOL_PRIO_*).
+ */
+void pool_submit(void (*fn)(void *arg, int job), void *arg, int prio)
+{
+	struct pool_task t = {fn, arg, 0, 0, NULL};
+
+	if (!nworkers || push_task(target_worker(), prio, &t) < 0)
+		fn(arg, 0);
+}
+
+/**
+ * @brief Runs the jobs @p fn(@p arg, 0...@p njobs - 1) in
+ * parallel, with the highest priority, and waits for all of
+ * them: the calling thread runs jobs as well, meanwhile.
+ *
+ * @param fn Job routine.
+ * @param arg Job argument.
+ * @param njobs Amount of jobs.
+ * @param deadline Pts (in seconds) of the frame the jobs are
+ * for: the earliest ones run first.
+ */
+void pool_run(void (*fn)(void *arg, int job), void *arg, int njobs,
+	double deadline)
+{
+	struct pool_batch batch;
+	struct pool_task t;
+	int self;
+	int i;
+
+	if (!nworkers)
+	{
+		for (i = 0; i < njobs; i++)
+			fn(arg, i);
+		return;
+	}
+
+	self = pool_worker();
+	batch.remaining = njobs;
+
+	/* Job 0 is for the caller, the others for anyone. */
+	for (i = 1; i < njobs; i++)
+	{
+		t = (struct pool_task){fn, arg, i, deadline, &batch};
+		if (push_task(target_worker(), POOL_PRIO_FRAME, &t) < 0)
+			run_task(&t);
+	}
+
+	t = (struct pool_task){fn, arg, 0, deadline, &batch};
+	run_task(&t);
+
+	/* Help with the frame tasks, then wait for the rest. */
+	while (take_task(self, POOL_PRIO_FRAME, &t))
+		run_task(&t);
+
+	SDL_LockMutex(pool_mutex);
+		while (batch.remaining)
+			SDL_CondWait(done_cond, pool_mutex);
+	SDL_UnlockMutex(pool_mutex);
+}
@@ -0,0 +1,378 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "anipaper.h"
+#include "queue.h"
+
+/*
+ * Power source monitoring.
+ *
+ * The power source is read from <sysfs>/class/power_supply/,
+ * whenever the kernel reports a power_supply uevent (netlink)
+ * or, as a fallback, at a fixed interval. If the sysfs root
+ * is overridden (ANIPAPER_SYSFS_ROOT, e.g: a fake tree for
+ * testing), only the fallback is used, and more often.
+ */
+
+/* Fallback checks interval (ms), with and without uevents. */
+#define POWER_CHECK_MS      30000
+#define POWER_FAKE_CHECK_MS  1000
+
+/* Monitor state. */
+static char sysfs_root[512] = "/sys";
+static int uevent_fd = -1;
+static int wake_pipe[2] = {-1, -1};
+static int check_ms;
+static int on_battery = -1;
+static SDL_Thread *power_thread;
+static void (*power_changed)(int battery, void *data);
+static void *power_data;
+
+/**
+ * @brief Reads the first line of the file @p dir/@p name
+ * into @p buf, without the new line.
+ *
+ * @param dir Directory.
+ * @param name File name.
+ * @param buf Output buffer.
+ * @param size Buffer size.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int read_attr(const char *dir, const char *name, char *buf,
+	size_t size)
+{
+	FILE *f;
+	char path[1024];
+
+	/* Truncated path: no such attribute. */
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path))
+		return (-1);
+
+	f = fopen(path, "r");
+	if (!f)
+		return (-1);
+
+	if (!fgets(buf, size, f))
+	{
+		fclose(f);
+		return (-1);
+	}
+	fclose(f);
+
+	buf[strcspn(buf, "\n")] = '\0';
+	return (0);
+}
+
+/**
+ * @brief Checks if the machine is running on battery: no
+ * AC adapter online and a (system) battery discharging.
+ *
+ * Desktops, without any power supply, are always on AC.
+ *
+ * @return Returns 1 if on battery, 0 otherwise.
+ */
+int power_on_battery(void)
+{
+	DIR *d;
+	struct dirent *ent;
+	char dir[1024];
+	char path[1024];
+	char type[32];
+	char value[32];
+	int ac_online;
+	int discharging;
+
+	snprintf(dir, sizeof(dir), "%s/class/power_supply", sysfs_root);
+	d = opendir(dir);
+	if (!d)
+		return (0);
+
+	ac_online = 0;
+	discharging = 0;
+
+	while ((ent = readdir(d)) != NULL)
+	{
+		if (ent->d_name[0] == '.')
+			continue;
+
+		if (snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name) >=
+			(int)sizeof(path))
+		{
+			continue;
+		}
+		if (read_attr(path, "type", type, sizeof(type)) < 0)
+			continue;
+
+		/* Mice, keyboards and so on also have batteries. */
+		if (!read_attr(path, "scope", value, sizeof(value)) &&
+			!strcmp(value, "Device"))
+		{
+			continue;
+		}
+
+		if (!strcmp(type, "Battery"))
+		{
+			if (!read_attr(path, "status", value, sizeof(value)) &&
+				!strcmp(value, "Discharging"))
+			{
+				discharging = 1;
+			}
+		}
+
+		/* Mains, USB, USB_C, USB_PD... */
+		else if (!read_attr(path, "online", value, sizeof(value)) &&
+			atoi(value) > 0)
+		{
+			ac_online = 1;
+		}
+	}
+	closedir(d);
+
+	return (!ac_online && discharging);
+}
+
+/**
+ * @brief Re-reads the power source and notifies if it
+ * has changed.
+ */
+static void power_check(void)
+{
+	int battery;
+
+	battery = power_on_battery();
+	if (battery == on_battery)
+		return;
+
+	on_battery = battery;
+	power_changed(battery, power_data);
+}
+
+/**
+ * @brief Power monitor thread: waits for power_supply uevents
+ * (or the fallback interval) and checks the power source.
+ *
+ * @param arg Unused.
+ *
+ * @return Always returns 0.
+ */
+static int power_monitor_thread(void *arg)
+{
+	char buf[4096];
+	char *p;
+	struct pollfd fds[2];
+	ssize_t len;
+	int nfds;
+	int ret;
+
+	((void)arg);
+
+	/* Nothing here is time critical. */
+	sched_timer_slack(BG_TIMER_SLACK_NS);
+
+	fds[0].fd = wake_pipe[0];
+	fds[0].events = POLLIN;
+	fds[1].fd = uevent_fd;
+	fds[1].events = POLLIN;
+	nfds = (uevent_fd >= 0) ? 2 : 1;
+
+	while (!should_quit)
+	{
+		ret = poll(fds, nfds, check_ms);
+		stats.wakeups++;
+		if (ret < 0)
+			continue;
+
+		/* Asked to stop. */
+		if (fds[0].revents & POLLIN)
+			break;
+
+		/*
+		 * Uevent: a list of NUL-terminated KEY=value strings,
+		 * only power_supply ones matter.
+		 */
+		if (nfds == 2 && (fds[1].revents & POLLIN))
+		{
+			len = recv(uevent_fd, buf, sizeof(buf) - 1, 0);
+			if (len <= 0)
+				continue;
+			buf[len] = '\0';
+
+			for (p = buf; p < buf + len; p += strlen(p) + 1)
+				if (!strcmp(p, "SUBSYSTEM=power_supply"))
+					break;
+			if (p >= buf + len)
+				continue;
+		}
+
+		power_check();
+	}
+
+	return (0);
+}
+
+/**
+ * @brief Starts monitoring the power source: @p changed is
+ * invoked right away with the current source and again
+ * (from another thread) every time it changes.
+ *
+ * @param changed Callback, receives 1 if on battery, 0
+ * if on AC.
+ * @param data Callback data.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+int power_start(void (*changed)(int battery, void *data), void *data)
+{
+	struct sockaddr_nl addr = {0};
+	const char *root;
+
+	power_changed = changed;
+	power_data = data;
+	check_ms = POWER_CHECK_MS;
+
+	root = getenv("ANIPAPER_SYSFS_ROOT");
+	if (root && *root)
+	{
+		snprintf(sysfs_root, sizeof(sysfs_root), "%s", root);
+		check_ms = POWER_FAKE_CHECK_MS;
+	}
+
+	/* Kernel uevents, no big deal if not available (containers...). */
+	else
+	{
+		uevent_fd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+		addr.nl_family = AF_NETLINK;
+		addr.nl_groups = 1;
+		if (uevent_fd >= 0 &&
+			bind(uevent_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+			close(uevent_fd);
+			uevent_fd = -1;
+		}
+		if (uevent_fd < 0)
+			LOG("power: uevents not available, checking every %ds\n",
+				check_ms / 1000);
+	}
+
+	if (pipe(wake_pipe) < 0)
+		LOG_GOTO("Unable to create the power monitor pipe!\n", out0);
+
+	/* Current profile. */
+	power_check();
+
+	power_thread = SDL_CreateThread(power_monitor_thread, "power", NULL);
+	if (!power_thread)
+		LOG_GOTO("Unable to create the power monitor thread!\n", out1);
+
+	return (0);
+out1:
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	wake_pipe[0] = wake_pipe[1] = -1;
+out0:
+	if (uevent_fd >= 0)
+		close(uevent_fd);
+	uevent_fd = -1;
+	return (-1);
+}
+
+/**
+ * @brief Stops the power monitor, if running.
+ */
+void power_stop(void)
+{
+	if (!power_thread)
+		return;
+
+	if (write(wake_pipe[1], "q", 1) < 0)
+		LOG("Unable to wake up the power monitor!\n");
+	SDL_WaitThread(power_thread, NULL);
+	power_thread = NULL;
+
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	wake_pipe[0] = wake_pipe[1] = -1;
+	if (uevent_fd >= 0)
+		close(uevent_fd);
+	uevent_fd = -1;
+}
+
+/**
+ * @brief Parses a performance profile in the format
+ * key=value[,key=value...] into @p p. The keys are:
+ * fps (FPS cap, 0 for none), threads (decoding threads,
+ * 0 for auto), quality (quality ladder floor, 0 for full
+ * quality) and occlusion (occlusion threshold, in %).
+ *
+ * Missing keys keep the current value.
+ *
+ * @param spec Profile string.
+ * @param p Profile to be filled.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+int profile_parse(const char *spec, struct perf_profile *p)
+{
+	char key[16];
+	double value;
+	int n;
+
+	while (*spec)
+	{
+		if (sscanf(spec, "%15[a-z]=%lf%n", key, &value, &n) != 2 || value < 0)
+			return (-1);
+
+		if (!strcmp(key, "fps"))
+			p->fps_cap = value;
+		else if (!strcmp(key, "threads"))
+			p->threads = (int)value;
+		else if (!strcmp(key, "quality") && value <= QUALITY_MAX)
+			p->quality = (int)value;
+		else if (!strcmp(key, "occlusion") && value <= 100)
+			p->occlusion = (int)value;
+		else
+			return (-1);
+
+		spec += n;
+		if (*spec == ',')
+			spec++;
+		else if (*spec)
+			return (-1);
+	}
+	return (0);
+}
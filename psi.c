@@ -0,0 +1,356 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "anipaper.h"
+#include "queue.h"
+
+/*
+ * CPU/IO pressure monitoring (PSI).
+ *
+ * A PSI trigger is registered on /proc/pressure/{cpu,io}: the
+ * kernel wakes us up (POLLPRI) only when the tasks were stalled
+ * for more than a threshold within a time window, so nothing
+ * is read while the machine is idle.
+ *
+ * Each event raises the throttle level (at most once per
+ * window), and each calm period without events lowers it by
+ * one: backing off is fast, recovering is slow.
+ *
+ * If triggers are not allowed (older kernels only allow them
+ * for privileged users) or the proc root is overridden
+ * (ANIPAPER_PROC_ROOT, e.g: a fake tree for testing), the
+ * avg10 of each file is read once per window instead.
+ */
+
+/* Trigger window (us), unprivileged triggers need 2s multiples. */
+#define PSI_WINDOW_US 2000000
+
+/* Stall (us) within a window that counts as pressure. */
+#define PSI_CPU_STALL_US 300000 /* 15%. */
+#define PSI_IO_STALL_US  200000 /* 10%. */
+
+/* Time without pressure to lower the throttle level (ms). */
+#define PSI_CALM_MS 10000
+
+/* Pressure source. */
+struct psi_source
+{
+	const char *name;
+	int stall_us;
+	int fd;      /* Trigger fd, -1 if none.   */
+	int polled;  /* Read periodically instead. */
+	char path[512];
+};
+
+static struct psi_source sources[] = {
+	{"cpu", PSI_CPU_STALL_US, -1, 0, {0}},
+	{"io",  PSI_IO_STALL_US,  -1, 0, {0}}
+};
+#define PSI_NR_SOURCES ((int)(sizeof(sources) / sizeof(sources[0])))
+
+/* Monitor state. */
+static int wake_pipe[2] = {-1, -1};
+static int throttle_level;
+static SDL_Thread *psi_thread;
+static void (*psi_changed)(int level, void *data);
+static void *psi_data;
+
+/**
+ * @brief Reads the 'some' avg10 (in %) of the pressure
+ * file @p path.
+ *
+ * @param path Pressure file.
+ *
+ * @return Returns the avg10, or -1 if error.
+ */
+static double read_avg10(const char *path)
+{
+	FILE *f;
+	double avg10;
+
+	f = fopen(path, "r");
+	if (!f)
+		return (-1.0);
+
+	if (fscanf(f, "some avg10=%lf", &avg10) != 1)
+		avg10 = -1.0;
+
+	fclose(f);
+	return (avg10);
+}
+
+/**
+ * @brief Sets up the pressure source @p src: registers a
+ * trigger if possible, otherwise falls back to reading it
+ * periodically.
+ *
+ * @param src Pressure source.
+ * @param trigger Non-zero to try a trigger.
+ *
+ * @return Returns 0 if success, -1 if the source is not
+ * available.
+ */
+static int psi_open(struct psi_source *src, int trigger)
+{
+	char buf[64];
+
+	if (trigger)
+	{
+		snprintf(buf, sizeof(buf), "some %d %d", src->stall_us,
+			PSI_WINDOW_US);
+
+		src->fd = open(src->path, O_RDWR | O_NONBLOCK);
+		if (src->fd >= 0 && write(src->fd, buf, strlen(buf) + 1) >= 0)
+			return (0);
+
+		if (src->fd >= 0)
+			close(src->fd);
+		src->fd = -1;
+	}
+
+	if (read_avg10(src->path) < 0)
+		return (-1);
+
+	src->polled = 1;
+	return (0);
+}
+
+/**
+ * @brief Changes the throttle level to @p level and
+ * notifies.
+ *
+ * @param level New throttle level.
+ */
+static void psi_set_level(int level)
+{
+	throttle_level = level;
+	psi_changed(level, psi_data);
+}
+
+/**
+ * @brief PSI monitor thread: waits for pressure events (or
+ * reads the pressure periodically) and updates the throttle
+ * level.
+ *
+ * @param arg Unused.
+ *
+ * @return Always returns 0.
+ */
+static int psi_monitor_thread(void *arg)
+{
+	struct pollfd fds[PSI_NR_SOURCES + 1];
+	double last_pressure;
+	double last_change;
+	double now;
+	int pressure;
+	int polled;
+	int timeout;
+	int i;
+
+	((void)arg);
+
+	/* Nothing here is time critical. */
+	sched_timer_slack(BG_TIMER_SLACK_NS);
+
+	fds[0].fd = wake_pipe[0];
+	fds[0].events = POLLIN;
+
+	for (i = 0, polled = 0; i < PSI_NR_SOURCES; i++)
+	{
+		fds[i + 1].fd = sources[i].fd;
+		fds[i + 1].events = POLLPRI;
+		polled |= sources[i].polled;
+	}
+
+	last_pressure = last_change = time_secs();
+
+	while (!should_quit)
+	{
+		/* Nothing to wait for, except the pressure. */
+		if (polled)
+			timeout = PSI_WINDOW_US / 1000;
+		else if (throttle_level > THROTTLE_NONE)
+			timeout = PSI_CALM_MS / 2;
+		else
+			timeout = -1;
+
+		if (poll(fds, PSI_NR_SOURCES + 1, timeout) < 0)
+			continue;
+		stats.wakeups++;
+
+		/* Asked to stop. */
+		if (fds[0].revents & POLLIN)
+			break;
+
+		now = time_secs();
+		pressure = 0;
+
+		for (i = 0; i < PSI_NR_SOURCES; i++)
+		{
+			if (fds[i + 1].revents & POLLPRI)
+				pressure = 1;
+
+			/* Trigger gone, poll() ignores negative fds. */
+			else if (fds[i + 1].revents & (POLLERR|POLLNVAL))
+			{
+				LOG("psi: %s trigger lost!\n", sources[i].name);
+				fds[i + 1].fd = -1;
+			}
+
+			if (sources[i].polled && read_avg10(sources[i].path) >
+				sources[i].stall_us * 100.0 / PSI_WINDOW_US)
+			{
+				pressure = 1;
+			}
+		}
+
+		/* Back off, a level per window. */
+		if (pressure)
+		{
+			last_pressure = now;
+			if (throttle_level < THROTTLE_PAUSED &&
+				(now - last_change) * 1000000.0 >= PSI_WINDOW_US)
+			{
+				last_change = now;
+				psi_set_level(throttle_level + 1);
+			}
+		}
+
+		/* Recover, a level per calm period. */
+		else if (throttle_level > THROTTLE_NONE &&
+			(now - last_pressure) * 1000.0 >= PSI_CALM_MS &&
+			(now - last_change) * 1000.0 >= PSI_CALM_MS)
+		{
+			last_change = now;
+			psi_set_level(throttle_level - 1);
+		}
+	}
+
+	return (0);
+}
+
+/**
+ * @brief Starts monitoring the CPU and IO pressure: @p changed
+ * is invoked (from another thread) every time the throttle
+ * level changes.
+ *
+ * @param changed Callback, receives the new throttle level
+ * (THROTTLE_*).
+ * @param data Callback data.
+ *
+ * @return Returns 0 if success, -1 otherwise (e.g: PSI not
+ * available).
+ */
+int psi_start(void (*changed)(int level, void *data), void *data)
+{
+	const char *root;
+	int available;
+	int i;
+
+	psi_changed = changed;
+	psi_data = data;
+	throttle_level = THROTTLE_NONE;
+
+	root = getenv("ANIPAPER_PROC_ROOT");
+	if (!root || !*root)
+		root = NULL;
+
+	for (i = 0, available = 0; i < PSI_NR_SOURCES; i++)
+	{
+		snprintf(sources[i].path, sizeof(sources[i].path),
+			"%s/pressure/%s", root ? root : "/proc", sources[i].name);
+
+		if (psi_open(&sources[i], !root) < 0)
+			continue;
+
+		available++;
+		if (sources[i].polled)
+			LOG("psi: %s triggers not available, reading every %ds\n",
+				sources[i].name, PSI_WINDOW_US / 1000000);
+	}
+
+	if (!available)
+		LOG_GOTO("psi: pressure information not available!\n", out0);
+
+	if (pipe(wake_pipe) < 0)
+		LOG_GOTO("Unable to create the PSI monitor pipe!\n", out0);
+
+	psi_thread = SDL_CreateThread(psi_monitor_thread, "psi", NULL);
+	if (!psi_thread)
+		LOG_GOTO("Unable to create the PSI monitor thread!\n", out1);
+
+	return (0);
+out1:
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	wake_pipe[0] = wake_pipe[1] = -1;
+out0:
+	for (i = 0; i < PSI_NR_SOURCES; i++)
+	{
+		if (sources[i].fd >= 0)
+			close(sources[i].fd);
+		sources[i].fd = -1;
+		sources[i].polled = 0;
+	}
+	return (-1);
+}
+
+/**
+ * @brief Stops the PSI monitor, if running.
+ */
+void psi_stop(void)
+{
+	int i;
+
+	if (!psi_thread)
+		return;
+
+	if (write(wake_pipe[1], "q", 1) < 0)
+		LOG("Unable to wake up the PSI monitor!\n");
+	SDL_WaitThread(psi_thread, NULL);
+	psi_thread = NULL;
+
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	wake_pipe[0] = wake_pipe[1] = -1;
+
+	for (i = 0; i < PSI_NR_SOURCES; i++)
+	{
+		if (sources[i].fd >= 0)
+			close(sources[i].fd);
+		sources[i].fd = -1;
+		sources[i].polled = 0;
+	}
+}
@@ -0,0 +1,592 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <SDL.h>
+#include <libavcodec/avcodec.h>
+
+#include "queue.h"
+
+/* Logs. */
+#define LOG_GOTO(log,lbl) \
+	do { \
+		fprintf(stderr, "INFO: " log); \
+		goto lbl; \
+	} while (0)
+
+/**
+ * @brief Initialize the packet queue.
+ *
+ * @param q Packet queue.
+ * @param max Maximum amount of packets.
+ *
+ * @return Returns 0 if sucess, -1 otherwise.
+ */
+int init_packet_queue(struct packet_queue *q, int max)
+{
+	memset(q, 0, sizeof(*q));
+	q->max   = max;
+	q->mutex = SDL_CreateMutex();
+	q->cond  = SDL_CreateCond();
+	if (!q->mutex || !q->cond)
+		LOG_GOTO("Unable to create SDL mutexes/cond!\n", out);
+	return (0);
+out:
+	return (-1);
+}
+
+/**
+ * @brief Releases all resources related to the packet
+ * queue, including the elements itself.
+ *
+ * @param q Packet queue to be freed.
+ */
+void finish_packet_queue(struct packet_queue *q)
+{
+	struct packet_list *pkl;
+	struct packet_list *pkl_next;
+
+	if (!q)
+		return;
+	if (q->mutex)
+		SDL_DestroyMutex(q->mutex);
+	if (q->cond)
+		SDL_DestroyCond(q->cond);
+
+	/* Go through the queue and clear everything. */
+	pkl = q->first_packet;
+	while (pkl)
+	{
+		pkl_next = pkl->next;
+			av_packet_unref(&pkl->pkt);
+			av_free(pkl);
+		pkl = pkl_next;
+	}
+}
+
+/**
+ * @brief Add a new packet @p src_pkt to the queue.
+ *
+ * It is important to note that this routine is blocking and if
+ * there are no space left, the thread remains in blocking state
+ * until there are room available.
+ *
+ * The wait (and the packet) is given up if the program should
+ * quit or if the queue is aborted, as it is about to be flushed.
+ *
+ * @param q Packet queue.
+ * @param src_pkt Packet to be added.
+ *
+ * @return Returns 1 if success (or given up), -1 otherwise.
+ */
+int packet_queue_put(struct packet_queue *q, AVPacket *src_pkt)
+{
+	struct packet_list *pkl;
+
+	pkl = av_malloc(sizeof(*pkl));
+	if (!pkl)
+		return (-1);
+
+	/* Fill our new node. */
+	pkl->pkt  = *src_pkt;
+	pkl->next = NULL;
+
+	/* Add to our list. */
+	SDL_LockMutex(q->mutex);
+		while (1)
+		{
+			if (should_quit || q->abort)
+			{
+				av_packet_unref(&pkl->pkt);
+				av_free(pkl);
+				break;
+			}
+
+			/* Sleep until a new space or if we should quit. */
+			if (q->npkts >= q->max)
+			{
+				SDL_CondWait(q->cond, q->mutex);
+				q->wakeups++;
+				continue;
+			}
+
+			if (!q->last_packet)
+				q->first_packet = pkl;
+			else
+				q->last_packet->next = pkl;
+			q->last_packet = pkl;
+
+			q->npkts++;
+			q->size += src_pkt->size;
+			SDL_CondSignal(q->cond);
+			break;
+		}
+	SDL_UnlockMutex(q->mutex);
+	return (1);
+}
+
+/**
+ * @brief Removes all packets from the queue @p q, waking up
+ * any thread waiting for room: the queue starts over, no
+ * longer aborted or ended.
+ *
+ * @param q Packet queue.
+ */
+void packet_queue_flush(struct packet_queue *q)
+{
+	struct packet_list *pkl;
+	struct packet_list *pkl_next;
+
+	SDL_LockMutex(q->mutex);
+		pkl = q->first_packet;
+		while (pkl)
+		{
+			pkl_next = pkl->next;
+				av_packet_unref(&pkl->pkt);
+				av_free(pkl);
+			pkl = pkl_next;
+		}
+		q->first_packet = NULL;
+		q->last_packet  = NULL;
+		q->npkts = 0;
+		q->size  = 0;
+		q->abort = 0;
+		q->end   = 0;
+		SDL_CondSignal(q->cond);
+	SDL_UnlockMutex(q->mutex);
+}
+
+/**
+ * @brief Peeks the size and key flag of up to @p max packets
+ * at the head of the queue @p q, without removing them. Stops
+ * at the first flush packet (negative stream index).
+ *
+ * @param q Packet queue.
+ * @param info Output, packets info.
+ * @param max Maximum amount of packets.
+ *
+ * @return Returns the amount of packets peeked.
+ */
+int packet_queue_peek(struct packet_queue *q, struct packet_info *info,
+	int max)
+{
+	struct packet_list *pkl;
+	int n;
+
+	n = 0;
+	SDL_LockMutex(q->mutex);
+		for (pkl = q->first_packet; pkl && n < max; pkl = pkl->next, n++)
+		{
+			if (pkl->pkt.stream_index < 0)
+				break;
+			info[n].size = pkl->pkt.size;
+			info[n].key  = !!(pkl->pkt.flags & AV_PKT_FLAG_KEY);
+		}
+	SDL_UnlockMutex(q->mutex);
+	return (n);
+}
+
+/**
+ * @brief Signals that no more packets will be added
+ * to the queue @p q and wake up any waiting thread.
+ *
+ * @param q Packet queue.
+ */
+void packet_queue_end(struct packet_queue *q)
+{
+	q->end = 1;
+	SDL_CondSignal(q->cond);
+}
+
+/**
+ * @brief Aborts the queue @p q: any thread waiting for room
+ * (or in packet_queue_wait_abort()) gives up, until the
+ * queue is flushed.
+ *
+ * @param q Packet queue.
+ */
+void packet_queue_abort(struct packet_queue *q)
+{
+	SDL_LockMutex(q->mutex);
+		q->abort = 1;
+		SDL_CondBroadcast(q->cond);
+	SDL_UnlockMutex(q->mutex);
+}
+
+/**
+ * @brief Waits until the queue @p q is aborted or the program
+ * should quit.
+ *
+ * @param q Packet queue.
+ *
+ * @return Returns 1 if aborted, 0 if should quit.
+ */
+int packet_queue_wait_abort(struct packet_queue *q)
+{
+	int ret;
+
+	SDL_LockMutex(q->mutex);
+		while (!q->abort && !should_quit)
+		{
+			SDL_CondWait(q->cond, q->mutex);
+			q->wakeups++;
+		}
+		ret = q->abort;
+	SDL_UnlockMutex(q->mutex);
+	return (ret);
+}
+
+/**
+ * @brief Removes a packet from the queue and returns it
+ * as @p pk.
+ *
+ * It is important to note that this routine is blocking and if
+ * there are no new packets, the thread remains in blocking state
+ * until there are new packets.
+ *
+ * @param q Packet queue.
+ * @param pk Returned packet.
+ *
+ * @return Returns 1 if success, -1 otherwise.
+ */
+int packet_queue_get(struct packet_queue *q, AVPacket *pk)
+{
+	int ret;
+	struct packet_list *pkl;
+
+	ret = -1;
+
+	SDL_LockMutex(q->mutex);
+		while (1)
+		{
+			/* Should we abort? */
+			if (should_quit || (q->end && !q->npkts))
+				break;
+
+			pkl = q->first_packet;
+
+			/* If empty, lets wait for something. */
+			if (!pkl)
+			{
+				SDL_CondWait(q->cond, q->mutex);
+				q->wakeups++;
+				continue;
+			}
+
+			/* If something, remove head node and return. */
+			q->first_packet = pkl->next;
+			if (!q->first_packet)
+				q->last_packet = NULL;
+
+			q->npkts--;
+			q->size -= pkl->pkt.size;
+			*pk = pkl->pkt;
+
+			/* Release our node. */
+			av_free(pkl);
+			ret = 1;
+			break;
+		}
+		SDL_CondSignal(q->cond);
+	SDL_UnlockMutex(q->mutex);
+
+	return (ret);
+}
+
+/**
+ * @brief Initialize the picture queue.
+ *
+ * @param q Picture queue.
+ * @param max Maximum amount of pictures.
+ *
+ * @return Returns 0 if sucess, -1 otherwise.
+ */
+int init_picture_queue(struct picture_queue *q, int max)
+{
+	memset(q, 0, sizeof(*q));
+	q->max   = max;
+	q->mutex = SDL_CreateMutex();
+	q->cond  = SDL_CreateCond();
+	if (!q->mutex || !q->cond)
+		LOG_GOTO("Unable to create SDL mutexes/cond in picture_queue!\n",
+			out);
+	return (0);
+out:
+	return (-1);
+}
+
+/**
+ * @brief Releases all resources related to the picture
+ * queue, including the elements itself.
+ *
+ * @param q Picture queue to be freed.
+ */
+void finish_picture_queue(struct picture_queue *q)
+{
+	struct picture_list *pl;
+	struct picture_list *pl_next;
+
+	if (!q)
+		return;
+	if (q->mutex)
+		SDL_DestroyMutex(q->mutex);
+	if (q->cond)
+		SDL_DestroyCond(q->cond);
+
+	/* Go through the queue and clear everything. */
+	pl = q->first_picture;
+	while (pl)
+	{
+		pl_next = pl->next;
+			if (pl->picture)
+				SDL_DestroyTexture(pl->picture);
+			av_free(pl);
+		pl = pl_next;
+	}
+}
+
+/**
+ * @brief Add a complete frame, already uploaded as the texture
+ * @p picture, to the queue.
+ *
+ * It is important to note that this routine is blocking and if
+ * there are no space left, the thread remains in blocking state
+ * until there are room available.
+ *
+ * @param q Picture queue.
+ * @param picture Texture to be added.
+ * @param pts Frame pts (in seconds).
+ *
+ * @return Returns 1 if success, -1 otherwise (the texture is
+ * not owned by the queue in this case).
+ */
+int picture_queue_put(struct picture_queue *q, SDL_Texture *picture,
+	double pts)
+{
+	int ret;
+	struct picture_list *pl;
+
+	ret = -1;
+
+	/* Allocate a new node and put in the list. */
+	pl = av_malloc(sizeof(*pl));
+	if (!pl)
+		return (-1);
+
+	pl->pts = pts;
+	pl->picture = picture;
+	pl->next = NULL;
+
+	/* Add to our list. */
+	SDL_LockMutex(q->mutex);
+		while (1)
+		{
+			if (should_quit)
+			{
+				av_free(pl);
+				ret = -1;
+				break;
+			}
+
+			/* Sleep until a new space or if we should quit. */
+			if (q->npics >= q->max)
+			{
+				SDL_CondWait(q->cond, q->mutex);
+				q->wakeups++;
+				continue;
+			}
+
+			if (!q->last_picture)
+				q->first_picture = pl;
+			else
+				q->last_picture->next = pl;
+			q->last_picture = pl;
+
+			ret = 1;
+			q->npics++;
+			SDL_CondSignal(q->cond);
+			break;
+		}
+	SDL_UnlockMutex(q->mutex);
+	return (ret);
+}
+
+/**
+ * @brief Removes all frames from the picture queue @p q,
+ * waking up any thread waiting for room.
+ *
+ * @param q Picture queue.
+ *
+ * @note Textures are destroyed here, so the caller must
+ * hold any lock that protects the renderer.
+ */
+void picture_queue_flush(struct picture_queue *q)
+{
+	struct picture_list *pl;
+	struct picture_list *pl_next;
+
+	SDL_LockMutex(q->mutex);
+		pl = q->first_picture;
+		while (pl)
+		{
+			pl_next = pl->next;
+				if (pl->picture)
+					SDL_DestroyTexture(pl->picture);
+				av_free(pl);
+			pl = pl_next;
+		}
+		q->first_picture = NULL;
+		q->last_picture  = NULL;
+		q->npics = 0;
+		SDL_CondSignal(q->cond);
+	SDL_UnlockMutex(q->mutex);
+}
+
+/**
+ * @brief Evicts, from the head of the queue @p q, the pictures
+ * with pts in [@p min_pts, @p max_pts), releasing their
+ * textures with @p release. Stops at the first picture out of
+ * the range, so a discontinuity (e.g: loop) is never crossed.
+ *
+ * @param q Picture queue.
+ * @param min_pts Lowest pts evicted.
+ * @param max_pts Pts from which pictures are kept.
+ * @param release Texture release routine.
+ *
+ * @return Returns the amount of pictures evicted.
+ *
+ * @note The caller must hold any lock that protects the
+ * renderer.
+ */
+int picture_queue_evict(struct picture_queue *q, double min_pts,
+	double max_pts, void (*release)(SDL_Texture *))
+{
+	struct picture_list *pl;
+	int n;
+
+	n = 0;
+	SDL_LockMutex(q->mutex);
+		while ((pl = q->first_picture) != NULL && pl->pts >= min_pts &&
+			pl->pts < max_pts)
+		{
+			q->first_picture = pl->next;
+			if (!q->first_picture)
+				q->last_picture = NULL;
+			q->npics--;
+
+			release(pl->picture);
+			av_free(pl);
+			n++;
+		}
+		if (n)
+			SDL_CondSignal(q->cond);
+	SDL_UnlockMutex(q->mutex);
+	return (n);
+}
+
+/**
+ * @brief Changes the maximum amount of pictures of the
+ * queue @p q, waking up the producer if it grew.
+ *
+ * @param q Picture queue.
+ * @param max New maximum.
+ */
+void picture_queue_set_max(struct picture_queue *q, int max)
+{
+	SDL_LockMutex(q->mutex);
+		if (max > q->max)
+			SDL_CondSignal(q->cond);
+		q->max = max;
+	SDL_UnlockMutex(q->mutex);
+}
+
+/**
+ * @brief Signals that no more pictures will be added
+ * to the queue @p q and wake up any waiting thread.
+ *
+ * @param q Picture queue.
+ */
+void picture_queue_end(struct picture_queue *q)
+{
+	q->end = 1;
+	SDL_CondSignal(q->cond);
+}
+
+/**
+ * @brief Removes a full frame from the queue and returns it
+ * as @p sdl_pic and @p pts.
+ *
+ * It is important to note that this routine is blocking and if
+ * there are no new frames, the thread remains in blocking until
+ * there are new frames.
+ *
+ * @param q Picture queue.
+ * @param sdl_pic Returned frame to be drawn.
+ * @param pts Returned frame pts.
+ *
+ * @return Returns 1 if success, -1 otherwise.
+ */
+int picture_queue_get(struct picture_queue *q, SDL_Texture **sdl_pic,
+	double *pts)
+{
+	int ret;
+	struct picture_list *pl;
+
+	ret = -1;
+
+	SDL_LockMutex(q->mutex);
+		while (1)
+		{
+			if (should_quit || (q->end && !q->npics))
+				break;
+
+			pl = q->first_picture;
+
+			/* If empty, lets wait for something. */
+			if (!pl)
+			{
+				SDL_CondWait(q->cond, q->mutex);
+				q->wakeups++;
+				continue;
+			}
+
+			/* If something, remove head node and return. */
+			q->first_picture = pl->next;
+			if (!q->first_picture)
+				q->last_picture = NULL;
+
+			q->npics--;
+			*sdl_pic = pl->picture;
+			*pts = pl->pts;
+
+			/* Release our node. */
+			av_free(pl);
+			ret = 1;
+			break;
+		}
+		SDL_CondSignal(q->cond);
+	SDL_UnlockMutex(q->mutex);
+
+	return (ret);
+}
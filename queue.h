@@ -0,0 +1,112 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+	#include <SDL.h>
+	#include <libavcodec/avcodec.h>
+
+	/* Termination flag, set when the program should quit. */
+	extern int should_quit;
+
+	/*
+	 * Since AVPacketList is marked as 'deprecated', let's
+	 * use ours.
+	 */
+	struct packet_list
+	{
+		AVPacket pkt;
+		struct packet_list *next;
+	};
+
+	/* Packet queue definition. */
+	struct packet_queue
+	{
+		struct packet_list *first_packet;
+		struct packet_list *last_packet;
+		int npkts;
+		int size;
+		int max;
+		int end;
+		int abort; /* Stop waiting for room, the queue will be flushed. */
+		unsigned long wakeups;
+		SDL_mutex *mutex;
+		SDL_cond *cond;
+	};
+
+	/* Packet info, for lookahead. */
+	struct packet_info
+	{
+		int size;
+		int key;
+	};
+
+	/* Picture list definition. */
+	struct picture_list
+	{
+		double pts;
+		SDL_Texture *picture;
+		struct picture_list *next;
+	};
+
+	/* Picture queue definition. */
+	struct picture_queue
+	{
+		struct picture_list *first_picture;
+		struct picture_list *last_picture;
+		int npics;
+		int max;
+		int end;
+		unsigned long wakeups;
+		SDL_mutex *mutex;
+		SDL_cond *cond;
+	};
+
+	/* Packet queue. */
+	extern int init_packet_queue(struct packet_queue *q, int max);
+	extern void finish_packet_queue(struct packet_queue *q);
+	extern int packet_queue_put(struct packet_queue *q, AVPacket *src_pkt);
+	extern int packet_queue_get(struct packet_queue *q, AVPacket *pk);
+	extern void packet_queue_flush(struct packet_queue *q);
+	extern void packet_queue_end(struct packet_queue *q);
+	extern void packet_queue_abort(struct packet_queue *q);
+	extern int packet_queue_wait_abort(struct packet_queue *q);
+	extern int packet_queue_peek(struct packet_queue *q,
+		struct packet_info *info, int max);
+
+	/* Picture queue. */
+	extern int init_picture_queue(struct picture_queue *q, int max);
+	extern void finish_picture_queue(struct picture_queue *q);
+	extern int picture_queue_put(struct picture_queue *q,
+		SDL_Texture *picture, double pts);
+	extern int picture_queue_get(struct picture_queue *q,
+		SDL_Texture **sdl_pic, double *pts);
+	extern void picture_queue_flush(struct picture_queue *q);
+	extern void picture_queue_end(struct picture_queue *q);
+	extern void picture_queue_set_max(struct picture_queue *q, int max);
+	extern int picture_queue_evict(struct picture_queue *q, double min_pts,
+		double max_pts, void (*release)(SDL_Texture *));
+
+#endif /* QUEUE_H */
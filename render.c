@@ -0,0 +1,306 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "anipaper.h"
+
+/*
+ * Render driver calibration.
+ *
+ * Each render driver available is timed creating, updating
+ * (YV12, at the stream resolution) and presenting a texture
+ * per frame, as the playback does, on a hidden window of the
+ * screen size; the fastest one is used.
+ *
+ * The result only depends on the machine, the display and the
+ * resolutions, so it is cached (per machine id, display, video
+ * driver, screen and stream resolution) and the calibration
+ * only runs once.
+ */
+
+/* Frames timed per driver, and untimed ones before. */
+#define RENDER_CAL_FRAMES 30
+#define RENDER_CAL_WARMUP 3
+
+/*
+ * Distinct frames filled before the timing and cycled through,
+ * so the pattern generation is not timed along with the driver.
+ */
+#define RENDER_CAL_FILLS 3
+
+/**
+ * @brief Fills the YV12 planes with a pattern that changes on
+ * every frame, so nothing can be skipped as unchanged.
+ *
+ * @param planes Y, U and V planes.
+ * @param width Frame width.
+ * @param height Frame height.
+ * @param n Frame number.
+ */
+static void fill_frame(uint8_t *planes[3], int width, int height, int n)
+{
+	int cw;
+	int ch;
+	int x;
+	int y;
+
+	cw = (width + 1) / 2;
+	ch = (height + 1) / 2;
+
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+			planes[0][y * width + x] = (uint8_t)(x + y * 3 + n * 7);
+
+	for (y = 0; y < ch; y++)
+	{
+		for (x = 0; x < cw; x++)
+		{
+			planes[1][y * cw + x] = (uint8_t)(128 + ((x + n) & 31));
+			planes[2][y * cw + x] = (uint8_t)(128 + ((y + n) & 31));
+		}
+	}
+}
+
+/**
+ * @brief Times the render driver @p index.
+ *
+ * @param index Driver index.
+ * @param planes Planes (YV12) of the frames to cycle through.
+ * @param width Frame width.
+ * @param height Frame height.
+ * @param win_w Window width.
+ * @param win_h Window height.
+ *
+ * @return Returns the time per frame (in seconds), or a
+ * negative number if the driver is not usable.
+ */
+static double time_driver(int index, uint8_t *planes[][3], int width,
+	int height, int win_w, int win_h)
+{
+	SDL_Renderer *renderer;
+	SDL_Texture *texture;
+	SDL_Window *window;
+	uint8_t **frm;
+	double start;
+	double secs;
+	Uint32 pixel;
+	SDL_Rect px;
+	int cw;
+	int i;
+
+	secs = -1.0;
+	cw = (width + 1) / 2;
+	px.x = px.y = 0;
+	px.w = px.h = 1;
+
+	window = SDL_CreateWindow("calibrate", SDL_WINDOWPOS_CENTERED,
+		SDL_WINDOWPOS_CENTERED, win_w, win_h, SDL_WINDOW_HIDDEN);
+	if (!window)
+		return (-1.0);
+
+	renderer = SDL_CreateRenderer(window, index, 0);
+	if (!renderer)
+		goto out0;
+
+	start = 0.0;
+	for (i = 0; i < RENDER_CAL_WARMUP + RENDER_CAL_FRAMES; i++)
+	{
+		if (i == RENDER_CAL_WARMUP)
+			start = time_secs();
+
+		frm = planes[i % RENDER_CAL_FILLS];
+		texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12,
+			SDL_TEXTUREACCESS_STREAMING, width, height);
+		if (!texture)
+			goto out1;
+
+		SDL_UpdateYUVTexture(texture, NULL, frm[0], width,
+			frm[1], cw, frm[2], cw);
+		SDL_RenderClear(renderer);
+		SDL_RenderCopy(renderer, texture, NULL, NULL);
+		SDL_RenderPresent(renderer);
+		SDL_DestroyTexture(texture);
+	}
+
+	/* Wait for the GPU: the presents above may be queued only. */
+	SDL_RenderReadPixels(renderer, &px, SDL_PIXELFORMAT_ARGB8888,
+		&pixel, sizeof(pixel));
+
+	secs = (time_secs() - start) / RENDER_CAL_FRAMES;
+out1:
+	SDL_DestroyRenderer(renderer);
+out0:
+	SDL_DestroyWindow(window);
+	return (secs);
+}
+
+/**
+ * @brief Times every render driver available and gets the
+ * fastest one.
+ *
+ * @param width Stream width.
+ * @param height Stream height.
+ * @param win_w Window (or screen) width.
+ * @param win_h Window (or screen) height.
+ * @param name Output buffer for the driver name.
+ * @param size Buffer size.
+ *
+ * @return Returns the time per frame (in seconds) of the
+ * fastest driver, or a negative number if none works.
+ */
+static double calibrate(int width, int height, int win_w, int win_h,
+	char *name, size_t size)
+{
+	uint8_t *planes[RENDER_CAL_FILLS][3];
+	SDL_RendererInfo info;
+	uint8_t *buf;
+	double best;
+	double secs;
+	size_t luma;
+	size_t chroma;
+	size_t frame;
+	int i;
+
+	luma = (size_t)width * height;
+	chroma = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+	frame = luma + 2 * chroma;
+	buf = malloc(frame * RENDER_CAL_FILLS);
+	if (!buf)
+		return (-1.0);
+
+	for (i = 0; i < RENDER_CAL_FILLS; i++)
+	{
+		planes[i][0] = buf + i * frame;
+		planes[i][1] = planes[i][0] + luma;
+		planes[i][2] = planes[i][1] + chroma;
+		fill_frame(planes[i], width, height, i);
+	}
+
+	best = -1.0;
+	for (i = 0; i < SDL_GetNumRenderDrivers(); i++)
+	{
+		if (SDL_GetRenderDriverInfo(i, &info) < 0)
+			continue;
+
+		secs = time_driver(i, planes, width, height, win_w, win_h);
+		if (secs < 0)
+		{
+			LOG("render: %s: not usable (%s)\n", info.name, SDL_GetError());
+			continue;
+		}
+
+		LOG("render: %s: %.3f ms/frame\n", info.name, secs * 1000.0);
+		if (best < 0 || secs < best)
+		{
+			best = secs;
+			snprintf(name, size, "%s", info.name);
+		}
+	}
+
+	free(buf);
+	return (best);
+}
+
+/**
+ * @brief Gets the fastest render driver for a stream of
+ * @p width x @p height on a window (or screen) of @p win_w x
+ * @p win_h: from the cache if already calibrated, otherwise
+ * by timing each driver (and caching the result).
+ *
+ * SDL must be already initialized.
+ *
+ * @param width Stream width.
+ * @param height Stream height.
+ * @param win_w Window (or screen) width.
+ * @param win_h Window (or screen) height.
+ * @param force Non-zero to ignore the cache.
+ * @param name Output buffer for the driver name.
+ * @param size Buffer size.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+int render_select(int width, int height, int win_w, int win_h, int force,
+	char *name, size_t size)
+{
+	char path[PATH_MAX + 64];
+	char driver[32];
+	char key[512];
+	char id[128];
+	const char *display;
+	double secs;
+	FILE *f;
+
+	machine_id(id, sizeof(id));
+	display = getenv("DISPLAY");
+	snprintf(key, sizeof(key), "%s:%s:%s:%dx%d:%dx%d", id,
+		display ? display : "", SDL_GetCurrentVideoDriver(),
+		win_w, win_h, width, height);
+
+	if (cache_path(path, sizeof(path), "render", key) < 0)
+		path[0] = '\0';
+
+	/* Already calibrated. */
+	if (!force && path[0] && (f = fopen(path, "r")) != NULL)
+	{
+		if (fscanf(f, "%31s %lf", driver, &secs) == 2)
+		{
+			fclose(f);
+			snprintf(name, size, "%s", driver);
+			LOG("render: %s (cached, %.3f ms/frame)\n", name, secs * 1000.0);
+			return (0);
+		}
+		fclose(f);
+	}
+
+	secs = calibrate(width, height, win_w, win_h, name, size);
+	if (secs < 0)
+	{
+		LOG("render: no render driver usable!\n");
+		return (-1);
+	}
+
+	LOG("render: %s selected\n", name);
+	if (!path[0])
+		return (0);
+
+	cache_mkdir(path);
+	f = fopen(path, "w");
+	if (!f)
+	{
+		LOG("render: unable to save the calibration to %s\n", path);
+		return (0);
+	}
+	fprintf(f, "%s %.9f\n", name, secs);
+	fclose(f);
+	return (0);
+}
@@ -0,0 +1,264 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "anipaper.h"
+
+/*
+ * Multi-rendition stream selection.
+ *
+ * A container may hold the same video at several resolutions
+ * (renditions): all the video streams with the same codec as
+ * the best one make up a ladder, from the smallest to the
+ * largest. The playback starts with the smallest rendition
+ * that is not upscaled on the screen (or the largest one), the
+ * ladder ceiling.
+ *
+ * Then, once per window, the presented and missed (dropped or
+ * evicted) frames are sampled: a window missing too many frames,
+ * or under load (quality ladder degraded by the CPU budget or
+ * the throttling), steps down a rendition; a long enough calm
+ * period steps up again, up to the ceiling. The switch itself
+ * happens at the next keyframe of the new rendition.
+ */
+
+/* Sampling window (ms). */
+#define RENDITION_WINDOW_MS 2000
+
+/* Missed frames (%) within a window that step down. */
+#define RENDITION_MISS_PCT 5.0
+
+/* Quality ladder level that means the decoder is under load. */
+#define RENDITION_LOAD_QUALITY 2
+
+/* Time without misses nor load to step up (ms). */
+#define RENDITION_CALM_MS 10000
+
+/* Largest ladder. */
+#define RENDITION_MAX 16
+
+/* Rendition. */
+struct rendition
+{
+	int idx;    /* Stream index. */
+	int width;
+	int height;
+};
+
+static struct rendition ladder[RENDITION_MAX];
+static int nrenditions;
+static int ceiling;
+static int level;
+
+/* Last sample. */
+static double last_sample;
+static double last_bad;
+static unsigned long last_presented;
+static unsigned long last_missed;
+
+/**
+ * @brief Builds the ladder of the renditions of the stream
+ * @p best in @p fmt and gets the one that best fits a
+ * destination of @p dst_w x @p dst_h.
+ *
+ * @param fmt Format context.
+ * @param best Best video stream (as in av_find_best_stream()).
+ * @param dst_w Destination width (0 if unknown).
+ * @param dst_h Destination height (0 if unknown).
+ * @param stretch Non-zero if the video is stretched to the
+ * destination, zero if it fits into (keeping aspect ratio).
+ *
+ * @return Returns the stream index to start with.
+ */
+int rendition_init(AVFormatContext *fmt, int best, int dst_w, int dst_h,
+	int stretch)
+{
+	AVCodecParameters *par;
+	AVCodecParameters *bpar;
+	struct rendition r;
+	double scale;
+	unsigned i;
+	int j;
+
+	nrenditions = 0;
+	bpar = fmt->streams[best]->codecpar;
+
+	/* Same codec, sorted by area (insertion sort, tiny ladders). */
+	for (i = 0; i < fmt->nb_streams && nrenditions < RENDITION_MAX; i++)
+	{
+		par = fmt->streams[i]->codecpar;
+		if (par->codec_type != AVMEDIA_TYPE_VIDEO ||
+			par->codec_id != bpar->codec_id ||
+			par->width <= 0 || par->height <= 0 ||
+			(fmt->streams[i]->disposition & AV_DISPOSITION_ATTACHED_PIC))
+		{
+			continue;
+		}
+
+		r.idx = (int)i;
+		r.width = par->width;
+		r.height = par->height;
+
+		for (j = nrenditions; j > 0 &&
+			(int64_t)ladder[j - 1].width * ladder[j - 1].height >
+			(int64_t)r.width * r.height; j--)
+		{
+			ladder[j] = ladder[j - 1];
+		}
+		ladder[j] = r;
+		nrenditions++;
+	}
+
+	/* Smallest rendition not upscaled, or the largest one. */
+	ceiling = -1;
+	for (j = 0; j < nrenditions; j++)
+	{
+		if (ladder[j].idx == best)
+			ceiling = j;
+	}
+
+	if (dst_w > 0 && dst_h > 0)
+	{
+		for (j = 0; j < nrenditions; j++)
+		{
+			if (stretch)
+				scale = FFMAX((double)dst_w / ladder[j].width,
+					(double)dst_h / ladder[j].height);
+			else
+				scale = FFMIN((double)dst_w / ladder[j].width,
+					(double)dst_h / ladder[j].height);
+
+			if (scale <= 1.0 || j == nrenditions - 1)
+			{
+				ceiling = j;
+				break;
+			}
+		}
+	}
+
+	if (ceiling < 0)
+	{
+		nrenditions = 0;
+		return (best);
+	}
+
+	level = ceiling;
+	last_sample = last_bad = time_secs();
+	last_presented = stats.frames_presented;
+	last_missed = stats.frames_dropped + stats.frames_evicted;
+
+	if (nrenditions > 1)
+	{
+		LOG("rendition: %d renditions, starting with %dx%d (stream #%d)\n",
+			nrenditions, ladder[level].width, ladder[level].height,
+			ladder[level].idx);
+	}
+
+	return (ladder[level].idx);
+}
+
+/**
+ * @brief Samples the presented and missed frames and, once per
+ * window, decides the rendition to play. Should be called often
+ * (e.g: at each pause check), the rate is handled internally.
+ *
+ * @param quality Current quality ladder level (the decoder
+ * load, as seen by the CPU budget and throttling).
+ *
+ * @return Returns the stream index of the rendition to play,
+ * or -1 if there is nothing to switch to.
+ */
+int rendition_update(int quality)
+{
+	unsigned long presented;
+	unsigned long missed;
+	double miss_pct;
+	double now;
+	int bad;
+
+	if (nrenditions < 2)
+		return (-1);
+
+	now = time_secs();
+	if ((now - last_sample) * 1000.0 < RENDITION_WINDOW_MS)
+		return (-1);
+
+	presented = stats.frames_presented - last_presented;
+	missed = stats.frames_dropped + stats.frames_evicted - last_missed;
+	last_presented += presented;
+	last_missed += missed;
+	last_sample = now;
+
+	/* Paused, nothing to learn. */
+	if (!presented && !missed)
+		return (-1);
+
+	miss_pct = missed * 100.0 / (presented + missed);
+	bad = miss_pct > RENDITION_MISS_PCT || quality >= RENDITION_LOAD_QUALITY;
+
+	if (bad)
+	{
+		last_bad = now;
+		if (level == 0)
+			return (-1);
+		level--;
+	}
+	else if (level < ceiling && (now - last_bad) * 1000.0 >= RENDITION_CALM_MS)
+	{
+		last_bad = now;
+		level++;
+	}
+	else
+		return (-1);
+
+	LOG("rendition: switching to %dx%d (stream #%d, missed: %.1f%%)\n",
+		ladder[level].width, ladder[level].height, ladder[level].idx,
+		miss_pct);
+
+	return (ladder[level].idx);
+}
+
+/**
+ * @brief Gets back to the rendition of stream @p idx, if the
+ * switch to another one could not be done.
+ *
+ * @param idx Stream index in use.
+ */
+void rendition_failed(int idx)
+{
+	int j;
+
+	for (j = 0; j < nrenditions; j++)
+	{
+		if (ladder[j].idx == idx)
+			level = j;
+	}
+}
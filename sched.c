@@ -0,0 +1,442 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "anipaper.h"
+
+/*
+ * Thread scheduling: background classes and CPU affinity.
+ *
+ * On Linux, the scheduling policy, the nice value and the I/O
+ * priority are per thread, and are inherited by the threads it
+ * creates: setting them in the demux and decode threads (before
+ * the decoder opens its own workers) keeps the main thread, i.e:
+ * the presentation, untouched.
+ */
+
+/* I/O priorities, not exported by the libc. */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE  3
+#define IOPRIO_WHO_PROCESS 1
+
+/* Nice value used by BG_SCHED_NICE. */
+#define BG_SCHED_NICE_VALUE 19
+
+/* Background classes. */
+const char *const bg_sched_names[BG_SCHED_NR] = {"none", "idle", "nice"};
+
+/**
+ * @brief Moves the calling thread to the background class
+ * @p mode: SCHED_IDLE (BG_SCHED_IDLE) or the highest nice
+ * value (BG_SCHED_NICE), both with the idle I/O priority.
+ *
+ * @param mode Background class (BG_SCHED_*).
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+int sched_background(int mode)
+{
+	struct sched_param param = {0};
+	pid_t tid;
+
+	if (mode == BG_SCHED_NONE)
+		return (0);
+
+	tid = syscall(SYS_gettid);
+
+	if (mode == BG_SCHED_IDLE)
+	{
+		if (sched_setscheduler(0, SCHED_IDLE, &param) < 0)
+			goto err;
+	}
+	else if (setpriority(PRIO_PROCESS, tid, BG_SCHED_NICE_VALUE) < 0)
+		goto err;
+
+	/* Only runs I/O when nobody else wants the disk. */
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+		IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0)
+	{
+		goto err;
+	}
+
+	return (0);
+err:
+	LOG("Unable to set the %s class (tid %d): %s\n", bg_sched_names[mode],
+		(int)tid, strerror(errno));
+	return (-1);
+}
+
+/**
+ * @brief Sets the timer slack of the calling thread: its
+ * timed sleeps may be delayed by up to @p ns nanoseconds,
+ * so the kernel can coalesce them with other wakeups.
+ *
+ * @param ns Timer slack (in ns).
+ */
+void sched_timer_slack(unsigned long ns)
+{
+	if (prctl(PR_SET_TIMERSLACK, ns, 0, 0, 0) < 0)
+		LOG("Unable to set the timer slack: %s\n", strerror(errno));
+}
+
+/*
+ * CPU affinity.
+ *
+ * The whole process is pinned from the main thread, before any
+ * other thread (ours, SDL's or libavcodec's) exists, so all of
+ * them inherit the same set. The core types come from sysfs:
+ * the hybrid PMUs (cpu_atom/cpu_core) if present, otherwise the
+ * cpu_capacity (or max frequency) of each CPU, and the L3
+ * domains from the cache topology.
+ */
+
+/* Sysfs root, overridable for testing. */
+static char affinity_root[512] = "/sys";
+
+/* Selected CPUs. */
+static cpu_set_t affinity_set;
+static int affinity_ncpus;
+
+/**
+ * @brief Parses a CPU list (e.g: 0-3,8,10-11) into @p set.
+ *
+ * @param list CPU list.
+ * @param set Output set.
+ *
+ * @return Returns the amount of CPUs, or -1 if invalid.
+ */
+static int parse_cpu_list(const char *list, cpu_set_t *set)
+{
+	char *end;
+	long first;
+	long last;
+
+	CPU_ZERO(set);
+
+	while (*list && *list != '\n')
+	{
+		first = strtol(list, &end, 10);
+		if (end == list || first < 0)
+			return (-1);
+
+		last = first;
+		if (*end == '-')
+		{
+			list = end + 1;
+			last = strtol(list, &end, 10);
+			if (end == list || last < first)
+				return (-1);
+		}
+
+		if (last >= CPU_SETSIZE)
+			return (-1);
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+
+		list = end;
+		if (*list == ',')
+			list++;
+		else if (*list && *list != '\n')
+			return (-1);
+	}
+	return (CPU_COUNT(set));
+}
+
+/**
+ * @brief Reads the CPU list file <root>/@p path into @p set.
+ *
+ * @param path File path, relative to the sysfs root.
+ * @param set Output set.
+ *
+ * @return Returns the amount of CPUs, or -1 if error.
+ */
+static int read_cpu_list(const char *path, cpu_set_t *set)
+{
+	FILE *f;
+	char buf[1024];
+	char file[1024];
+
+	snprintf(file, sizeof(file), "%s/%s", affinity_root, path);
+	f = fopen(file, "r");
+	if (!f)
+		return (-1);
+
+	if (!fgets(buf, sizeof(buf), f))
+	{
+		fclose(f);
+		return (-1);
+	}
+	fclose(f);
+	return (parse_cpu_list(buf, set));
+}
+
+/**
+ * @brief Gets the capacity of the CPU @p cpu: its
+ * cpu_capacity (if available, e.g: ARM big.LITTLE) or its
+ * max frequency.
+ *
+ * @param cpu CPU number.
+ *
+ * @return Returns the capacity, or -1 if unknown.
+ */
+static long cpu_capacity(int cpu)
+{
+	static const char *const files[] = {
+		"cpu_capacity", "cpufreq/cpuinfo_max_freq"
+	};
+	FILE *f;
+	char path[1024];
+	long cap;
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/%s",
+			affinity_root, cpu, files[i]);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fscanf(f, "%ld", &cap) != 1)
+			cap = -1;
+		fclose(f);
+		if (cap > 0)
+			return (cap);
+	}
+	return (-1);
+}
+
+/**
+ * @brief Finds the efficiency (or performance) cores.
+ *
+ * @param performance Non-zero for the performance cores.
+ * @param set Output set.
+ *
+ * @return Returns the amount of CPUs, or 0 if the CPU is
+ * not hybrid.
+ */
+static int find_core_type(int performance, cpu_set_t *set)
+{
+	cpu_set_t online;
+	long cap, min_cap, max_cap;
+	int cpu;
+
+	/* Intel hybrid: a PMU per core type. */
+	if (read_cpu_list(performance ? "devices/cpu_core/cpus" :
+		"devices/cpu_atom/cpus", set) > 0)
+	{
+		return (CPU_COUNT(set));
+	}
+
+	if (read_cpu_list("devices/system/cpu/online", &online) <= 0)
+		return (0);
+
+	min_cap = LONG_MAX;
+	max_cap = 0;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (!CPU_ISSET(cpu, &online) || (cap = cpu_capacity(cpu)) < 0)
+			continue;
+		min_cap = FFMIN(min_cap, cap);
+		max_cap = FFMAX(max_cap, cap);
+	}
+
+	/* Homogeneous. */
+	if (max_cap == 0 || min_cap == max_cap)
+		return (0);
+
+	CPU_ZERO(set);
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (!CPU_ISSET(cpu, &online))
+			continue;
+		cap = cpu_capacity(cpu);
+		if (cap == (performance ? max_cap : min_cap))
+			CPU_SET(cpu, set);
+	}
+	return (CPU_COUNT(set));
+}
+
+/**
+ * @brief Finds the CPUs sharing the last L3 cache (e.g: the
+ * last CCX), usually the farthest from the boot CPU, where
+ * the desktop tends to start.
+ *
+ * @param set Output set.
+ *
+ * @return Returns the amount of CPUs, or 0 if there is a
+ * single L3 domain.
+ */
+static int find_last_llc(cpu_set_t *set)
+{
+	cpu_set_t online;
+	char path[128];
+	int cpu;
+	int last;
+
+	if (read_cpu_list("devices/system/cpu/online", &online) <= 0)
+		return (0);
+
+	for (cpu = 0, last = -1; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &online))
+			last = cpu;
+	if (last < 0)
+		return (0);
+
+	snprintf(path, sizeof(path),
+		"devices/system/cpu/cpu%d/cache/index3/shared_cpu_list", last);
+	if (read_cpu_list(path, set) <= 0)
+		return (0);
+
+	/* A single domain covering everything. */
+	CPU_AND(set, set, &online);
+	if (CPU_EQUAL(set, &online))
+		return (0);
+
+	return (CPU_COUNT(set));
+}
+
+/**
+ * @brief Formats @p set as a CPU list into @p buf.
+ *
+ * @param set CPU set.
+ * @param buf Output buffer.
+ * @param size Buffer size.
+ */
+static void format_cpu_list(const cpu_set_t *set, char *buf, size_t size)
+{
+	size_t len;
+	int first;
+	int cpu;
+
+	buf[0] = '\0';
+	for (cpu = 0, len = 0; cpu < CPU_SETSIZE && len < size; cpu++)
+	{
+		if (!CPU_ISSET(cpu, set))
+			continue;
+		for (first = cpu; cpu + 1 < CPU_SETSIZE && CPU_ISSET(cpu + 1, set);)
+			cpu++;
+
+		if (first == cpu)
+			len += snprintf(buf + len, size - len, "%s%d", len ? "," : "",
+				cpu);
+		else
+			len += snprintf(buf + len, size - len, "%s%d-%d",
+				len ? "," : "", first, cpu);
+	}
+}
+
+/**
+ * @brief Selects the CPUs described by @p spec: a CPU list
+ * (e.g: 0-3,8), "efficiency" or "performance" (core types of
+ * hybrid CPUs), "llc" (CPUs of the last L3 domain) or "auto"
+ * (the efficiency cores, or the last L3 domain, if any).
+ *
+ * @param spec Affinity specification.
+ *
+ * @return Returns the amount of CPUs selected, 0 if there is
+ * nothing to pin (e.g: "auto" on a homogeneous CPU) or -1 if
+ * @p spec is invalid or no CPU matches it.
+ */
+int affinity_init(const char *spec)
+{
+	const char *root;
+	char list[256];
+	const char *what;
+
+	root = getenv("ANIPAPER_SYSFS_ROOT");
+	if (root && *root)
+		snprintf(affinity_root, sizeof(affinity_root), "%s", root);
+
+	affinity_ncpus = 0;
+	what = spec;
+
+	if (!strcmp(spec, "efficiency") || !strcmp(spec, "performance"))
+		affinity_ncpus = find_core_type(spec[0] == 'p', &affinity_set);
+	else if (!strcmp(spec, "llc"))
+		affinity_ncpus = find_last_llc(&affinity_set);
+	else if (!strcmp(spec, "auto"))
+	{
+		what = "efficiency";
+		affinity_ncpus = find_core_type(0, &affinity_set);
+		if (!affinity_ncpus)
+		{
+			what = "llc";
+			affinity_ncpus = find_last_llc(&affinity_set);
+		}
+		if (!affinity_ncpus)
+		{
+			LOG("affinity: homogeneous CPU, nothing to pin\n");
+			return (0);
+		}
+	}
+	else
+	{
+		what = "list";
+		affinity_ncpus = parse_cpu_list(spec, &affinity_set);
+	}
+
+	if (affinity_ncpus <= 0)
+	{
+		affinity_ncpus = 0;
+		return (-1);
+	}
+
+	format_cpu_list(&affinity_set, list, sizeof(list));
+	LOG("affinity: %s, CPUs %s (%d)\n", what, list, affinity_ncpus);
+	return (affinity_ncpus);
+}
+
+/**
+ * @brief Pins the calling thread (and so every thread it
+ * creates afterwards) to the CPUs selected by affinity_init().
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+int affinity_apply(void)
+{
+	if (!affinity_ncpus)
+		return (0);
+
+	if (sched_setaffinity(0, sizeof(affinity_set), &affinity_set) < 0)
+	{
+		LOG("Unable to set the CPU affinity: %s\n", strerror(errno));
+		return (-1);
+	}
+	return (0);
+}
@@ -0,0 +1,257 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "anipaper.h"
+
+/* Pipeline metrics. */
+struct pipeline_stats stats = {0};
+
+/* Stage names. */
+const char *const stage_names[STAGE_NR] = {
+	"demux", "decode", "convert", "upload", "present"
+};
+
+/* Begin of measurement. */
+static double begin_secs;
+static struct rusage begin_usage;
+
+/**
+ * @brief Dumps the current pipeline metrics into the
+ * file @p f.
+ *
+ * @param f Output file.
+ */
+void stats_dump(FILE *f)
+{
+	double now;
+
+	now = time_secs();
+
+	fprintf(f,
+		"INFO: stats:\n"
+		"INFO:   packets read:     %lu\n"
+		"INFO:   frames decoded:   %lu\n"
+		"INFO:   frames presented: %lu\n"
+		"INFO:   frames dropped:   %lu\n"
+		"INFO:   frames skipped:   %lu\n"
+		"INFO:   frames evicted:   %lu\n"
+		"INFO:   stalls:           %lu\n"
+		"INFO:   recoveries:       %lu\n"
+		"INFO:   throttle level:   %d\n"
+		"INFO:   wakeups:          %lu (%.1f/s)\n",
+		stats.pkts_read, stats.frames_decoded, stats.frames_presented,
+		stats.frames_dropped, stats.frames_skipped, stats.frames_evicted,
+		stats.stalls,
+		stats.recoveries, stats.throttle_level, stats.wakeups,
+		now > begin_secs ? stats.wakeups / (now - begin_secs) : 0.0);
+
+	if (stats.rendition_switches)
+	{
+		fprintf(f, "INFO:   renditions:       %lu switches\n",
+			stats.rendition_switches);
+	}
+
+	if (stats.pool_threads)
+	{
+		fprintf(f, "INFO:   task pool:        %d threads, %lu tasks "
+			"(%lu stolen)\n", stats.pool_threads, stats.pool_tasks,
+			stats.pool_steals);
+	}
+
+	if (stats.cpu_budget > 0)
+	{
+		fprintf(f, "INFO:   cpu usage:        %.1f%% (budget: %.1f%%)\n",
+			stats.cpu_usage, stats.cpu_budget);
+	}
+
+	if (stats.queue_depth_samples)
+	{
+		fprintf(f, "INFO:   queue depth:      %.2f avg (max: %d, %.1f MiB)\n",
+			stats.queue_depth_sum / stats.queue_depth_samples,
+			stats.queue_max,
+			stats.queue_max * stats.queue_frame_bytes / (1024.0 * 1024.0));
+	}
+
+	if (stats.motion_fps > 0)
+	{
+		fprintf(f, "INFO:   motion rate:      %.1f fps (%lu still frames "
+			"skipped, %.1f ms analysing)\n", stats.motion_fps,
+			stats.frames_still, stats.motion_secs * 1000.0);
+	}
+
+	if (stats.dirty_frames)
+	{
+		fprintf(f, "INFO:   dirty uploads:    %lu/%lu partial, %.1f%% of "
+			"the area\n", stats.dirty_partial, stats.dirty_frames,
+			stats.dirty_area / stats.dirty_frames);
+	}
+
+	fprintf(f,
+		"INFO:   last activity: demux %.3fs ago, decode %.3fs ago, "
+		"present %.3fs ago (pts: %.3f)\n",
+		now - stats.last_demux, now - stats.last_decode,
+		now - stats.last_present, stats.last_pts);
+}
+
+/**
+ * @brief Marks the begin of a measurement: the wall and
+ * CPU times reported by stats_dump_json() are relative
+ * to this point.
+ */
+void stats_begin(void)
+{
+	begin_secs = time_secs();
+	getrusage(RUSAGE_SELF, &begin_usage);
+}
+
+/**
+ * @brief Converts a timeval to seconds.
+ *
+ * @param tv Timeval to be converted.
+ *
+ * @return Returns the amount of seconds.
+ */
+static double tv_secs(const struct timeval *tv)
+{
+	return ((double)tv->tv_sec + (double)tv->tv_usec / 1000000.0);
+}
+
+/**
+ * @brief Writes the string @p str as a JSON string
+ * into @p f.
+ *
+ * @param f Output file.
+ * @param str String to be written.
+ */
+void json_str(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (; *str; str++)
+	{
+		if (*str == '"' || *str == '\\')
+			fputc('\\', f);
+		if ((unsigned char)*str < 0x20)
+			fprintf(f, "\\u%04x", *str);
+		else
+			fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+/**
+ * @brief Dumps the pipeline metrics since the last
+ * stats_begin() as a JSON object into @p f.
+ *
+ * @param f Output file.
+ * @param dp av_decode_params structure.
+ * @param file Input file.
+ * @param stop Last pipeline stage executed.
+ * @param renderer Renderer name, or NULL if none.
+ */
+void stats_dump_json(FILE *f, struct av_decode_params *dp,
+	const char *file, int stop, const char *renderer)
+{
+	int i;
+	double wall;
+	double cpu_user;
+	double cpu_sys;
+	unsigned long frames;
+	struct rusage usage;
+
+	wall = time_secs() - begin_secs;
+	getrusage(RUSAGE_SELF, &usage);
+	cpu_user = tv_secs(&usage.ru_utime) - tv_secs(&begin_usage.ru_utime);
+	cpu_sys  = tv_secs(&usage.ru_stime) - tv_secs(&begin_usage.ru_stime);
+
+	/* Frames that reached the last stage. */
+	if (stop == STAGE_DEMUX)
+		frames = stats.pkts_read;
+	else if (stop == STAGE_PRESENT)
+		frames = stats.frames_presented;
+	else
+		frames = stats.frames_decoded;
+
+	fprintf(f, "{\n  \"file\": ");
+	json_str(f, file);
+	fprintf(f, ",\n  \"codec\": ");
+	json_str(f, dp->codec_context->codec->name);
+	fprintf(f, ",\n  \"width\": %d,\n  \"height\": %d,\n",
+		dp->codec_context->width, dp->codec_context->height);
+	fprintf(f, "  \"threads\": %d,\n", dp->codec_context->thread_count);
+	fprintf(f, "  \"pool_threads\": %d,\n", stats.pool_threads);
+	fprintf(f, "  \"fps_cap\": %.3f,\n", dp->fps_cap);
+	fprintf(f, "  \"stop\": \"%s\",\n  \"renderer\": ", stage_names[stop]);
+	if (renderer)
+		json_str(f, renderer);
+	else
+		fprintf(f, "null");
+
+	fprintf(f,
+		",\n"
+		"  \"frames\": %lu,\n"
+		"  \"frames_dropped\": %lu,\n"
+		"  \"frames_skipped\": %lu,\n"
+		"  \"frames_still\": %lu,\n"
+		"  \"frames_evicted\": %lu,\n"
+		"  \"rendition_switches\": %lu,\n"
+		"  \"wall_s\": %.6f,\n"
+		"  \"fps\": %.3f,\n"
+		"  \"cpu_user_s\": %.6f,\n"
+		"  \"cpu_sys_s\": %.6f,\n"
+		"  \"cpu_ms_per_frame\": %.6f,\n"
+		"  \"peak_rss_kb\": %ld,\n"
+		"  \"ctx_switches\": %ld,\n"
+		"  \"wakeups_per_s\": %.3f,\n"
+		"  \"upload_area_pct\": %.3f,\n"
+		"  \"avg_queue_depth\": %.3f,\n"
+		"  \"queue_max\": %d,\n"
+		"  \"queue_mem_kb\": %.0f,\n"
+		"  \"stage_ms_per_frame\": {",
+		frames, stats.frames_dropped, stats.frames_skipped,
+		stats.frames_still, stats.frames_evicted, stats.rendition_switches,
+		wall,
+		wall > 0 ? (double)frames / wall : 0.0,
+		cpu_user, cpu_sys,
+		frames ? (cpu_user + cpu_sys) * 1000.0 / (double)frames : 0.0,
+		usage.ru_maxrss, usage.ru_nvcsw + usage.ru_nivcsw,
+		wall > 0 ? stats.wakeups / wall : 0.0,
+		stats.dirty_frames ? stats.dirty_area / stats.dirty_frames : 100.0,
+		stats.queue_depth_samples ?
+			stats.queue_depth_sum / stats.queue_depth_samples : 0.0,
+		stats.queue_max, stats.queue_max * stats.queue_frame_bytes / 1024.0);
+
+	for (i = 0; i <= stop; i++)
+	{
+		fprintf(f, "%s\n    \"%s\": %.6f", (i ? "," : ""), stage_names[i],
+			frames ? stats.stage_secs[i] * 1000.0 / (double)frames : 0.0);
+	}
+	fprintf(f, "\n  }\n}\n");
+}
@@ -0,0 +1,451 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021-2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <X11/Xlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "anipaper.h"
+
+/*
+ * First-run auto-tuning.
+ *
+ * Each candidate configuration is trialed on the actual file:
+ * a child process (this very binary, with the user options plus
+ * the candidate ones) runs the headless pacing test for
+ * AUTOTUNE_TRIAL_SECS. A candidate qualifies if the pacing test
+ * passes, and its cost is the CPU time (user and system) of the
+ * child.
+ *
+ * The knobs are tuned one at a time (coordinate descent), each
+ * one starting from the best configuration so far, and a new
+ * value must be cheaper by TUNE_MIN_GAIN to be kept, so the
+ * noise does not pick the configuration.
+ *
+ * The result is cached, keyed by the machine (machine id, CPUs,
+ * memory and CPU model), the file (path, size and modification
+ * time) and the user options: if any of them changes, so does
+ * the key, and the next run tunes again.
+ */
+
+/* Largest amount of user options passed to the trials. */
+#define TUNE_MAX_ARGS 128
+
+/* Relative cost reduction a knob must bring to be kept. */
+#define TUNE_MIN_GAIN 0.05
+
+/* Adaptive picture queue tried: up to the default depth. */
+#define TUNE_QUEUE_MIN LOOKAHEAD_MIN_DEPTH
+#define TUNE_QUEUE_MAX 8
+
+/* Decoding threads tried, 0 meaning one per CPU. */
+static const int tune_threads[] = {1, 2, 4, 0};
+#define TUNE_NR_THREADS ((int)(sizeof(tune_threads) / sizeof(tune_threads[0])))
+
+/* Trial parameters. */
+static char **user_args;
+static int nuser_args;
+static const char *input_file;
+
+/**
+ * @brief Appends the options of the configuration @p c to
+ * @p args.
+ *
+ * @param c Configuration.
+ * @param args Arguments list.
+ * @param n Amount of arguments already in @p args.
+ * @param threads Buffer for the threads argument.
+ * @param queue Buffer for the queue depth argument.
+ *
+ * @return Returns the new amount of arguments.
+ */
+static int config_args(const struct tune_config *c, char **args, int n,
+	char *threads, char *queue)
+{
+	if (c->threads >= 0)
+	{
+		sprintf(threads, "%d", c->threads);
+		args[n++] = "--threads";
+		args[n++] = threads;
+	}
+	if (c->coop)
+		args[n++] = "--single-thread";
+	if (c->dirty_rects)
+		args[n++] = "--dirty-rects";
+	if (c->queue_min)
+	{
+		sprintf(queue, "%d:%d", c->queue_min, c->queue_max);
+		args[n++] = "--queue-depth";
+		args[n++] = queue;
+	}
+	if (c->renditions)
+		args[n++] = "--renditions";
+	return (n);
+}
+
+/**
+ * @brief Describes the configuration @p c (its options) into
+ * @p buf, for the logs.
+ *
+ * @param c Configuration.
+ * @param buf Output buffer.
+ * @param size Buffer size.
+ */
+static void config_describe(const struct tune_config *c, char *buf,
+	size_t size)
+{
+	char *args[16];
+	char threads[16];
+	char queue[32];
+	size_t len;
+	int n;
+	int i;
+
+	n = config_args(c, args, 0, threads, queue);
+	buf[0] = '\0';
+	for (i = 0, len = 0; i < n && len < size; i++)
+		len += snprintf(buf + len, size - len, "%s%s", i ? " " : "", args[i]);
+
+	if (!n)
+		snprintf(buf, size, "defaults");
+}
+
+/**
+ * @brief Trials the configuration @p c: runs the headless
+ * pacing test with it, in a child process.
+ *
+ * @param c Configuration.
+ *
+ * @return Returns the CPU time (in seconds) spent by the
+ * trial, or -1 if it does not meet the pacing target (or
+ * could not run).
+ */
+static double trial(const struct tune_config *c)
+{
+	char *args[TUNE_MAX_ARGS + 16];
+	char desc[128];
+	char secs[16];
+	char threads[16];
+	char queue[32];
+	struct rusage before;
+	struct rusage after;
+	double cpu;
+	pid_t pid;
+	int status;
+	int fd;
+	int n;
+
+	memcpy(args, user_args, nuser_args * sizeof(*args));
+	n = nuser_args;
+
+	sprintf(secs, "%d", AUTOTUNE_TRIAL_SECS);
+	args[n++] = "--bench-pacing";
+	args[n++] = secs;
+	n = config_args(c, args, n, threads, queue);
+	args[n++] = (char *)input_file;
+	args[n] = NULL;
+
+	getrusage(RUSAGE_CHILDREN, &before);
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if (pid < 0)
+		return (-1.0);
+
+	/* The pacing report and logs are not needed, only the status. */
+	if (!pid)
+	{
+		fd = open("/dev/null", O_WRONLY);
+		if (fd >= 0)
+		{
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		execv("/proc/self/exe", args);
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) < 0)
+		return (-1.0);
+	getrusage(RUSAGE_CHILDREN, &after);
+
+	cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) +
+		(after.ru_stime.tv_sec - before.ru_stime.tv_sec) +
+		((after.ru_utime.tv_usec - before.ru_utime.tv_usec) +
+		 (after.ru_stime.tv_usec - before.ru_stime.tv_usec)) / 1000000.0;
+
+	config_describe(c, desc, sizeof(desc));
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+	{
+		LOG("tune: %s: pacing target missed\n", desc);
+		return (-1.0);
+	}
+
+	LOG("tune: %s: %.1f%% CPU\n", desc, cpu * 100.0 / AUTOTUNE_TRIAL_SECS);
+	return (cpu);
+}
+
+/**
+ * @brief Trials the configuration @p c and keeps it as the
+ * best one if it meets the pacing target and is cheaper
+ * enough than the best one so far.
+ *
+ * @param c Candidate configuration.
+ * @param best Best configuration so far.
+ * @param best_cost Cost of @p best, -1 if none met the
+ * target yet.
+ */
+static void try_config(const struct tune_config *c, struct tune_config *best,
+	double *best_cost)
+{
+	double cost;
+
+	cost = trial(c);
+	if (cost < 0)
+		return;
+
+	if (*best_cost < 0 || cost < *best_cost * (1.0 - TUNE_MIN_GAIN))
+	{
+		*best = *c;
+		*best_cost = cost;
+	}
+}
+
+/**
+ * @brief Reads the CPU model name into @p buf.
+ *
+ * @param buf Output buffer.
+ * @param size Buffer size.
+ */
+static void cpu_model(char *buf, size_t size)
+{
+	char line[256];
+	char *p;
+	FILE *f;
+
+	buf[0] = '\0';
+	f = fopen("/proc/cpuinfo", "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (strncmp(line, "model name", 10) || !(p = strchr(line, ':')))
+			continue;
+		p += strspn(p + 1, " \t") + 1;
+		p[strcspn(p, "\n")] = '\0';
+		snprintf(buf, size, "%s", p);
+		break;
+	}
+	fclose(f);
+}
+
+/**
+ * @brief Builds the cache path of the tuning of @p file
+ * into @p path, from the machine, the file and the user
+ * options.
+ *
+ * @param file Input file.
+ * @param path Output buffer.
+ * @param size Buffer size.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int tune_path(const char *file, char *path, size_t size)
+{
+	char key[PATH_MAX + 1024];
+	char real[PATH_MAX];
+	char model[128];
+	char id[128];
+	struct stat st;
+	size_t len;
+	int i;
+
+	if (stat(file, &st) < 0 || !realpath(file, real))
+		return (-1);
+
+	machine_id(id, sizeof(id));
+	cpu_model(model, sizeof(model));
+
+	len = snprintf(key, sizeof(key), "%s:%d:%d:%s:%s:%lld:%lld", id,
+		SDL_GetCPUCount(), SDL_GetSystemRAM(), model, real,
+		(long long)st.st_size, (long long)st.st_mtime);
+
+	/* Tuning itself does not change the result. */
+	for (i = 1; i < nuser_args && len < sizeof(key); i++)
+	{
+		if (strcmp(user_args[i], "--auto-tune") &&
+			strcmp(user_args[i], "--retune"))
+		{
+			len += snprintf(key + len, sizeof(key) - len, ":%s",
+				user_args[i]);
+		}
+	}
+
+	return (cache_path(path, size, "tune", key));
+}
+
+/**
+ * @brief Picks the cheapest configuration that meets the
+ * pacing target for the input file @p file on this machine:
+ * reads it from the cache or, if not tuned yet (or if asked
+ * to), trials the candidates and caches the result.
+ *
+ * @param args User options (and the program name), passed
+ * to each trial.
+ * @param nargs Amount of user options (and program name).
+ * @param file Input file.
+ * @param fixed Knobs set by the user (TUNE_*), not tuned.
+ * @param retune Non-zero to ignore the cache.
+ * @param cfg Output configuration, knobs not tuned are left
+ * unset (-1/0).
+ *
+ * @return Returns 0 if success, -1 if no configuration meets
+ * the pacing target (or error).
+ */
+int tune_config(char **args, int nargs, const char *file, int fixed,
+	int retune, struct tune_config *cfg)
+{
+	struct tune_config best = {-1, 0, 0, 0, 0, 0};
+	struct tune_config c;
+	char path[PATH_MAX + 64];
+	char desc[128];
+	double cost;
+	int ncpus;
+	int i;
+	FILE *f;
+
+	if (nargs > TUNE_MAX_ARGS)
+		LOG_GOTO("tune: too many options!\n", out);
+
+	user_args  = args;
+	nuser_args = nargs;
+	input_file = file;
+
+	if (tune_path(file, path, sizeof(path)) < 0)
+		path[0] = '\0';
+
+	/* Already tuned. */
+	if (!retune && path[0] && (f = fopen(path, "r")) != NULL)
+	{
+		if (fscanf(f, "%d %d %d %d %d %d %lf", &cfg->threads, &cfg->coop,
+			&cfg->dirty_rects, &cfg->queue_min, &cfg->queue_max,
+			&cfg->renditions, &cost) == 7)
+		{
+			fclose(f);
+			config_describe(cfg, desc, sizeof(desc));
+			LOG("tune: %s (cached, %.1f%% CPU)\n", desc,
+				cost * 100.0 / AUTOTUNE_TRIAL_SECS);
+			return (0);
+		}
+		fclose(f);
+	}
+
+	LOG("tune: trialing configurations, %ds each...\n",
+		AUTOTUNE_TRIAL_SECS);
+
+	cost = trial(&best);
+	ncpus = SDL_GetCPUCount();
+
+	/* Decoding threads, a single thread may also go cooperative. */
+	if (!(fixed & TUNE_THREADS))
+	{
+		for (i = 0; i < TUNE_NR_THREADS; i++)
+		{
+			if (tune_threads[i] > ncpus)
+				continue;
+			c = best;
+			c.threads = tune_threads[i];
+			try_config(&c, &best, &cost);
+		}
+	}
+	if (!(fixed & TUNE_COOP) && best.threads == 1)
+	{
+		c = best;
+		c.coop = 1;
+		try_config(&c, &best, &cost);
+	}
+
+	/* Texture path: partial uploads. */
+	if (!(fixed & TUNE_DIRTY_RECTS))
+	{
+		c = best;
+		c.dirty_rects = 1;
+		try_config(&c, &best, &cost);
+	}
+
+	/* Picture queue: sized from the decode jitter. */
+	if (!(fixed & TUNE_QUEUE))
+	{
+		c = best;
+		c.queue_min = TUNE_QUEUE_MIN;
+		c.queue_max = TUNE_QUEUE_MAX;
+		try_config(&c, &best, &cost);
+	}
+
+	/* Smaller rendition, if any. */
+	if (!(fixed & TUNE_RENDITIONS))
+	{
+		c = best;
+		c.renditions = 1;
+		try_config(&c, &best, &cost);
+	}
+
+	if (cost < 0)
+		LOG_GOTO("tune: no configuration meets the pacing target!\n", out);
+
+	*cfg = best;
+	config_describe(cfg, desc, sizeof(desc));
+	LOG("tune: %s selected\n", desc);
+	if (!path[0])
+		return (0);
+
+	cache_mkdir(path);
+	f = fopen(path, "w");
+	if (!f)
+	{
+		LOG("tune: unable to save the configuration to %s\n", path);
+		return (0);
+	}
+	fprintf(f, "%d %d %d %d %d %d %.6f\n", cfg->threads, cfg->coop,
+		cfg->dirty_rects, cfg->queue_min, cfg->queue_max, cfg->renditions,
+		cost);
+	fclose(f);
+	return (0);
+out:
+	return (-1);
+}